@@ -1,15 +1,20 @@
+#include <algorithm>
+#include <filesystem>
+#include <format>
 #include <limits>
 #include <random>
 #include <string>
-#include <thread>
 #include <utility>
 #include <vector>
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include "checkpoint.h"
+#include "dominance_cache.h"
 #include "extend_network.h"
 #include "network.h"
+#include "network_score.h"
 #include "network_utils.h"
 
 DEFINE_bool(symmetric, false, "Build symmetric networks.");
@@ -18,8 +23,16 @@ DEFINE_string(output_path, "", "Path to the output file.");
 DEFINE_int32(keep_best_count, std::numeric_limits<int>::max(),
              "Number of networks to keep after adding each comparator. "
              "Default is to keep all networks.");
-DEFINE_int32(jobs, std::thread::hardware_concurrency(),
-             "The number of workers to use for parallel processing.");
+DEFINE_string(dominance_cache_path, "",
+              "If set, the cached subset-isomorphism results are loaded from "
+              "this file (if it exists) and saved to it at the end.");
+DEFINE_bool(pipeline, false,
+            "Overlap the steps: the networks kept by a step are extended by "
+            "the next one while the step checks the redundancy of the others. "
+            "The result is the same.");
+DEFINE_int32(seed, 0,
+             "The random seed. The output only depends on it and on the "
+             "input, not on --jobs.");
 
 int main(int argc, char *argv[]) {
   FLAGS_alsologtostderr = true;
@@ -31,32 +44,72 @@ int main(int argc, char *argv[]) {
   CHECK(!FLAGS_output_path.empty());
   CHECK(!FLAGS_input_path.empty());
 
-  std::vector<Network> networks = LoadFromProtoFile(FLAGS_input_path);
+  std::vector<Network> networks;
+  std::mt19937 gen(FLAGS_seed);
+  Checkpointer checkpointer(
+      FLAGS_checkpoint_dir,
+      std::format("add_comparators_main symmetric={} input_path={} "
+                  "keep_best_count={} network_score={} pipeline={} seed={}",
+                  FLAGS_symmetric, FLAGS_input_path, FLAGS_keep_best_count,
+                  FLAGS_network_score, FLAGS_pipeline, FLAGS_seed));
+  // The step is the number of comparators added to the new layer.
+  int resumed_step = FLAGS_resume ? checkpointer.Load(&networks, &gen) : -1;
+  if (resumed_step < 0) {
+    networks = LoadFromProtoFile(FLAGS_input_path);
+  }
   CHECK(!networks.empty());
 
-  std::mt19937 gen;
+  if (!FLAGS_dominance_cache_path.empty() &&
+      std::filesystem::exists(FLAGS_dominance_cache_path)) {
+    DominanceCache::Default().Load(FLAGS_dominance_cache_path);
+  }
+
   int n = networks[0].n;
   int num_layers = networks[0].layers.size();
-  LOG(INFO) << "Add one layer on " << num_layers << " layers";
-
-  for (auto &network : networks) {
-    if (FLAGS_symmetric) {
-      CHECK(network.IsSymmetric());
+  if (resumed_step < 0) {
+    LOG(INFO) << "Add one layer on " << num_layers << " layers";
+    for (auto &network : networks) {
+      if (FLAGS_symmetric) {
+        CHECK(network.IsSymmetric());
+      }
+      CHECK_EQ(network.n, n);
+      CHECK_EQ(network.layers.size(), num_layers);
+      network.AddEmptyLayer();
     }
-    CHECK_EQ(network.n, n);
-    CHECK_EQ(network.layers.size(), num_layers);
-    network.AddEmptyLayer();
   }
-  for (int num_comps = 0; num_comps < n / 2; ++num_comps) {
-    LOG(INFO) << "Add one comparator on " << num_comps << " comparators";
-    networks = ExtendNetwork(n, networks, FLAGS_symmetric, true,
-                             FLAGS_keep_best_count, FLAGS_jobs, &gen);
-    LOG(INFO) << "After cleanup: networks.size()=" << networks.size();
+  NetworkScore score = NetworkScore::FromFlags();
+  if (FLAGS_pipeline) {
+    // The steps overlap, so there is no set of networks between two of them
+    // to save: only the input of the first step is saved.
+    if (resumed_step < 0) {
+      checkpointer.Save(0, networks, gen);
+      checkpointer.Wait();
+    }
+    networks =
+        AddComparatorsPipelined(n, std::move(networks), FLAGS_symmetric, n / 2,
+                                FLAGS_keep_best_count, &gen, score);
+  } else {
+    for (int num_comps = std::max(resumed_step, 0); num_comps < n / 2;
+         ++num_comps) {
+      LOG(INFO) << "Add one comparator on " << num_comps << " comparators";
+      if (num_comps != resumed_step) {
+        checkpointer.Save(num_comps, networks, gen);
+      }
+      std::vector<Network> extended_networks =
+          ExtendNetwork(n, networks, FLAGS_symmetric, true,
+                        FLAGS_keep_best_count, &gen, score);
+      checkpointer.Wait();
+      networks = std::move(extended_networks);
+      LOG(INFO) << "After cleanup: networks.size()=" << networks.size();
+    }
   }
 
   LOG(INFO) << "Saving " << networks.size() << " networks to "
             << FLAGS_output_path;
   SaveToProtoFile(networks, FLAGS_output_path);
+  if (!FLAGS_dominance_cache_path.empty()) {
+    DominanceCache::Default().Save(FLAGS_dominance_cache_path);
+  }
 
   return 0;
 }
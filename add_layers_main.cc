@@ -8,10 +8,13 @@ the prefix to shrink the outputs, even under permutation.
 The first layer is (0,1),(2,3),....
 */
 
+#include <algorithm>
+#include <filesystem>
+#include <format>
 #include <limits>
+#include <optional>
 #include <random>
 #include <string>
-#include <thread>
 #include <utility>
 #include <vector>
 
@@ -19,22 +22,33 @@ The first layer is (0,1),(2,3),....
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include "checkpoint.h"
+#include "clean_up.h"
+#include "dominance_cache.h"
 #include "extend_network.h"
 #include "network.h"
+#include "network_score.h"
 #include "network_utils.h"
+#include "prefix_database.h"
 
 DEFINE_int32(n, 0, "The number of channels.");
 DEFINE_bool(symmetric, false, "Build symmetric networks.");
 DEFINE_int32(input_depth, 1, "The depth of the input prefixes.");
-DEFINE_string(input_path, "", "The input prefixes file.");
+DEFINE_string(input_path, "",
+              "The input prefixes file. If empty, the input is the first "
+              "layer, and --input_depth must be 1.");
 DEFINE_int32(output_depth, 0, "The depth of the output prefixes.");
 DEFINE_string(output_path, "", "The output prefixes file.");
 DEFINE_string(
     keep_best_count, "",
     "The number of networks to keep for each depth, separated by commas. "
     "If empty, all networks will be kept.");
-DEFINE_int32(jobs, std::thread::hardware_concurrency(),
-             "The number of workers to use for parallel processing.");
+DEFINE_string(dominance_cache_path, "",
+              "If set, the cached subset-isomorphism results are loaded from "
+              "this file (if it exists) and saved to it at the end.");
+DEFINE_int32(seed, 0,
+             "The random seed. The output only depends on it and on the "
+             "input, not on --jobs.");
 
 std::vector<int> ParseKeepBestCount() {
   if (FLAGS_keep_best_count.empty()) {
@@ -58,6 +72,23 @@ std::vector<int> ParseKeepBestCount() {
   return keep_best_counts;
 }
 
+std::vector<Network> LoadInputs() {
+  LOG(INFO) << "Loading networks from " << FLAGS_input_path;
+  std::vector<Network> networks;
+  if (FLAGS_input_path.empty()) {
+    CHECK_EQ(FLAGS_input_depth, 1);
+    networks = CreateFirstLayer(FLAGS_n, FLAGS_symmetric);
+  } else {
+    networks = LoadFromProtoFile(FLAGS_input_path, FLAGS_n);
+  }
+
+  for (const auto &network : networks) {
+    CHECK_EQ(network.layers.size(), FLAGS_input_depth);
+  }
+  LOG(INFO) << "Loaded " << networks.size() << " networks";
+  return networks;
+}
+
 int main(int argc, char *argv[]) {
   FLAGS_alsologtostderr = true;
   FLAGS_log_dir = "/tmp";
@@ -69,37 +100,100 @@ int main(int argc, char *argv[]) {
   CHECK(!FLAGS_output_path.empty());
 
   std::vector<Network> networks;
-  LOG(INFO) << "Loading networks from " << FLAGS_input_path;
-  if (FLAGS_input_depth == 1) {
-    CHECK(FLAGS_input_path.empty());
-    networks = CreateFirstLayer(FLAGS_n, FLAGS_symmetric);
-  } else {
-    CHECK(!FLAGS_input_path.empty());
-    networks = LoadFromProtoFile(FLAGS_input_path, FLAGS_n);
+  std::mt19937 gen(FLAGS_seed);
+  // The steps are the depths after the input depth.
+  Checkpointer checkpointer(
+      FLAGS_checkpoint_dir,
+      std::format("add_layers_main n={} symmetric={} input_depth={} "
+                  "input_path={} output_depth={} keep_best_count={} "
+                  "network_score={} prefix_db={} seed={}",
+                  FLAGS_n, FLAGS_symmetric, FLAGS_input_depth,
+                  FLAGS_input_path, FLAGS_output_depth, FLAGS_keep_best_count,
+                  FLAGS_network_score, FLAGS_prefix_db, FLAGS_seed));
+  int resumed_step = FLAGS_resume ? checkpointer.Load(&networks, &gen) : -1;
+  if (resumed_step < 0) {
+    networks = LoadInputs();
   }
 
-  for (const auto &network : networks) {
-    CHECK_EQ(network.layers.size(), FLAGS_input_depth);
+  std::vector<int> keep_best_counts = ParseKeepBestCount();
+
+  if (!FLAGS_dominance_cache_path.empty() &&
+      std::filesystem::exists(FLAGS_dominance_cache_path)) {
+    DominanceCache::Default().Load(FLAGS_dominance_cache_path);
   }
-  LOG(INFO) << "Loaded " << networks.size() << " networks";
 
-  std::vector<int> keep_best_counts = ParseKeepBestCount();
+  std::optional<PrefixDatabase> prefix_db;
+  if (!FLAGS_prefix_db.empty()) {
+    // The entries are the ones of the input, which a resumed run loads again.
+    prefix_db.emplace(
+        FLAGS_prefix_db,
+        PrefixDatabase::Root(resumed_step < 0 ? networks : LoadInputs(),
+                             FLAGS_symmetric));
+  }
+  // Whether the networks are all the non-redundant extensions of the input of
+  // their depth: the input is, and so are the extensions of all of them, or
+  // the complete prefixes of the database, that are all kept.
+  bool complete = true;
+  for (int step = 0; step < resumed_step; step++) {
+    // The entry of the depth of an earlier step is complete if it was when the
+    // step ran, or if the step made it so, which gives the same result.
+    bool entry_complete =
+        prefix_db &&
+        prefix_db->Load(FLAGS_n, FLAGS_input_depth + step + 1, FLAGS_symmetric)
+            .complete;
+    complete = (complete || entry_complete) &&
+               keep_best_counts.at(step) == std::numeric_limits<int>::max();
+  }
 
-  std::mt19937 gen;
-  for (int depth = FLAGS_input_depth; depth < FLAGS_output_depth; depth++) {
+  NetworkScore score = NetworkScore::FromFlags();
+  for (int depth = FLAGS_input_depth + std::max(resumed_step, 0);
+       depth < FLAGS_output_depth; depth++) {
     LOG(INFO) << "Extending networks from depth " << depth << " to "
               << depth + 1;
-    for (auto &network : networks) {
-      network.AddEmptyLayer();
+    int step = depth - FLAGS_input_depth;
+    // A resumed step starts from the networks of its checkpoint, which
+    // already have the empty layer.
+    if (step != resumed_step) {
+      for (auto &network : networks) {
+        network.AddEmptyLayer();
+      }
+      checkpointer.Save(step, networks, gen);
     }
-    networks = ExtendNetwork(FLAGS_n, networks, FLAGS_symmetric, false,
-                             keep_best_counts.at(depth - FLAGS_input_depth),
-                             FLAGS_jobs, &gen);
+    int keep_best_count = keep_best_counts.at(step);
+    // The prefixes of the next depth found by the previous runs. If they are
+    // all of them, the networks are not extended.
+    PrefixDatabase::Entry entry;
+    if (prefix_db) {
+      entry = prefix_db->Load(FLAGS_n, depth + 1, FLAGS_symmetric);
+    }
+    std::vector<Network> extended_networks;
+    if (entry.complete) {
+      LOG(INFO) << "Taking the networks of depth " << depth + 1
+                << " from the prefix database";
+      extended_networks = CleanUp(std::move(entry.networks), FLAGS_symmetric,
+                                  keep_best_count, &gen, score);
+    } else {
+      extended_networks =
+          ExtendNetwork(FLAGS_n, networks, FLAGS_symmetric, false,
+                        keep_best_count, &gen, score, entry.networks);
+    }
+    bool keep_all = keep_best_count == std::numeric_limits<int>::max();
+    complete = (complete || entry.complete) && keep_all;
+    if (prefix_db) {
+      // Unless some are dropped, the networks were cleaned up with the entry,
+      // so they replace it.
+      prefix_db->Add(extended_networks, FLAGS_symmetric, complete, keep_all);
+    }
+    checkpointer.Wait();
+    networks = std::move(extended_networks);
   }
 
   LOG(INFO) << "Saving " << networks.size() << " networks to "
             << FLAGS_output_path;
   SaveToProtoFile(networks, FLAGS_output_path);
+  if (!FLAGS_dominance_cache_path.empty()) {
+    DominanceCache::Default().Save(FLAGS_dominance_cache_path);
+  }
 
   return 0;
 }
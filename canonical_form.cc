@@ -0,0 +1,275 @@
+#include "canonical_form.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <numeric>
+#include <span>
+#include <tuple>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace {
+
+// The maximum number of automorphisms kept for pruning.
+constexpr int kMaxAutomorphisms = 64;
+
+uint64_t Mix(uint64_t x) {
+  // The finalizer of splitmix64.
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// Replaces the keys by their ranks among the distinct keys and returns the
+// number of distinct keys.
+template <typename Key>
+int RankColors(const std::vector<Key> &keys, std::vector<uint32_t> *colors) {
+  int n = keys.size();
+  std::vector<int> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](int a, int b) { return keys[a] < keys[b]; });
+  int num_colors = 0;
+  for (int k = 0; k < n; k++) {
+    if (k > 0 && keys[order[k - 1]] < keys[order[k]]) {
+      num_colors++;
+    }
+    (*colors)[order[k]] = num_colors;
+  }
+  return num_colors + 1;
+}
+
+class CanonicalFormSearch {
+public:
+  CanonicalFormSearch(int n, std::span<const OutputType> set, bool symmetric,
+                      int max_leaves)
+      : n_(n), set_(set), symmetric_(symmetric), max_leaves_(max_leaves),
+        num_positions_(symmetric ? n / 2 : n) {
+    if (symmetric) {
+      CHECK_EQ(n % 2, 0);
+    }
+  }
+
+  std::vector<OutputType> Run(std::vector<int> *positions) {
+    // The initial colors are the column counts.
+    std::vector<uint32_t> counts(n_, 0);
+    for (OutputType x : set_) {
+      for (OutputType y = x; y; y &= y - 1) {
+        counts[std::countr_zero(y)]++;
+      }
+    }
+    std::vector<uint32_t> colors(n_);
+    RankColors(counts, &colors);
+    Refine(&colors);
+    std::vector<int> prefix;
+    Visit(colors, &prefix);
+    if (positions != nullptr) {
+      *positions = best_positions_;
+    }
+    return best_;
+  }
+
+private:
+  // Refines the colors until the number of colors is stable.
+  void Refine(std::vector<uint32_t> *colors) const {
+    int num_colors = 0;
+    std::vector<uint64_t> color_hash(n_);
+    std::vector<uint64_t> col_hash(n_);
+    std::vector<std::tuple<uint32_t, uint64_t, uint32_t>> keys(n_);
+    while (true) {
+      for (int c = 0; c < n_; c++) {
+        color_hash[c] = Mix((*colors)[c] + 1);
+      }
+      // A column is described by the multiset of the colors of the outputs
+      // that contain it, and an output by the multiset of its channel colors.
+      std::fill(col_hash.begin(), col_hash.end(), 0);
+      for (OutputType x : set_) {
+        uint64_t row_hash = 0;
+        for (OutputType y = x; y; y &= y - 1) {
+          row_hash += color_hash[std::countr_zero(y)];
+        }
+        row_hash = Mix(row_hash);
+        for (OutputType y = x; y; y &= y - 1) {
+          col_hash[std::countr_zero(y)] += row_hash;
+        }
+      }
+      for (int c = 0; c < n_; c++) {
+        keys[c] = {(*colors)[c], col_hash[c],
+                   symmetric_ ? (*colors)[n_ - 1 - c] : 0};
+      }
+      int new_num_colors = RankColors(keys, colors);
+      if (new_num_colors == num_colors) {
+        return;
+      }
+      num_colors = new_num_colors;
+    }
+  }
+
+  // Returns the position of each column for a complete prefix.
+  std::vector<int> Positions(const std::vector<int> &prefix) const {
+    std::vector<int> positions(n_);
+    for (int p = 0; p < num_positions_; p++) {
+      positions[prefix[p]] = p;
+      if (symmetric_) {
+        positions[n_ - 1 - prefix[p]] = n_ - 1 - p;
+      }
+    }
+    return positions;
+  }
+
+  bool IsAssigned(const std::vector<int> &prefix, int c) const {
+    for (int p : prefix) {
+      if (p == c || (symmetric_ && p == n_ - 1 - c)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Visit(const std::vector<uint32_t> &colors, std::vector<int> *prefix) {
+    if (num_leaves_ >= max_leaves_) {
+      return;
+    }
+    if (prefix->size() == num_positions_) {
+      VisitLeaf(*prefix);
+      return;
+    }
+
+    // The candidates for the next position are the unassigned columns of the
+    // smallest color.
+    std::vector<int> candidates;
+    for (int c = 0; c < n_; c++) {
+      if (IsAssigned(*prefix, c)) {
+        continue;
+      }
+      if (!candidates.empty() && colors[c] < colors[candidates[0]]) {
+        candidates.clear();
+      }
+      if (candidates.empty() || colors[c] == colors[candidates[0]]) {
+        candidates.push_back(c);
+      }
+    }
+
+    // The orbits of the candidates under the automorphisms that fix the
+    // prefix.
+    std::vector<int> orbit(n_);
+    std::iota(orbit.begin(), orbit.end(), 0);
+    auto find = [&](int c) {
+      while (orbit[c] != c) {
+        c = orbit[c] = orbit[orbit[c]];
+      }
+      return c;
+    };
+    if (candidates.size() > 1) {
+      for (const std::vector<int> &g : automorphisms_) {
+        if (std::all_of(prefix->begin(), prefix->end(),
+                        [&](int c) { return g[c] == c; })) {
+          for (int c = 0; c < n_; c++) {
+            orbit[find(c)] = find(g[c]);
+          }
+        }
+      }
+    }
+
+    std::vector<int> explored_orbits;
+    for (int c : candidates) {
+      int root = find(c);
+      if (std::find(explored_orbits.begin(), explored_orbits.end(), root) !=
+          explored_orbits.end()) {
+        continue;
+      }
+      explored_orbits.push_back(root);
+      std::vector<uint32_t> child_colors = colors;
+      for (int d = 0; d < n_; d++) {
+        child_colors[d] = 3 * colors[d] + 2;
+      }
+      child_colors[c] = 3 * colors[c];
+      if (symmetric_) {
+        child_colors[n_ - 1 - c] = 3 * colors[n_ - 1 - c] + 1;
+      }
+      Refine(&child_colors);
+      prefix->push_back(c);
+      Visit(child_colors, prefix);
+      prefix->pop_back();
+      if (num_leaves_ >= max_leaves_) {
+        return;
+      }
+    }
+  }
+
+  void VisitLeaf(const std::vector<int> &prefix) {
+    num_leaves_++;
+    std::vector<int> positions = Positions(prefix);
+    std::vector<OutputType> image;
+    image.reserve(set_.size());
+    for (OutputType x : set_) {
+      OutputType y = 0;
+      for (OutputType z = x; z; z &= z - 1) {
+        y |= OutputType(1) << positions[std::countr_zero(z)];
+      }
+      image.push_back(y);
+    }
+    std::sort(image.begin(), image.end());
+    if (best_positions_.empty() || image < best_) {
+      best_ = std::move(image);
+      best_positions_ = std::move(positions);
+      return;
+    }
+    if (image == best_ && automorphisms_.size() < kMaxAutomorphisms) {
+      // best_positions^-1 o positions maps the set to itself.
+      std::vector<int> best_columns(n_);
+      for (int c = 0; c < n_; c++) {
+        best_columns[best_positions_[c]] = c;
+      }
+      std::vector<int> g(n_);
+      for (int c = 0; c < n_; c++) {
+        g[c] = best_columns[positions[c]];
+      }
+      automorphisms_.push_back(std::move(g));
+    }
+  }
+
+  int n_;
+  std::span<const OutputType> set_;
+  bool symmetric_;
+  int max_leaves_;
+  int num_positions_;
+  int num_leaves_ = 0;
+  std::vector<OutputType> best_;
+  std::vector<int> best_positions_;
+  std::vector<std::vector<int>> automorphisms_;
+};
+
+} // namespace
+
+std::vector<OutputType> CanonicalForm(int n, std::span<const OutputType> set,
+                                      bool symmetric, int max_leaves,
+                                      std::vector<int> *positions) {
+  CHECK_GT(max_leaves, 0);
+  return CanonicalFormSearch(n, set, symmetric, max_leaves).Run(positions);
+}
+
+std::vector<OutputType>
+CanonicalFormUpToInverse(int n, std::span<const OutputType> set,
+                         bool symmetric) {
+  // Flipping the bits reverses the order.
+  std::vector<OutputType> set_inv(set.rbegin(), set.rend());
+  for (OutputType &x : set_inv) {
+    x ^= (OutputType(1) << n) - 1;
+  }
+  return std::min(CanonicalForm(n, set, symmetric),
+                  CanonicalForm(n, set_inv, symmetric));
+}
+
+uint64_t HashOutputs(const std::vector<OutputType> &set) {
+  uint64_t hash = Mix(set.size());
+  for (OutputType x : set) {
+    hash = Mix(hash ^ x);
+  }
+  return hash;
+}
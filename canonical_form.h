@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "output_type.h"
+
+// Canonical forms of sets of outputs under permutations of the n channels, or
+// under the permutations that commute with the reflection i -> n-1-i if
+// symmetric.
+//
+// The channels are colored by their column counts, and the coloring is refined
+// by the colors of the outputs that contain each channel until it is stable.
+// When a color class has several channels, each of them is individualized in
+// turn and refined again (as nauty does), and the canonical form is the
+// smallest permuted set over the leaves of this search. Branches that are
+// images of explored ones under the automorphisms found so far are skipped.
+//
+// The search visits at most max_leaves leaves. The result is always the set
+// permuted by some allowed permutation, so equal forms imply isomorphic sets.
+// If the budget runs out (only for sets with large automorphism groups that
+// the pruning misses), isomorphic sets may get different forms.
+//
+// If positions is not null, (*positions)[c] is set to the channel of the form
+// that the channel c of the set is moved to.
+std::vector<OutputType> CanonicalForm(int n, std::span<const OutputType> set,
+                                      bool symmetric, int max_leaves = 256,
+                                      std::vector<int> *positions = nullptr);
+
+// The canonical form of the set or of its inverse (all n bits flipped),
+// whichever is smaller: it is the same for the sets that are isomorphic up to
+// inversion.
+std::vector<OutputType>
+CanonicalFormUpToInverse(int n, std::span<const OutputType> set,
+                         bool symmetric);
+
+// Returns a hash of a sorted set of outputs.
+uint64_t HashOutputs(const std::vector<OutputType> &set);
@@ -0,0 +1,200 @@
+#include "canonical_form.h"
+
+#include <algorithm>
+#include <bit>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "isomorphism.h"
+#include "output_type.h"
+
+namespace {
+
+// Returns a random sorted set of outputs of n channels.
+std::vector<OutputType> RandomSet(int n, int size, std::mt19937 *gen) {
+  std::uniform_int_distribution<OutputType> dist(0, (OutputType(1) << n) - 1);
+  std::vector<OutputType> set;
+  for (int i = 0; i < size; i++) {
+    set.push_back(dist(*gen));
+  }
+  std::sort(set.begin(), set.end());
+  set.erase(std::unique(set.begin(), set.end()), set.end());
+  return set;
+}
+
+// Returns a random permutation of n channels, which commutes with the
+// reflection if symmetric.
+std::vector<int> RandomPermutation(int n, bool symmetric, std::mt19937 *gen) {
+  std::vector<int> perm(n);
+  std::iota(perm.begin(), perm.end(), 0);
+  if (!symmetric) {
+    std::shuffle(perm.begin(), perm.end(), *gen);
+    return perm;
+  }
+  std::vector<int> half(n / 2);
+  std::iota(half.begin(), half.end(), 0);
+  std::shuffle(half.begin(), half.end(), *gen);
+  for (int i = 0; i < n / 2; i++) {
+    int j = (*gen)() % 2 ? half[i] : n - 1 - half[i];
+    perm[i] = j;
+    perm[n - 1 - i] = n - 1 - j;
+  }
+  return perm;
+}
+
+std::vector<OutputType> Permute(const std::vector<OutputType> &set,
+                                const std::vector<int> &perm) {
+  std::vector<OutputType> result;
+  for (OutputType x : set) {
+    OutputType y = 0;
+    for (int i = 0; i < perm.size(); i++) {
+      y |= ((x >> i) & OutputType(1)) << perm[i];
+    }
+    result.push_back(y);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+// Returns the symmetric closure of a set: the set with ReflectAndInvert of
+// every output.
+std::vector<OutputType> Symmetrize(int n, std::vector<OutputType> set) {
+  int size = set.size();
+  for (int i = 0; i < size; i++) {
+    set.push_back(ReflectAndInvert(n, set[i]));
+  }
+  std::sort(set.begin(), set.end());
+  set.erase(std::unique(set.begin(), set.end()), set.end());
+  return set;
+}
+
+TEST(CanonicalFormTest, IsAPermutationOfTheSet) {
+  std::mt19937 gen(0);
+  for (int trial = 0; trial < 100; trial++) {
+    int n = 4 + trial % 3;
+    std::vector<OutputType> set = RandomSet(n, 1 + gen() % 20, &gen);
+    std::vector<int> positions;
+    std::vector<OutputType> form =
+        CanonicalForm(n, set, false, 256, &positions);
+    EXPECT_TRUE(std::is_sorted(form.begin(), form.end()));
+    EXPECT_EQ(Permute(set, positions), form);
+  }
+}
+
+TEST(CanonicalFormTest, InvariantUnderPermutations) {
+  std::mt19937 gen(0);
+  for (bool symmetric : {false, true}) {
+    for (int trial = 0; trial < 200; trial++) {
+      int n = 4 + 2 * (trial % 6);
+      std::vector<OutputType> set = RandomSet(n, 1 + gen() % 200, &gen);
+      if (symmetric) {
+        set = Symmetrize(n, set);
+      }
+      std::vector<OutputType> form = CanonicalForm(n, set, symmetric);
+      for (int k = 0; k < 3; k++) {
+        std::vector<OutputType> permuted =
+            Permute(set, RandomPermutation(n, symmetric, &gen));
+        ASSERT_EQ(CanonicalForm(n, permuted, symmetric), form)
+            << "symmetric=" << symmetric << " trial=" << trial;
+      }
+    }
+  }
+}
+
+TEST(CanonicalFormTest, DistinguishesNonIsomorphicSets) {
+  std::mt19937 gen(1);
+  int n = 5;
+  for (int trial = 0; trial < 200; trial++) {
+    std::vector<OutputType> a = RandomSet(n, 6, &gen);
+    // Half of the pairs differ by one output of a permutation of a.
+    std::vector<OutputType> b =
+        Permute(a, RandomPermutation(n, false, &gen));
+    if (trial % 2) {
+      b[gen() % b.size()] = gen() % (1 << n);
+      std::sort(b.begin(), b.end());
+      if (std::adjacent_find(b.begin(), b.end()) != b.end()) {
+        continue;
+      }
+    }
+    bool isomorphic = internal::IsIsomorphicToSubsetSlow(n, a, b);
+    EXPECT_EQ(CanonicalForm(n, a, false) == CanonicalForm(n, b, false),
+              isomorphic)
+        << "trial=" << trial;
+  }
+}
+
+TEST(CanonicalFormTest, RespectsTheReflection) {
+  // The outputs of a are pairs of reflected channels and those of b are not,
+  // so they are only isomorphic by a permutation that breaks the reflection.
+  int n = 4;
+  std::vector<OutputType> a = {0b0110, 0b1001};
+  std::vector<OutputType> b = {0b0011, 0b1100};
+  EXPECT_EQ(CanonicalForm(n, a, false), CanonicalForm(n, b, false));
+  EXPECT_NE(CanonicalForm(n, a, true), CanonicalForm(n, b, true));
+}
+
+TEST(CanonicalFormTest, LargeAutomorphismGroups) {
+  // All the outputs of weight 3: every permutation is an automorphism, which
+  // the pruning has to find to stay within the leaf budget.
+  std::mt19937 gen(2);
+  for (bool symmetric : {false, true}) {
+    int n = 16;
+    std::vector<OutputType> set;
+    for (OutputType x = 0; x < (OutputType(1) << n); x++) {
+      if (std::popcount(x) == 3 || std::popcount(x) == n - 3) {
+        set.push_back(x);
+      }
+    }
+    std::vector<OutputType> form = CanonicalForm(n, set, symmetric);
+    EXPECT_EQ(form, set);
+    EXPECT_EQ(CanonicalForm(n, Permute(set, RandomPermutation(n, symmetric,
+                                                              &gen)),
+                            symmetric),
+              form);
+  }
+
+  // The outputs of a layer of comparators (0, 1), (2, 3), ...: the pairs can
+  // be permuted, but the channels of a pair cannot be swapped.
+  int n = 16;
+  std::vector<OutputType> set;
+  for (OutputType x = 0; x < (OutputType(1) << n); x++) {
+    // The odd channel of a pair is only set if the even one is.
+    if (((x >> 1) & ~x & 0x5555) == 0) {
+      set.push_back(x);
+    }
+  }
+  std::vector<OutputType> form = CanonicalForm(n, set, false);
+  for (int k = 0; k < 3; k++) {
+    EXPECT_EQ(CanonicalForm(n, Permute(set, RandomPermutation(n, false, &gen)),
+                            false),
+              form);
+  }
+}
+
+TEST(CanonicalFormTest, UpToInverse) {
+  std::mt19937 gen(3);
+  int n = 8;
+  for (int trial = 0; trial < 50; trial++) {
+    std::vector<OutputType> set = RandomSet(n, 1 + gen() % 50, &gen);
+    std::vector<OutputType> inverse;
+    for (OutputType x : Permute(set, RandomPermutation(n, false, &gen))) {
+      inverse.push_back(x ^ ((OutputType(1) << n) - 1));
+    }
+    std::sort(inverse.begin(), inverse.end());
+    std::vector<OutputType> form = CanonicalFormUpToInverse(n, set, false);
+    EXPECT_EQ(CanonicalFormUpToInverse(n, inverse, false), form);
+    EXPECT_EQ(form, std::min(CanonicalForm(n, set, false),
+                             CanonicalForm(n, inverse, false)));
+  }
+}
+
+TEST(CanonicalFormTest, HashOutputs) {
+  EXPECT_EQ(HashOutputs({1, 2, 3}), HashOutputs({1, 2, 3}));
+  EXPECT_NE(HashOutputs({1, 2, 3}), HashOutputs({1, 2, 4}));
+  EXPECT_NE(HashOutputs({}), HashOutputs({0}));
+}
+
+} // namespace
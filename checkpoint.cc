@@ -0,0 +1,118 @@
+#include "checkpoint.h"
+
+#include <filesystem>
+#include <format>
+#include <sstream>
+
+#include "glog/logging.h"
+#include "google/protobuf/text_format.h"
+
+#include "compressed_file.h"
+#include "network.pb.h"
+#include "network_utils.h"
+
+namespace {
+
+constexpr char kCheckpointPrefix[] = "step-";
+constexpr char kCheckpointSuffix[] = ".checkpoint.txt";
+constexpr char kRedundancySnapshotPrefix[] = "redundancy-";
+
+std::string Join(const std::string &dirname, const std::string &filename) {
+  return (std::filesystem::path(dirname) / filename).string();
+}
+
+} // namespace
+
+Checkpointer::Checkpointer(const std::string &dirname, const std::string &run)
+    : dirname_(dirname), run_(run) {
+  if (!dirname_.empty()) {
+    std::filesystem::create_directories(dirname_);
+  }
+}
+
+Checkpointer::~Checkpointer() { Wait(); }
+
+int Checkpointer::Load(std::vector<Network> *networks,
+                       std::mt19937 *gen) const {
+  if (dirname_.empty()) {
+    return -1;
+  }
+  // The checkpoint files are named by step, so the newest is the last one.
+  std::string newest;
+  for (const auto &entry : std::filesystem::directory_iterator(dirname_)) {
+    std::string filename = entry.path().filename().string();
+    if (filename.starts_with(kCheckpointPrefix) &&
+        filename.ends_with(kCheckpointSuffix) && filename > newest) {
+      newest = filename;
+    }
+  }
+  if (newest.empty()) {
+    LOG(INFO) << "No checkpoint in " << dirname_;
+    return -1;
+  }
+  pb::Checkpoint checkpoint;
+  auto input_stream = OpenInputFile(Join(dirname_, newest));
+  CHECK(google::protobuf::TextFormat::Parse(input_stream.get(), &checkpoint))
+      << "Corrupted checkpoint " << newest;
+  CHECK_EQ(checkpoint.run(), run_)
+      << "The checkpoint " << newest << " belongs to another run";
+  *networks = LoadFromProtoFile(Join(dirname_, checkpoint.networks()));
+  std::istringstream gen_state(checkpoint.gen_state());
+  gen_state >> *gen;
+  CHECK(gen_state) << "Corrupted random state in " << newest;
+  LOG(INFO) << std::format("Resumed {} networks before step {} from {}",
+                           networks->size(), checkpoint.step(), newest);
+  return checkpoint.step();
+}
+
+void Checkpointer::Save(int step, const std::vector<Network> &networks,
+                        const std::mt19937 &gen) {
+  if (dirname_.empty()) {
+    return;
+  }
+  Wait();
+  // The redundancy snapshots belong to the previous steps, and the ones of
+  // this step are only written once it runs.
+  for (const auto &entry : std::filesystem::directory_iterator(dirname_)) {
+    if (entry.path().filename().string().starts_with(
+            kRedundancySnapshotPrefix)) {
+      std::filesystem::remove(entry.path());
+    }
+  }
+  pb::Checkpoint checkpoint;
+  checkpoint.set_run(run_);
+  checkpoint.set_step(step);
+  std::string name = std::format("{}{:04}", kCheckpointPrefix, step);
+  checkpoint.set_networks(name + ".pb.shards");
+  std::ostringstream gen_state;
+  gen_state << gen;
+  checkpoint.set_gen_state(gen_state.str());
+  pending_ = std::async(std::launch::async, [this, &networks, name,
+                                             checkpoint]() {
+    SaveToProtoFile(networks, Join(dirname_, checkpoint.networks()));
+    // The checkpoint file is written last and renamed, so that it only exists
+    // once the checkpoint is complete.
+    std::string filename = Join(dirname_, name + kCheckpointSuffix);
+    {
+      auto output_stream = OpenOutputFile(filename + ".tmp");
+      CHECK(google::protobuf::TextFormat::Print(checkpoint,
+                                                output_stream.get()));
+    }
+    std::filesystem::rename(filename + ".tmp", filename);
+    for (const auto &entry : std::filesystem::directory_iterator(dirname_)) {
+      std::string other = entry.path().filename().string();
+      if (other.starts_with(kCheckpointPrefix) && !other.starts_with(name)) {
+        std::filesystem::remove_all(entry.path());
+      }
+    }
+    LOG(INFO) << std::format("Saved the checkpoint of {} networks before step "
+                             "{} to {}",
+                             networks.size(), checkpoint.step(), filename);
+  });
+}
+
+void Checkpointer::Wait() {
+  if (pending_.valid()) {
+    pending_.get();
+  }
+}
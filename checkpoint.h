@@ -0,0 +1,47 @@
+#pragma once
+
+#include <future>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "network.h"
+// The flags of the checkpoints.
+#include "redundancy_snapshot.h"
+
+// Saves the checkpoints of a run of steps, e.g. the depths of add_layers_main,
+// to a directory: the networks before a step, as a .shards collection saved in
+// parallel, and the state of the random generator. A checkpoint is saved in
+// the background while the step runs, and replaces the older ones once it is
+// complete. The redundancy snapshots of FindRedundantOutputs
+// (redundancy_snapshot.h) in the directory belong to the step after the newest
+// checkpoint.
+//
+// Each checkpoint rewrites all the networks: they are the extensions made by
+// the previous step, so none of them is in the previous checkpoint. The save
+// costs about as much as writing the output of the step.
+class Checkpointer {
+public:
+  // A resumed run must have the same description. If dirname is empty,
+  // nothing is saved or loaded.
+  Checkpointer(const std::string &dirname, const std::string &run);
+  // Waits for the pending save.
+  ~Checkpointer();
+  Checkpointer(const Checkpointer &) = delete;
+  Checkpointer &operator=(const Checkpointer &) = delete;
+
+  // Loads the newest checkpoint into networks and gen, and returns its step,
+  // or returns -1 if there is none.
+  int Load(std::vector<Network> *networks, std::mt19937 *gen) const;
+  // Starts saving the networks before a step, which must not change until the
+  // save is complete (see Wait).
+  void Save(int step, const std::vector<Network> &networks,
+            const std::mt19937 &gen);
+  // Waits for the pending save.
+  void Wait();
+
+private:
+  std::string dirname_;
+  std::string run_;
+  std::future<void> pending_;
+};
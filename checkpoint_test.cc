@@ -0,0 +1,47 @@
+#include "checkpoint.h"
+
+#include <filesystem>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "network.h"
+#include "network_utils.h"
+
+namespace {
+
+TEST(CheckpointerTest, SaveAndLoad) {
+  std::string dirname = "/tmp/test_checkpointer";
+  std::filesystem::remove_all(dirname);
+  std::vector<Network> networks = CreateFirstLayer(4, false);
+  std::mt19937 gen(0);
+  std::vector<Network> loaded_networks;
+  std::mt19937 loaded_gen;
+  {
+    Checkpointer checkpointer(dirname, "run");
+    EXPECT_EQ(checkpointer.Load(&loaded_networks, &loaded_gen), -1);
+    checkpointer.Save(0, networks, gen);
+    checkpointer.Wait();
+    gen();
+    networks.pop_back();
+    checkpointer.Save(2, networks, gen);
+  }
+  Checkpointer checkpointer(dirname, "run");
+  EXPECT_EQ(checkpointer.Load(&loaded_networks, &loaded_gen), 2);
+  EXPECT_EQ(loaded_networks, networks);
+  EXPECT_EQ(loaded_gen, gen);
+  // Only the newest checkpoint is kept.
+  int num_files = std::distance(std::filesystem::directory_iterator(dirname),
+                                std::filesystem::directory_iterator());
+  EXPECT_EQ(num_files, 2);
+
+  // Without a directory, nothing is saved.
+  Checkpointer disabled("", "run");
+  disabled.Save(0, networks, gen);
+  EXPECT_EQ(disabled.Load(&loaded_networks, &loaded_gen), -1);
+}
+
+} // namespace
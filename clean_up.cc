@@ -2,16 +2,22 @@
 
 #include <algorithm>
 #include <cmath>
+#include <format>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "glog/logging.h"
 
+#include "dominance_cache.h"
+#include "isomorphism.h"
 #include "network_utils.h"
+#include "output_type.h"
+#include "outputs_collection.h"
 
 std::vector<Network> CleanUp(std::vector<Network> networks, bool symmetric,
-                             int keep_best_count, std::mt19937 *gen) {
+                             int keep_best_count, std::mt19937 *gen,
+                             const NetworkScore &score) {
   if (networks.empty()) {
     return networks;
   }
@@ -21,49 +27,139 @@ std::vector<Network> CleanUp(std::vector<Network> networks, bool symmetric,
         RemoveRedundantNetworks(std::move(networks), symmetric, false, gen);
     return networks;
   }
+  if (score.kind != NetworkScore::kNumOutputs) {
+    networks =
+        RemoveRedundantNetworks(std::move(networks), symmetric, false, gen);
+    return KeepBestNetworks(std::move(networks), score, keep_best_count,
+                            symmetric);
+  }
   networks = RemoveRedundantNetworks(std::move(networks), symmetric, true, gen);
-  // Only keep good networks. It reduces the computational cost of the following
-  // RemoveRedundantNetworks call.
+  // Only keep good networks. It reduces the computational cost of the exact
+  // check. The networks are admitted by increasing number of outputs, and a
+  // network is only redundant because of smaller (or earlier) ones, so each
+  // retry only checks the newly admitted networks against the non-redundant
+  // ones found so far.
   constexpr double kPreFilterFactor = 2.0;
   int filtered_num_networks =
       static_cast<int>(std::ceil(keep_best_count * kPreFilterFactor));
+  int n = networks.front().n;
+  // The indices of the non-redundant networks among the admitted ones, sorted
+  // by number of outputs, and their outputs (moved out of the networks).
+  std::vector<int> kept;
+  OutputsCollection kept_outputs;
+  int num_admitted = 0;
   while (true) {
-    bool is_filtered = false;
-    std::vector<Network> filtered_networks;
-    if (networks.size() > filtered_num_networks) {
-      filtered_networks = std::vector<Network>(
-          networks.begin(), networks.begin() + filtered_num_networks);
-      is_filtered = true;
-    } else {
-      filtered_networks = networks;
+    int64_t num_non_redundant = kept.size();
+    int end = std::min<int>(filtered_num_networks, networks.size());
+    for (; num_admitted < end; num_admitted++) {
+      kept.push_back(num_admitted);
+      kept_outputs.Add(networks[num_admitted].outputs);
+      std::vector<OutputType>().swap(networks[num_admitted].outputs);
     }
-    filtered_networks = RemoveRedundantNetworks(std::move(filtered_networks),
-                                                symmetric, false, gen);
-    CHECK(std::is_sorted(filtered_networks.begin(), filtered_networks.end(),
-                         [](const Network &a, const Network &b) {
-                           return a.outputs.size() < b.outputs.size();
-                         }));
-    if (!is_filtered ||
-        (filtered_networks.size() > keep_best_count &&
-         filtered_networks.back().outputs.size() >
-             filtered_networks.at(keep_best_count - 1).outputs.size())) {
+    std::vector<bool> is_redundant =
+        FindRedundantOutputs(n, &kept_outputs, false, symmetric, gen,
+                             &DominanceCache::Default(), num_non_redundant);
+    kept_outputs.Remove(is_redundant);
+    int num_kept = 0;
+    for (int i = 0; i < kept.size(); i++) {
+      if (!is_redundant[i]) {
+        kept[num_kept++] = kept[i];
+      }
+    }
+    kept.resize(num_kept);
+    LOG(INFO) << kept.size() << " non-redundant networks among the first "
+              << num_admitted;
+    bool is_filtered = num_admitted < networks.size();
+    if (!is_filtered || (kept.size() > keep_best_count &&
+                         kept_outputs[kept.size() - 1].size() >
+                             kept_outputs[keep_best_count - 1].size())) {
       int best_count_threshold =
-          filtered_networks
-              .at(std::min<int>(keep_best_count, filtered_networks.size()) - 1)
-              .outputs.size();
-      while (filtered_networks.back().outputs.size() > best_count_threshold) {
-        filtered_networks.pop_back();
+          kept_outputs[std::min<int>(keep_best_count, kept.size()) - 1].size();
+      std::vector<Network> best_networks;
+      for (int i = 0; i < kept.size() &&
+                      kept_outputs[i].size() <= best_count_threshold;
+           i++) {
+        Network &network = networks[kept[i]];
+        network.outputs.assign(kept_outputs[i].begin(), kept_outputs[i].end());
+        best_networks.push_back(std::move(network));
       }
-      return filtered_networks;
+      return best_networks;
     }
     // If we filtered too aggressively, increase the filter size.
     // Factor of 1.5 provides gradual expansion without being too aggressive.
     constexpr double kRedundantFactor = 1.5;
     filtered_num_networks = static_cast<int>(
         std::ceil(kRedundantFactor * filtered_num_networks *
-                  std::max<int>(keep_best_count, filtered_networks.size()) /
-                  filtered_networks.size()));
+                  std::max<int>(keep_best_count, kept.size()) / kept.size()));
     LOG(INFO) << "Increasing filtered_num_networks to " << filtered_num_networks
               << " and retrying";
   }
 }
+
+IncrementalCleanUp::IncrementalCleanUp(bool symmetric, int keep_best_count,
+                                       const NetworkScore &score)
+    : symmetric_(symmetric), keep_best_count_(keep_best_count), score_(score) {
+  CHECK_GT(keep_best_count, 0);
+}
+
+void IncrementalCleanUp::Add(std::vector<Network> chunk, std::mt19937 *gen) {
+  if (chunk.empty()) {
+    return;
+  }
+  int n = chunk.front().n;
+  int64_t num_non_redundant = frontier_.size();
+  for (Network &network : chunk) {
+    CHECK(!network.outputs.empty());
+    frontier_outputs_.Add(network.outputs);
+    std::vector<OutputType>().swap(network.outputs);
+    frontier_.push_back(std::move(network));
+  }
+  std::vector<Network>().swap(chunk);
+  std::vector<bool> is_redundant = FindRedundantOutputs(
+      n, &frontier_outputs_, /*fast=*/false, symmetric_, gen,
+      &DominanceCache::Default(), num_non_redundant);
+  if (score_.kind == NetworkScore::kNumOutputs &&
+      frontier_.size() - std::count(is_redundant.begin(), is_redundant.end(),
+                                    true) >=
+          keep_best_count_) {
+    // Only keep the networks as good as the keep_best_count-th one.
+    int num_kept = 0;
+    for (int i = 0; i < frontier_.size(); i++) {
+      if (!is_redundant[i] && ++num_kept == keep_best_count_) {
+        max_size_ = frontier_outputs_[i].size();
+      }
+      if (frontier_outputs_[i].size() > max_size_) {
+        is_redundant[i] = true;
+      }
+    }
+  }
+  frontier_outputs_.Remove(is_redundant);
+  int num_kept = 0;
+  for (int i = 0; i < frontier_.size(); i++) {
+    if (!is_redundant[i]) {
+      // Not moved onto itself, which would leave it empty.
+      if (num_kept != i) {
+        frontier_[num_kept] = std::move(frontier_[i]);
+      }
+      num_kept++;
+    }
+  }
+  frontier_.erase(frontier_.begin() + num_kept, frontier_.end());
+  LOG(INFO) << std::format("{} non-redundant networks, {} outputs",
+                           frontier_.size(), frontier_outputs_.num_outputs());
+}
+
+std::vector<Network> IncrementalCleanUp::Release() {
+  for (int i = 0; i < frontier_.size(); i++) {
+    frontier_[i].outputs.assign(frontier_outputs_[i].begin(),
+                                frontier_outputs_[i].end());
+  }
+  frontier_outputs_ = OutputsCollection();
+  std::vector<Network> networks = std::move(frontier_);
+  frontier_.clear();
+  if (score_.kind != NetworkScore::kNumOutputs) {
+    networks = KeepBestNetworks(std::move(networks), score_, keep_best_count_,
+                                symmetric_);
+  }
+  return networks;
+}
@@ -1,12 +1,62 @@
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <random>
+#include <span>
 #include <vector>
 
 #include "network.h"
+#include "network_score.h"
+#include "output_type.h"
+#include "outputs_collection.h"
 
 // Removes redundant networks and keeps only the best ones (minimum number of
-// outputs). A network is redundant if its outputs or the negation is isomorphic
-// to the superset of another network's outputs.
+// outputs, or minimum score). A network is redundant if its outputs or the
+// negation is isomorphic to the superset of another network's outputs.
+// Ranking by another score than the number of outputs needs all the
+// non-redundant networks, so the smallest ones are not prefiltered.
 std::vector<Network> CleanUp(std::vector<Network> networks, bool symmetric,
-                             int keep_best_count, std::mt19937 *gen);
+                             int keep_best_count, std::mt19937 *gen,
+                             const NetworkScore &score = NetworkScore());
+
+// Keeps the non-redundant networks, or only the best ones as CleanUp does, of
+// networks that are added in chunks by increasing number of outputs. A network
+// is only made redundant by a smaller one (or by an earlier one of the same
+// size), so each chunk is only checked against the non-redundant networks of
+// the previous chunks, the frontier, and the networks of the frontier are
+// final: the next chunks only add networks after them. Unless the score is the
+// number of outputs, the best ones are only known once all are added, so they
+// are selected by Release.
+class IncrementalCleanUp {
+public:
+  IncrementalCleanUp(bool symmetric, int keep_best_count,
+                     const NetworkScore &score = NetworkScore());
+
+  // Adds a chunk of networks with their outputs, with at least as many outputs
+  // as the networks of the previous chunks, and keeps its non-redundant
+  // networks with at most max_size() outputs in the frontier.
+  void Add(std::vector<Network> chunk, std::mt19937 *gen);
+
+  // The number of outputs of the keep_best_count-th network of the frontier
+  // once there is one, if the networks are ranked by number of outputs: the
+  // networks with more outputs are not kept.
+  int max_size() const { return max_size_; }
+  // The frontier, sorted by number of outputs. The outputs of the networks are
+  // in outputs(i) and not in the networks.
+  int64_t size() const { return frontier_.size(); }
+  const Network &network(int64_t i) const { return frontier_[i]; }
+  std::span<const OutputType> outputs(int64_t i) const {
+    return frontier_outputs_[i];
+  }
+  // Returns the networks of the frontier with their outputs, or the best ones.
+  std::vector<Network> Release();
+
+private:
+  bool symmetric_;
+  int keep_best_count_;
+  NetworkScore score_;
+  int max_size_ = std::numeric_limits<int>::max();
+  std::vector<Network> frontier_;
+  OutputsCollection frontier_outputs_;
+};
@@ -0,0 +1,52 @@
+#include "clean_up.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "network.h"
+#include "network_utils.h"
+#include "test_networks.h"
+
+namespace {
+
+// CleanUp keeps the non-redundant networks up to the number of outputs of the
+// keep_best_count-th one, whether it needs to widen its prefilter or not.
+TEST(CleanUpTest, KeepsTheBestNonRedundantNetworks) {
+  std::mt19937 gen(0);
+  int n = 8;
+  std::vector<Network> networks;
+  for (int i = 0; i < 1000; i++) {
+    networks.push_back(RandomNetwork(n, 2, &gen));
+  }
+  std::vector<Network> non_redundant =
+      RemoveRedundantNetworks(networks, false, false, &gen);
+  for (int keep_best_count : {1, 3, 10, 40, 1000}) {
+    int threshold =
+        non_redundant[std::min<int>(keep_best_count, non_redundant.size()) - 1]
+            .outputs.size();
+    std::vector<Network> expected;
+    for (const Network &network : non_redundant) {
+      if (network.outputs.size() <= threshold) {
+        expected.push_back(network);
+      }
+    }
+    std::vector<Network> result =
+        CleanUp(networks, false, keep_best_count, &gen);
+    EXPECT_TRUE(std::is_sorted(result.begin(), result.end(),
+                               [](const Network &a, const Network &b) {
+                                 return a.outputs.size() < b.outputs.size();
+                               }));
+    // The outputs of the kept networks are the same, up to the choice among
+    // isomorphic networks, which have the same number of outputs.
+    ASSERT_EQ(result.size(), expected.size()) << keep_best_count;
+    for (int i = 0; i < result.size(); i++) {
+      EXPECT_EQ(result[i].outputs.size(), expected[i].outputs.size());
+      EXPECT_EQ(result[i].outputs, NetworkOutputs(result[i]));
+    }
+  }
+}
+
+} // namespace
@@ -0,0 +1,299 @@
+#include "compressed_file.h"
+
+#include <algorithm>
+#include <deque>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "zlib.h"
+#include "zstd.h"
+
+#include "thread_pool.h"
+
+namespace {
+
+// The size of the read buffer and of the buffers handed out to protobuf.
+constexpr int kBufferSize = 1 << 20;
+// The size of the uncompressed blocks that are compressed independently.
+constexpr int kBlockSize = 4 << 20;
+constexpr int kGzipLevel = 6;
+constexpr int kZstdLevel = 3;
+// windowBits for a gzip wrapper; inflate also detects it automatically by +32.
+constexpr int kGzipWindowBits = 15 + 16;
+constexpr int kAutoDetectWindowBits = 15 + 32;
+
+std::string GzipCompress(const std::string &data) {
+  z_stream stream = {};
+  CHECK_EQ(deflateInit2(&stream, kGzipLevel, Z_DEFLATED, kGzipWindowBits, 8,
+                        Z_DEFAULT_STRATEGY),
+           Z_OK);
+  std::string output(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef *>(output.data());
+  stream.avail_out = output.size();
+  CHECK_EQ(deflate(&stream, Z_FINISH), Z_STREAM_END);
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+  return output;
+}
+
+std::string ZstdCompress(const std::string &data) {
+  std::string output(ZSTD_compressBound(data.size()), '\0');
+  size_t size = ZSTD_compress(output.data(), output.size(), data.data(),
+                              data.size(), kZstdLevel);
+  CHECK(!ZSTD_isError(size)) << ZSTD_getErrorName(size);
+  output.resize(size);
+  return output;
+}
+
+class InputFile : public google::protobuf::io::CopyingInputStream {
+public:
+  explicit InputFile(const std::string &filename)
+      : filename_(filename), compression_(CompressionFromFilename(filename)),
+        file_(filename, std::ios::binary) {
+    CHECK(file_.is_open()) << std::format("Failed to open file: {}", filename);
+    if (compression_ == Compression::kGzip) {
+      CHECK_EQ(inflateInit2(&gzip_stream_, kAutoDetectWindowBits), Z_OK);
+    } else if (compression_ == Compression::kZstd) {
+      zstd_stream_ = ZSTD_createDStream();
+      CHECK_NOTNULL(zstd_stream_);
+    }
+    if (compression_ != Compression::kNone) {
+      buffer_.resize(kBufferSize);
+    }
+  }
+
+  ~InputFile() override {
+    if (compression_ == Compression::kGzip) {
+      inflateEnd(&gzip_stream_);
+    } else if (compression_ == Compression::kZstd) {
+      ZSTD_freeDStream(zstd_stream_);
+    }
+  }
+
+  int Read(void *buffer, int size) override {
+    char *output = static_cast<char *>(buffer);
+    switch (compression_) {
+    case Compression::kNone:
+      return ReadFile(output, size);
+    case Compression::kGzip:
+      return ReadGzip(output, size);
+    case Compression::kZstd:
+      return ReadZstd(output, size);
+    }
+    return -1;
+  }
+
+private:
+  int ReadFile(char *buffer, int size) {
+    file_.read(buffer, size);
+    CHECK(!file_.bad()) << std::format("Failed to read file: {}", filename_);
+    return file_.gcount();
+  }
+
+  // Reads more compressed data if the buffer is consumed.
+  // Returns false at the end of the file.
+  bool FillBuffer() {
+    if (buffer_pos_ == buffer_size_) {
+      buffer_pos_ = 0;
+      buffer_size_ = ReadFile(buffer_.data(), buffer_.size());
+    }
+    return buffer_pos_ < buffer_size_;
+  }
+
+  int ReadGzip(char *buffer, int size) {
+    gzip_stream_.next_out = reinterpret_cast<Bytef *>(buffer);
+    gzip_stream_.avail_out = size;
+    while (gzip_stream_.avail_out > 0) {
+      bool end_of_file = !FillBuffer();
+      if (end_of_file && !in_frame_) {
+        break;
+      }
+      if (!in_frame_) {
+        // Another gzip member follows.
+        CHECK_EQ(inflateReset(&gzip_stream_), Z_OK);
+        in_frame_ = true;
+      }
+      gzip_stream_.next_in = reinterpret_cast<Bytef *>(&buffer_[buffer_pos_]);
+      gzip_stream_.avail_in = buffer_size_ - buffer_pos_;
+      uInt avail_out = gzip_stream_.avail_out;
+      int result = inflate(&gzip_stream_, Z_NO_FLUSH);
+      buffer_pos_ = buffer_size_ - gzip_stream_.avail_in;
+      if (result == Z_STREAM_END) {
+        in_frame_ = false;
+        continue;
+      }
+      CHECK(result == Z_OK || result == Z_BUF_ERROR)
+          << std::format("Failed to decompress {}: {}", filename_,
+                         gzip_stream_.msg ? gzip_stream_.msg : "");
+      CHECK(!end_of_file || gzip_stream_.avail_out < avail_out)
+          << std::format("Truncated file: {}", filename_);
+    }
+    return size - gzip_stream_.avail_out;
+  }
+
+  int ReadZstd(char *buffer, int size) {
+    ZSTD_outBuffer output = {buffer, static_cast<size_t>(size), 0};
+    while (output.pos < output.size) {
+      bool end_of_file = !FillBuffer();
+      if (end_of_file && !in_frame_) {
+        break;
+      }
+      // With an empty input, this flushes the data buffered in the stream.
+      ZSTD_inBuffer input = {&buffer_[buffer_pos_], buffer_size_ - buffer_pos_,
+                             0};
+      size_t output_pos = output.pos;
+      size_t result = ZSTD_decompressStream(zstd_stream_, &output, &input);
+      CHECK(!ZSTD_isError(result)) << std::format(
+          "Failed to decompress {}: {}", filename_, ZSTD_getErrorName(result));
+      buffer_pos_ += input.pos;
+      // The result is 0 exactly when a frame is complete and flushed.
+      in_frame_ = result != 0;
+      CHECK(!end_of_file || !in_frame_ || output.pos > output_pos)
+          << std::format("Truncated file: {}", filename_);
+    }
+    return output.pos;
+  }
+
+  std::string filename_;
+  Compression compression_;
+  std::ifstream file_;
+  // Compressed data read from the file.
+  std::vector<char> buffer_;
+  size_t buffer_pos_ = 0;
+  size_t buffer_size_ = 0;
+  // Whether a gzip member or zstd frame has started but not ended.
+  bool in_frame_ = false;
+  z_stream gzip_stream_ = {};
+  ZSTD_DStream *zstd_stream_ = nullptr;
+};
+
+class OutputFile : public google::protobuf::io::CopyingOutputStream {
+public:
+  explicit OutputFile(const std::string &filename)
+      : filename_(filename), compression_(CompressionFromFilename(filename)),
+        file_(filename, std::ios::binary) {
+    CHECK(file_.is_open()) << std::format("Failed to open file: {}", filename);
+  }
+
+  ~OutputFile() override {
+    // An empty file still gets one (empty) block, so that it is a valid
+    // compressed file.
+    if (compression_ != Compression::kNone &&
+        (!block_.empty() || num_blocks_ == 0)) {
+      SubmitBlock();
+    }
+    while (!pending_.empty()) {
+      WriteFront();
+    }
+    file_.close();
+    CHECK(!file_.fail()) << std::format("Failed to write file: {}", filename_);
+  }
+
+  bool Write(const void *buffer, int size) override {
+    const char *data = static_cast<const char *>(buffer);
+    if (compression_ == Compression::kNone) {
+      file_.write(data, size);
+      return file_.good();
+    }
+    while (size > 0) {
+      int count = std::min<int>(size, kBlockSize - block_.size());
+      block_.append(data, count);
+      data += count;
+      size -= count;
+      if (block_.size() == kBlockSize) {
+        SubmitBlock();
+      }
+    }
+    return file_.good();
+  }
+
+private:
+  struct Block {
+    std::string data;
+    // Declared after data, so that the compression finishes before data is
+    // destroyed.
+    TaskGroup group;
+  };
+
+  void SubmitBlock() {
+    auto block = std::make_unique<Block>();
+    block->data = std::move(block_);
+    block_.clear();
+    Block *raw_block = block.get();
+    raw_block->group.Run([raw_block, compression = compression_]() {
+      raw_block->data = compression == Compression::kGzip
+                            ? GzipCompress(raw_block->data)
+                            : ZstdCompress(raw_block->data);
+    });
+    pending_.push_back(std::move(block));
+    num_blocks_++;
+    // Bound the memory used by the blocks in flight.
+    while (pending_.size() > 2 * raw_block->group.pool()->num_threads()) {
+      WriteFront();
+    }
+  }
+
+  // Waits for the oldest block and writes it.
+  void WriteFront() {
+    Block &block = *pending_.front();
+    block.group.Wait();
+    file_.write(block.data.data(), block.data.size());
+    pending_.pop_front();
+  }
+
+  std::string filename_;
+  Compression compression_;
+  std::ofstream file_;
+  // The uncompressed data of the block being filled.
+  std::string block_;
+  // The blocks being compressed, in file order.
+  std::deque<std::unique_ptr<Block>> pending_;
+  int num_blocks_ = 0;
+};
+
+} // namespace
+
+Compression CompressionFromFilename(const std::string &filename) {
+  if (filename.ends_with(".gz")) {
+    return Compression::kGzip;
+  }
+  if (filename.ends_with(".zst")) {
+    return Compression::kZstd;
+  }
+  return Compression::kNone;
+}
+
+std::string StripCompressionExtension(const std::string &filename) {
+  for (const std::string extension : {".gz", ".zst"}) {
+    if (filename.ends_with(extension)) {
+      return filename.substr(0, filename.size() - extension.size());
+    }
+  }
+  return filename;
+}
+
+std::unique_ptr<google::protobuf::io::ZeroCopyInputStream>
+OpenInputFile(const std::string &filename) {
+  auto stream =
+      std::make_unique<google::protobuf::io::CopyingInputStreamAdaptor>(
+          new InputFile(filename), kBufferSize);
+  stream->SetOwnsCopyingStream(true);
+  return stream;
+}
+
+std::unique_ptr<google::protobuf::io::ZeroCopyOutputStream>
+OpenOutputFile(const std::string &filename) {
+  auto stream =
+      std::make_unique<google::protobuf::io::CopyingOutputStreamAdaptor>(
+          new OutputFile(filename), kBufferSize);
+  stream->SetOwnsCopyingStream(true);
+  return stream;
+}
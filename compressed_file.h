@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "google/protobuf/io/zero_copy_stream.h"
+
+// The compression of a file, chosen by its extension.
+enum class Compression {
+  kNone,
+  kGzip, // .gz
+  kZstd, // .zst
+};
+
+Compression CompressionFromFilename(const std::string &filename);
+
+// Returns the filename without the compression extension, e.g.
+// "n28d6.pb.zst" -> "n28d6.pb".
+std::string StripCompressionExtension(const std::string &filename);
+
+// Opens a file for reading. .gz and .zst files are decompressed while they are
+// read. Concatenated gzip members and zstd frames are read as one stream.
+std::unique_ptr<google::protobuf::io::ZeroCopyInputStream>
+OpenInputFile(const std::string &filename);
+
+// Opens a file for writing. For .gz and .zst files, the data is cut into
+// blocks that are compressed independently on the thread pool and written in
+// order as separate gzip members or zstd frames, which the standard tools
+// decompress as a single stream. The file is complete when the stream is
+// destroyed.
+std::unique_ptr<google::protobuf::io::ZeroCopyOutputStream>
+OpenOutputFile(const std::string &filename);
@@ -0,0 +1,106 @@
+#include "compressed_file.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Compressible data: random lowercase words.
+std::string RandomText(int size) {
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> letter(0, 26);
+  std::string text(size, ' ');
+  for (char &c : text) {
+    int l = letter(gen);
+    c = l == 26 ? ' ' : 'a' + l;
+  }
+  return text;
+}
+
+void WriteFile(const std::string &filename, const std::string &data) {
+  auto stream = OpenOutputFile(filename);
+  size_t pos = 0;
+  void *buffer;
+  int size;
+  while (pos < data.size()) {
+    ASSERT_TRUE(stream->Next(&buffer, &size));
+    int count = std::min<size_t>(size, data.size() - pos);
+    data.copy(static_cast<char *>(buffer), count, pos);
+    pos += count;
+    if (count < size) {
+      stream->BackUp(size - count);
+    }
+  }
+}
+
+std::string ReadFile(const std::string &filename) {
+  auto stream = OpenInputFile(filename);
+  std::string data;
+  const void *buffer;
+  int size;
+  while (stream->Next(&buffer, &size)) {
+    data.append(static_cast<const char *>(buffer), size);
+  }
+  return data;
+}
+
+std::string ReadRawFile(const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary);
+  std::stringstream ss;
+  ss << file.rdbuf();
+  return ss.str();
+}
+
+} // namespace
+
+TEST(CompressedFileTest, CompressionFromFilename) {
+  EXPECT_EQ(CompressionFromFilename("a.pb"), Compression::kNone);
+  EXPECT_EQ(CompressionFromFilename("a.pb.gz"), Compression::kGzip);
+  EXPECT_EQ(CompressionFromFilename("a.pb.zst"), Compression::kZstd);
+  EXPECT_EQ(StripCompressionExtension("a.pb"), "a.pb");
+  EXPECT_EQ(StripCompressionExtension("a.pb.gz"), "a.pb");
+  EXPECT_EQ(StripCompressionExtension("a.txt.zst"), "a.txt");
+}
+
+TEST(CompressedFileTest, RoundTrip) {
+  // Several blocks, the last one partial.
+  std::string data = RandomText(10 << 20);
+  for (const std::string filename :
+       {"/tmp/test_compressed_file.bin", "/tmp/test_compressed_file.bin.gz",
+        "/tmp/test_compressed_file.bin.zst"}) {
+    WriteFile(filename, data);
+    EXPECT_EQ(ReadFile(filename), data) << filename;
+    if (CompressionFromFilename(filename) != Compression::kNone) {
+      EXPECT_LT(ReadRawFile(filename).size(), data.size()) << filename;
+    }
+  }
+}
+
+TEST(CompressedFileTest, EmptyFile) {
+  for (const std::string filename :
+       {"/tmp/test_compressed_empty.bin", "/tmp/test_compressed_empty.bin.gz",
+        "/tmp/test_compressed_empty.bin.zst"}) {
+    WriteFile(filename, "");
+    EXPECT_EQ(ReadFile(filename), "") << filename;
+  }
+  EXPECT_FALSE(ReadRawFile("/tmp/test_compressed_empty.bin.gz").empty());
+}
+
+TEST(CompressedFileTest, ConcatenatedFiles) {
+  for (const std::string extension : {".gz", ".zst"}) {
+    std::string first = "/tmp/test_compressed_first" + extension;
+    std::string second = "/tmp/test_compressed_second" + extension;
+    std::string both = "/tmp/test_compressed_both" + extension;
+    WriteFile(first, "hello ");
+    WriteFile(second, "world");
+    std::ofstream file(both, std::ios::binary);
+    file << ReadRawFile(first) << ReadRawFile(second);
+    file.close();
+    EXPECT_EQ(ReadFile(both), "hello world") << extension;
+  }
+}
@@ -31,7 +31,8 @@ int main(int argc, char *argv[]) {
   if (FLAGS_pb_to_bracket) {
     // Convert from protobuf to bracket
     LOG(INFO) << "Loading networks from protobuf file: " << FLAGS_pb_path;
-    std::vector<Network> networks = LoadFromProtoFile(FLAGS_pb_path, FLAGS_n);
+    std::vector<Network> networks =
+        LoadFromProtoFile(FLAGS_pb_path, FLAGS_n, /*fill_outputs=*/false);
     LOG(INFO) << "Loaded " << networks.size() << " networks.";
 
     LOG(INFO) << "Saving networks to bracket file: " << FLAGS_bracket_path;
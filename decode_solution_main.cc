@@ -147,7 +147,9 @@ int main(int argc, char *argv[]) {
   CHECK(!FLAGS_permutation_file.empty());
   CHECK(FLAGS_symmetric);
 
-  std::vector<Network> prefixes = LoadFromProtoFile(FLAGS_prefix_file);
+  // The outputs of the prefixes are recomputed after adding the suffixes.
+  std::vector<Network> prefixes =
+      LoadFromProtoFile(FLAGS_prefix_file, 0, /*fill_outputs=*/false);
   std::vector<Network> permuted_prefixes;
   if (!FLAGS_permuted_prefix_file.empty()) {
     permuted_prefixes = LoadFromProtoFile(FLAGS_permuted_prefix_file);
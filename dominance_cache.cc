@@ -0,0 +1,117 @@
+#include "dominance_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "compressed_file.h"
+#include "network.pb.h"
+
+DEFINE_int64(dominance_cache_max_entries, 1 << 22,
+             "The maximum number of subset-isomorphism results to cache.");
+
+size_t DominanceCache::KeyHash::operator()(const Key &key) const {
+  uint64_t hash = key.hash_a * 0x9e3779b97f4a7c15ULL;
+  hash ^= key.hash_b + 0x7f4a7c159e3779b9ULL + (hash << 6) + (hash >> 2);
+  hash ^= uint64_t(key.n) << 1 | key.symmetric;
+  // Mix the high bits into the low ones, which pick the shard.
+  return hash ^ (hash >> 29);
+}
+
+DominanceCache::DominanceCache(int64_t max_entries)
+    : max_entries_per_shard_(
+          std::max<int64_t>(1, (max_entries + kNumShards - 1) / kNumShards)) {}
+
+DominanceCache &DominanceCache::Default() {
+  static DominanceCache cache(FLAGS_dominance_cache_max_entries);
+  return cache;
+}
+
+std::optional<DominanceCache::Entry>
+DominanceCache::Lookup(const Key &key) const {
+  const Shard &shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it == shard.entries.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+void DominanceCache::Insert(const Key &key, Entry entry) {
+  Shard &shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.entries.size() >= max_entries_per_shard_) {
+    shard.entries.clear();
+  }
+  shard.entries[key] = std::move(entry);
+}
+
+int64_t DominanceCache::size() const {
+  int64_t size = 0;
+  for (const Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size += shard.entries.size();
+  }
+  return size;
+}
+
+void DominanceCache::Clear() {
+  for (Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries.clear();
+  }
+}
+
+void DominanceCache::Load(const std::string &filename) {
+  pb::DominanceCacheFile file;
+  auto input_stream = OpenInputFile(filename);
+  CHECK(file.ParseFromZeroCopyStream(input_stream.get()))
+      << "Corrupted dominance cache " << filename;
+  for (const pb::DominanceCacheEntry &entry_proto : file.entry()) {
+    Key key{entry_proto.hash_a(), entry_proto.hash_b(), entry_proto.n(),
+            entry_proto.symmetric()};
+    Entry entry;
+    entry.is_subset = entry_proto.is_subset();
+    entry.witness.assign(entry_proto.witness().begin(),
+                         entry_proto.witness().end());
+    Insert(key, std::move(entry));
+  }
+  LOG(INFO) << "Loaded " << file.entry_size()
+            << " dominance cache entries from " << filename;
+}
+
+void DominanceCache::Save(const std::string &filename) const {
+  pb::DominanceCacheFile file;
+  for (const Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto &[key, entry] : shard.entries) {
+      pb::DominanceCacheEntry *entry_proto = file.add_entry();
+      entry_proto->set_hash_a(key.hash_a);
+      entry_proto->set_hash_b(key.hash_b);
+      entry_proto->set_n(key.n);
+      entry_proto->set_symmetric(key.symmetric);
+      entry_proto->set_is_subset(entry.is_subset);
+      entry_proto->set_witness(
+          std::string(entry.witness.begin(), entry.witness.end()));
+    }
+  }
+  // Written to a temporary file and renamed, so that an interrupted save keeps
+  // the previous file. The temporary file keeps the compression extension.
+  std::string name = StripCompressionExtension(filename);
+  std::string tmp_filename = name + ".tmp" + filename.substr(name.size());
+  {
+    auto output_stream = OpenOutputFile(tmp_filename);
+    CHECK(file.SerializeToZeroCopyStream(output_stream.get()));
+  }
+  std::filesystem::rename(tmp_filename, filename);
+  LOG(INFO) << "Saved " << file.entry_size() << " dominance cache entries to "
+            << filename;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+// The maximum number of entries of the process-wide dominance cache.
+DECLARE_int64(dominance_cache_max_entries);
+
+// A cache of the results of subset-isomorphism tests (is set_a isomorphic to a
+// subset of set_b?) between sets of outputs of n channels. The sets are
+// identified by the hashes of their canonical forms (canonical_form.h), so a
+// result carries over to any channel order of the sets: to the later passes
+// and calls of FindRedundantOutputs and, through Load and Save, to later runs.
+//
+// A positive result keeps its witness in the channels of the canonical forms,
+// and the users check it before relying on it. A hash collision can then only
+// make a negative result wrong, which keeps a network that could have been
+// removed, never the opposite.
+//
+// The cache is thread-safe. When a shard exceeds its share of max_entries, it
+// is cleared.
+class DominanceCache {
+public:
+  struct Key {
+    uint64_t hash_a = 0;
+    uint64_t hash_b = 0;
+    int n = 0;
+    bool symmetric = false;
+    bool operator==(const Key &other) const = default;
+  };
+  struct Entry {
+    bool is_subset = false;
+    // If is_subset, witness[c] is the channel of the canonical form of set_b
+    // that the channel c of the canonical form of set_a is mapped to.
+    std::vector<uint8_t> witness;
+  };
+
+  explicit DominanceCache(int64_t max_entries);
+  DominanceCache(const DominanceCache &) = delete;
+  DominanceCache &operator=(const DominanceCache &) = delete;
+
+  // Returns the process-wide cache with --dominance_cache_max_entries entries.
+  static DominanceCache &Default();
+
+  std::optional<Entry> Lookup(const Key &key) const;
+  void Insert(const Key &key, Entry entry);
+  int64_t size() const;
+  void Clear();
+
+  // Adds the entries of a file written by Save. .gz and .zst files are
+  // decompressed.
+  void Load(const std::string &filename);
+  // Replaces the file at once, so that an interrupted save keeps the previous
+  // one.
+  void Save(const std::string &filename) const;
+
+private:
+  static constexpr int kNumShards = 64;
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<Key, Entry, KeyHash> entries;
+  };
+
+  Shard &GetShard(const Key &key) {
+    return shards_[KeyHash()(key) % kNumShards];
+  }
+  const Shard &GetShard(const Key &key) const {
+    return shards_[KeyHash()(key) % kNumShards];
+  }
+
+  int64_t max_entries_per_shard_;
+  Shard shards_[kNumShards];
+};
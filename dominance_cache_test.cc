@@ -0,0 +1,72 @@
+#include "dominance_cache.h"
+
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(DominanceCacheTest, InsertAndLookup) {
+  DominanceCache cache(1000);
+  DominanceCache::Key key{1, 2, 4, false};
+  EXPECT_FALSE(cache.Lookup(key).has_value());
+  cache.Insert(key, {true, {1, 0, 3, 2}});
+  cache.Insert({2, 1, 4, false}, {false, {}});
+  std::optional<DominanceCache::Entry> entry = cache.Lookup(key);
+  ASSERT_TRUE(entry.has_value());
+  EXPECT_TRUE(entry->is_subset);
+  EXPECT_EQ(entry->witness, std::vector<uint8_t>({1, 0, 3, 2}));
+  EXPECT_FALSE(cache.Lookup({2, 1, 4, false})->is_subset);
+  // The number of channels and the symmetry are part of the key.
+  EXPECT_FALSE(cache.Lookup({1, 2, 5, false}).has_value());
+  EXPECT_FALSE(cache.Lookup({1, 2, 4, true}).has_value());
+  EXPECT_EQ(cache.size(), 2);
+  cache.Clear();
+  EXPECT_EQ(cache.size(), 0);
+}
+
+TEST(DominanceCacheTest, MaxEntries) {
+  DominanceCache cache(640);
+  for (uint64_t k = 0; k < 10000; k++) {
+    cache.Insert({k, k + 1, 8, false}, {false, {}});
+  }
+  EXPECT_LE(cache.size(), 640);
+  EXPECT_TRUE(cache.Lookup({9999, 10000, 8, false}).has_value());
+}
+
+TEST(DominanceCacheTest, SaveAndLoad) {
+  for (std::string extension : {".pb", ".pb.zst"}) {
+    std::string filename = testing::TempDir() + "/dominance_cache" + extension;
+    DominanceCache cache(1000);
+    for (uint64_t k = 0; k < 100; k++) {
+      cache.Insert({k, ~k, 6, k % 2 == 0},
+                   {k % 3 == 0, k % 3 == 0 ? std::vector<uint8_t>{5, 4, 3, 2,
+                                                                 1, 0}
+                                           : std::vector<uint8_t>{}});
+    }
+    cache.Save(filename);
+    // The temporary file is renamed.
+    for (const auto &entry :
+         std::filesystem::directory_iterator(testing::TempDir())) {
+      std::string name = entry.path().filename().string();
+      EXPECT_FALSE(name.starts_with("dominance_cache") &&
+                   name.find(".tmp") != std::string::npos)
+          << name;
+    }
+    DominanceCache loaded(1000);
+    loaded.Load(filename);
+    EXPECT_EQ(loaded.size(), 100);
+    for (uint64_t k = 0; k < 100; k++) {
+      std::optional<DominanceCache::Entry> entry =
+          loaded.Lookup({k, ~k, 6, k % 2 == 0});
+      ASSERT_TRUE(entry.has_value());
+      EXPECT_EQ(entry->is_subset, k % 3 == 0);
+      EXPECT_EQ(entry->witness, cache.Lookup({k, ~k, 6, k % 2 == 0})->witness);
+    }
+    std::filesystem::remove(filename);
+  }
+}
+
+} // namespace
@@ -0,0 +1,124 @@
+#include "dominance_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace {
+// Nodes with at most this many points are not split.
+constexpr int kLeafSize = 8;
+} // namespace
+
+void DominanceIndex::Add(int id, std::span<const uint32_t> point) {
+  CHECK_EQ(point.size(), dim_);
+  CHECK(nodes_.empty()) << "Add() after Build()";
+  ids_.push_back(id);
+  points_.insert(points_.end(), point.begin(), point.end());
+}
+
+void DominanceIndex::Build() {
+  CHECK(nodes_.empty()) << "Build() is called twice";
+  if (ids_.empty()) {
+    return;
+  }
+  BuildNode(0, ids_.size());
+}
+
+int DominanceIndex::BuildNode(int begin, int end) {
+  int node_index = nodes_.size();
+  nodes_.push_back({begin, end, -1, -1, 0});
+  std::vector<uint32_t> mins(dim_, std::numeric_limits<uint32_t>::max());
+  std::vector<uint32_t> maxs(dim_, 0);
+  int min_id = std::numeric_limits<int>::max();
+  for (int i = begin; i < end; i++) {
+    const uint32_t *point = Point(i);
+    for (int d = 0; d < dim_; d++) {
+      mins[d] = std::min(mins[d], point[d]);
+      maxs[d] = std::max(maxs[d], point[d]);
+    }
+    min_id = std::min(min_id, ids_[i]);
+  }
+  nodes_[node_index].min_id = min_id;
+  node_mins_.insert(node_mins_.end(), mins.begin(), mins.end());
+
+  int split_dim = 0;
+  for (int d = 1; d < dim_; d++) {
+    if (maxs[d] - mins[d] > maxs[split_dim] - mins[split_dim]) {
+      split_dim = d;
+    }
+  }
+  if (end - begin <= kLeafSize || maxs[split_dim] == mins[split_dim]) {
+    return node_index;
+  }
+
+  // Partition [begin, end) at the median of split_dim, moving the ids and the
+  // points together.
+  std::vector<int> order(end - begin);
+  std::iota(order.begin(), order.end(), begin);
+  int mid = (end - begin) / 2;
+  std::nth_element(order.begin(), order.begin() + mid, order.end(),
+                   [&](int a, int b) {
+                     return Point(a)[split_dim] < Point(b)[split_dim];
+                   });
+  std::vector<int> ids(end - begin);
+  std::vector<uint32_t> points((end - begin) * dim_);
+  for (int k = 0; k < order.size(); k++) {
+    ids[k] = ids_[order[k]];
+    std::copy_n(Point(order[k]), dim_, &points[k * dim_]);
+  }
+  std::copy(ids.begin(), ids.end(), ids_.begin() + begin);
+  std::copy(points.begin(), points.end(), points_.begin() + begin * dim_);
+
+  int left = BuildNode(begin, begin + mid);
+  int right = BuildNode(begin + mid, end);
+  nodes_[node_index].left = left;
+  nodes_[node_index].right = right;
+  return node_index;
+}
+
+bool DominanceIndex::IsDominated(const uint32_t *point,
+                                 std::span<const uint32_t> query) const {
+  for (int d = 0; d < dim_; d++) {
+    if (point[d] > query[d]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<int>
+DominanceIndex::FindDominated(std::span<const uint32_t> query,
+                              int max_id) const {
+  CHECK_EQ(query.size(), dim_);
+  std::vector<int> result;
+  if (nodes_.empty()) {
+    return result;
+  }
+  std::vector<int> stack = {0};
+  while (!stack.empty()) {
+    int node_index = stack.back();
+    stack.pop_back();
+    const Node &node = nodes_[node_index];
+    if (node.min_id >= max_id ||
+        !IsDominated(&node_mins_[node_index * dim_], query)) {
+      continue;
+    }
+    if (node.left >= 0) {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+      continue;
+    }
+    for (int i = node.begin; i < node.end; i++) {
+      if (ids_[i] < max_id && IsDominated(Point(i), query)) {
+        result.push_back(ids_[i]);
+      }
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// A static index of points with integer coordinates that finds the points
+// dominated by a query point q, i.e. the points p with p[d] <= q[d] for all d.
+//
+// It is a k-d tree: each node splits its points at the median of the
+// coordinate with the largest spread, and stores the componentwise minimum of
+// its points and their smallest id. A query skips a subtree as soon as the
+// minimum exceeds q in some coordinate or the smallest id is too large.
+class DominanceIndex {
+public:
+  explicit DominanceIndex(int dim) : dim_(dim) {}
+
+  // Adds a point. Must be called before Build().
+  void Add(int id, std::span<const uint32_t> point);
+  // Builds the tree over the added points.
+  void Build();
+
+  int dim() const { return dim_; }
+  int size() const { return ids_.size(); }
+  // Returns the ids (< max_id) of the points dominated by query, in increasing
+  // order.
+  std::vector<int> FindDominated(std::span<const uint32_t> query,
+                                 int max_id) const;
+
+private:
+  struct Node {
+    // The points of the node are [begin, end) in ids_ and points_.
+    int begin = 0;
+    int end = 0;
+    // Children, or -1 for a leaf.
+    int left = -1;
+    int right = -1;
+    int min_id = 0;
+  };
+
+  int BuildNode(int begin, int end);
+  const uint32_t *Point(int index) const { return &points_[index * dim_]; }
+  bool IsDominated(const uint32_t *point,
+                   std::span<const uint32_t> query) const;
+
+  int dim_ = 0;
+  // The points in tree order: the points of a node are contiguous.
+  std::vector<int> ids_;
+  std::vector<uint32_t> points_;
+  std::vector<Node> nodes_;
+  // The componentwise minimum of the points of node i is at
+  // node_mins_[i * dim_].
+  std::vector<uint32_t> node_mins_;
+};
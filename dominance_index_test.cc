@@ -0,0 +1,62 @@
+#include "dominance_index.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(DominanceIndexTest, Empty) {
+  DominanceIndex index(3);
+  index.Build();
+  std::vector<uint32_t> query = {1, 2, 3};
+  EXPECT_TRUE(index.FindDominated(query, 100).empty());
+}
+
+TEST(DominanceIndexTest, Small) {
+  DominanceIndex index(2);
+  index.Add(0, std::vector<uint32_t>{1, 1});
+  index.Add(1, std::vector<uint32_t>{2, 0});
+  index.Add(2, std::vector<uint32_t>{0, 3});
+  index.Add(5, std::vector<uint32_t>{1, 1});
+  index.Build();
+  std::vector<uint32_t> query = {2, 1};
+  EXPECT_EQ(index.FindDominated(query, 10), std::vector<int>({0, 1, 5}));
+  EXPECT_EQ(index.FindDominated(query, 5), std::vector<int>({0, 1}));
+  EXPECT_EQ(index.FindDominated(query, 0), std::vector<int>());
+}
+
+TEST(DominanceIndexTest, MatchesLinearScan) {
+  std::mt19937 gen(0);
+  for (int dim : {1, 4, 17}) {
+    std::uniform_int_distribution<uint32_t> dist(0, 20);
+    std::vector<std::vector<uint32_t>> points(2000);
+    DominanceIndex index(dim);
+    for (int id = 0; id < points.size(); id++) {
+      // Correlated coordinates, like the invariants of output sets.
+      uint32_t base = dist(gen);
+      for (int d = 0; d < dim; d++) {
+        points[id].push_back(base + dist(gen) / 4);
+      }
+      index.Add(id, points[id]);
+    }
+    index.Build();
+    EXPECT_EQ(index.size(), points.size());
+    for (int q = 0; q < 200; q++) {
+      const std::vector<uint32_t> &query = points[q * 7];
+      int max_id = q * 10;
+      std::vector<int> expected;
+      for (int id = 0; id < max_id; id++) {
+        bool dominated = true;
+        for (int d = 0; d < dim; d++) {
+          dominated = dominated && points[id][d] <= query[d];
+        }
+        if (dominated) {
+          expected.push_back(id);
+        }
+      }
+      EXPECT_EQ(index.FindDominated(query, max_id), expected)
+          << "dim=" << dim << " q=" << q;
+    }
+  }
+}
@@ -1,10 +1,12 @@
 #include "extend_network.h"
 
-#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iterator>
 #include <limits>
-#include <mutex>
+#include <memory>
 #include <string>
-#include <thread>
 #include <utility>
 #include <vector>
 
@@ -12,7 +14,10 @@
 
 #include "clean_up.h"
 #include "comparator.h"
+#include "network_spill.h"
+#include "network_utils.h"
 #include "output_type.h"
+#include "thread_pool.h"
 
 namespace {
 void AddComparator(const Network &network, bool symmetric,
@@ -97,10 +102,22 @@ void AddComparator(const Network &network, bool symmetric,
   }
 }
 
+// An estimate of the memory of the extensions of a network, which all copy
+// its outputs: one per pair of channels for a comparator, and for a layer as
+// many per comparator of the layer, which is only a lower bound.
+int64_t ExtensionBytes(const Network &network, bool add_one_comparator) {
+  int64_t n = network.n;
+  int64_t num_pairs = n * (n - 1) / 2;
+  int64_t num_extensions =
+      1 + (add_one_comparator ? num_pairs : num_pairs * (n / 2));
+  return num_extensions *
+         (network.outputs.size() * sizeof(OutputType) +
+          network.layers.size() * n * sizeof(int) + sizeof(Network));
+}
+
 void ProcessPrefixWorker(const Network &network, int n, bool symmetric,
                          bool add_one_comparator,
-                         std::vector<Network> *extended_networks,
-                         std::mutex *output_mutex) {
+                         std::vector<Network> *extended_networks) {
   if (symmetric) {
     CHECK_EQ(n % 2, 0);
     CHECK(network.IsSymmetric());
@@ -125,55 +142,204 @@ void ProcessPrefixWorker(const Network &network, int n, bool symmetric,
       }
     }
   }
-  std::vector<Network> local_extended_networks;
   int remaining_dfs_depth =
       add_one_comparator ? 1 : std::numeric_limits<int>::max();
   AddComparator(network, symmetric, has_inverse, 0, remaining_dfs_depth,
-                &local_extended_networks);
-  std::lock_guard<std::mutex> lock(*output_mutex);
-  for (const auto &extended_network : local_extended_networks) {
-    extended_networks->push_back(std::move(extended_network));
-  }
+                extended_networks);
 }
 
+// The networks of a step of AddComparatorsPipelined, which are extended as they
+// are added.
+class PipelineStep {
+public:
+  PipelineStep(int n, bool symmetric) : n_(n), symmetric_(symmetric) {}
+
+  // Schedules the extension of a network with its outputs.
+  void Add(Network network) {
+    // The deques keep the addresses of their elements, which the running
+    // tasks use.
+    const Network *parent = &parents_.emplace_back(std::move(network));
+    std::vector<Network> *extended_networks =
+        &extended_networks_.emplace_back();
+    group_.Run([this, parent, extended_networks]() {
+      ProcessPrefixWorker(*parent, n_, symmetric_, true, extended_networks);
+    });
+  }
+
+  int64_t size() const { return parents_.size(); }
+
+  // Waits for the extensions and returns them in the order of the networks,
+  // without the ones with isomorphic outputs, sorted by number of outputs.
+  std::vector<Network> Finish() {
+    group_.Wait();
+    std::deque<Network>().swap(parents_);
+    std::vector<Network> networks;
+    for (std::vector<Network> &extended_networks : extended_networks_) {
+      std::move(extended_networks.begin(), extended_networks.end(),
+                std::back_inserter(networks));
+      std::vector<Network>().swap(extended_networks);
+    }
+    std::deque<std::vector<Network>>().swap(extended_networks_);
+    LOG(INFO) << "Extended " << networks.size() << " networks";
+    networks = RemoveIsomorphicNetworks(std::move(networks), symmetric_);
+    std::stable_sort(networks.begin(), networks.end(),
+                     [](const Network &a, const Network &b) {
+                       return a.outputs.size() < b.outputs.size();
+                     });
+    return networks;
+  }
+
+private:
+  int n_;
+  bool symmetric_;
+  std::deque<Network> parents_;
+  std::deque<std::vector<Network>> extended_networks_;
+  // Last, so that it waits for the tasks before the deques are destroyed.
+  TaskGroup group_;
+};
+
 } // namespace
 
 std::vector<Network> ExtendNetwork(int n, const std::vector<Network> &networks,
                                    bool symmetric, bool add_one_comparator,
-                                   int keep_best_count, int jobs,
-                                   std::mt19937 *gen) {
-  // Parallel processing setup
-  std::vector<std::thread> workers;
-  std::vector<Network> extended_networks;
-  std::mutex output_mutex;
-  std::atomic<int> next_network_idx(0);
-
-  LOG(INFO) << "Processing " << networks.size() << " networks using " << jobs
-            << " workers";
-
-  // Create worker workers
-  for (int w = 0; w < jobs; w++) {
-    workers.emplace_back([&]() {
-      while (true) {
-        int network_idx = next_network_idx.fetch_add(1);
-        if (network_idx >= networks.size()) {
+                                   int keep_best_count, std::mt19937 *gen,
+                                   const NetworkScore &score,
+                                   const std::vector<Network> &seeds) {
+  LOG(INFO) << "Processing " << networks.size() << " networks using "
+            << ThreadPool::Default().num_threads() << " workers";
+  LOG_IF(INFO, !seeds.empty()) << "Seeded with " << seeds.size()
+                               << " networks";
+
+  if (!FLAGS_spill_dir.empty()) {
+    NetworkSpill spill(FLAGS_spill_dir, symmetric, FLAGS_spill_run_outputs);
+    spill.Add(seeds);
+    // The networks are extended in batches, whose extensions are added in the
+    // order of the networks. The extensions of a batch are reserved in the
+    // memory budget until they are spilled, and a batch ends before they
+    // exceed it (with at least one network per batch).
+    MemoryBudget &budget = MemoryBudget::Default();
+    int max_batch_size = 4 * ThreadPool::Default().num_threads();
+    for (int begin = 0, end = 0; begin < networks.size(); begin = end) {
+      int64_t batch_bytes = 0;
+      for (end = begin; end < networks.size() && end - begin < max_batch_size;
+           end++) {
+        int64_t bytes = ExtensionBytes(networks[end], add_one_comparator);
+        if (end > begin && budget.capacity() > 0 &&
+            batch_bytes + bytes > budget.capacity()) {
           break;
         }
-        ProcessPrefixWorker(networks[network_idx], n, symmetric,
-                            add_one_comparator, &extended_networks,
-                            &output_mutex);
+        batch_bytes += bytes;
       }
-    });
+      MemoryBudget::Reservation reservation = budget.Reserve(batch_bytes);
+      std::vector<std::vector<Network>> extended_networks_by_network(end -
+                                                                     begin);
+      ParallelFor(begin, end, [&](int network_idx) {
+        ProcessPrefixWorker(
+            networks[network_idx], n, symmetric, add_one_comparator,
+            &extended_networks_by_network[network_idx - begin]);
+      });
+      for (auto &networks_of_network : extended_networks_by_network) {
+        spill.Add(std::move(networks_of_network));
+      }
+    }
+    MemoryBudget::Default().LogAdmissionDelay("Extending networks");
+    LOG(INFO) << "Extended " << spill.num_networks() << " networks";
+    return spill.CleanUp(keep_best_count, gen, score);
   }
 
-  // Wait for all workers to complete
-  for (auto &worker : workers) {
-    worker.join();
+  // The extensions of each network are concatenated in the order of the
+  // networks, so that the result does not depend on the threads.
+  std::vector<std::vector<Network>> extended_networks_by_network(
+      networks.size());
+  ParallelFor(0, networks.size(), [&](int network_idx) {
+    ProcessPrefixWorker(networks[network_idx], n, symmetric, add_one_comparator,
+                        &extended_networks_by_network[network_idx]);
+  });
+  size_t num_extended_networks = seeds.size();
+  for (const auto &networks_of_network : extended_networks_by_network) {
+    num_extended_networks += networks_of_network.size();
+  }
+  std::vector<Network> extended_networks;
+  extended_networks.reserve(num_extended_networks);
+  extended_networks.insert(extended_networks.end(), seeds.begin(), seeds.end());
+  for (auto &networks_of_network : extended_networks_by_network) {
+    std::move(networks_of_network.begin(), networks_of_network.end(),
+              std::back_inserter(extended_networks));
+    std::vector<Network>().swap(networks_of_network);
   }
   LOG(INFO) << "Extended " << extended_networks.size() << " networks";
 
   extended_networks =
-      CleanUp(std::move(extended_networks), symmetric, keep_best_count, gen);
+      RemoveIsomorphicNetworks(std::move(extended_networks), symmetric);
+
+  extended_networks = CleanUp(std::move(extended_networks), symmetric,
+                              keep_best_count, gen, score);
 
   return extended_networks;
 }
+
+std::vector<Network>
+AddComparatorsPipelined(int n, std::vector<Network> networks, bool symmetric,
+                        int num_comparators, int keep_best_count,
+                        std::mt19937 *gen, const NetworkScore &score) {
+  CHECK_GT(num_comparators, 0);
+  bool overlap = score.kind == NetworkScore::kNumOutputs;
+  // The number of chunks of the redundancy check of a step. More chunks start
+  // the next step earlier, but each chunk is also checked against the
+  // networks kept so far.
+  constexpr int kNumChunks = 16;
+  auto step = std::make_unique<PipelineStep>(n, symmetric);
+  for (Network &network : networks) {
+    step->Add(std::move(network));
+  }
+  networks.clear();
+  for (int k = 0; k < num_comparators; k++) {
+    LOG(INFO) << "Add one comparator on " << k << " comparators";
+    std::vector<Network> extended_networks = step->Finish();
+    bool is_last_step = k + 1 == num_comparators;
+    step = is_last_step ? nullptr
+                        : std::make_unique<PipelineStep>(n, symmetric);
+    size_t num_outputs = 0;
+    for (const Network &network : extended_networks) {
+      num_outputs += network.outputs.size();
+    }
+    size_t chunk_outputs = std::max<size_t>(1, num_outputs / kNumChunks);
+    IncrementalCleanUp clean_up(symmetric, keep_best_count, score);
+    for (int begin = 0, end = 0; begin < extended_networks.size();
+         begin = end) {
+      if (extended_networks[begin].outputs.size() > clean_up.max_size()) {
+        break;
+      }
+      size_t outputs = 0;
+      while (end < extended_networks.size() && outputs < chunk_outputs) {
+        outputs += extended_networks[end++].outputs.size();
+      }
+      int64_t num_kept = clean_up.size();
+      auto chunk_begin = extended_networks.begin() + begin;
+      auto chunk_end = extended_networks.begin() + end;
+      clean_up.Add(std::vector<Network>(std::make_move_iterator(chunk_begin),
+                                        std::make_move_iterator(chunk_end)),
+                   gen);
+      if (!is_last_step && overlap) {
+        for (int64_t i = num_kept; i < clean_up.size(); i++) {
+          Network network = clean_up.network(i);
+          network.outputs.assign(clean_up.outputs(i).begin(),
+                                 clean_up.outputs(i).end());
+          step->Add(std::move(network));
+        }
+      }
+    }
+    std::vector<Network>().swap(extended_networks);
+    if (is_last_step) {
+      networks = clean_up.Release();
+    } else if (!overlap) {
+      for (Network &network : clean_up.Release()) {
+        step->Add(std::move(network));
+      }
+    }
+    LOG(INFO) << "After cleanup: networks.size()="
+              << (is_last_step ? networks.size() : step->size());
+    MemoryBudget::Default().LogAdmissionDelay("Adding a comparator");
+  }
+  return networks;
+}
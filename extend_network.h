@@ -4,11 +4,39 @@
 #include <vector>
 
 #include "network.h"
+#include "network_score.h"
 
 // Extends a collection of networks by adding comparators to the last layer.
 // add_one_comparator: If true, adds exactly one comparator per network;
 //                     if false, adds all possible comparators per network;
+// The networks are extended in parallel on ThreadPool::Default(), and the
+// result only depends on gen, not on the number of threads.
+// If --spill_dir is set, the extended networks go through a NetworkSpill, so
+// that only the non-redundant ones are held in memory, and the extensions that
+// are not spilled yet are kept within --memory_budget. Otherwise all the
+// extensions are held until they are cleaned up, which the budget does not
+// cover.
+// The best networks are ranked by score (see CleanUp).
+// The seeds, e.g. the prefixes of the same depth found by previous runs, are
+// cleaned up with the extended networks, before them: the extended networks
+// isomorphic to a seed or made redundant by one are removed.
 std::vector<Network> ExtendNetwork(int n, const std::vector<Network> &networks,
                                    bool symmetric, bool add_one_comparator,
-                                   int keep_best_count, int jobs,
-                                   std::mt19937 *gen);
+                                   int keep_best_count, std::mt19937 *gen,
+                                   const NetworkScore &score = NetworkScore(),
+                                   const std::vector<Network> &seeds = {});
+
+// Adds num_comparators comparators to the last layer of the networks, one at a
+// time, with the same result as num_comparators calls to
+// ExtendNetwork(..., true, ...), unless --backtracking_timeout stops some
+// searches. The steps overlap: the redundancy of the extended networks of a
+// step is checked in chunks of increasing number of outputs (see
+// IncrementalCleanUp), and the networks kept by a chunk are extended by the
+// next step on the thread pool while the next chunks are checked. Unless the
+// score is the number of outputs, the best networks of a step are only known
+// at its end, so the steps do not overlap.
+std::vector<Network>
+AddComparatorsPipelined(int n, std::vector<Network> networks, bool symmetric,
+                        int num_comparators, int keep_best_count,
+                        std::mt19937 *gen,
+                        const NetworkScore &score = NetworkScore());
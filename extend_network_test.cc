@@ -2,26 +2,24 @@
 
 #include <limits>
 #include <string>
-#include <thread>
 #include <utility>
 #include <vector>
 
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
+#include "network_score.h"
 #include "network_utils.h"
 
 void TestTwoLayers(int n, bool symmetric, int expected_networks_count) {
   std::mt19937 gen;
   std::vector<Network> networks = CreateFirstLayer(n, symmetric);
   int keep_best_count = std::numeric_limits<int>::max();
-  int jobs = std::thread::hardware_concurrency();
-  CHECK_GT(jobs, 0);
   for (Network &network : networks) {
     network.AddEmptyLayer();
   }
   networks =
-      ExtendNetwork(n, networks, symmetric, false, keep_best_count, jobs, &gen);
+      ExtendNetwork(n, networks, symmetric, false, keep_best_count, &gen);
 
   EXPECT_EQ(networks.size(), expected_networks_count)
       << "n=" << n << ", symmetric=" << symmetric;
@@ -45,3 +43,53 @@ TEST(ExtendPrefixFull, TwoLayers) {
 
   TestTwoLayers(9, false, 22);
 }
+
+TEST(ExtendPrefixFull, Seeds) {
+  for (bool symmetric : {false, true}) {
+    int n = 8;
+    std::mt19937 gen;
+    std::vector<Network> networks = CreateFirstLayer(n, symmetric);
+    for (Network &network : networks) {
+      network.AddEmptyLayer();
+    }
+    int keep_best_count = std::numeric_limits<int>::max();
+    std::vector<Network> expected =
+        ExtendNetwork(n, networks, symmetric, false, keep_best_count, &gen);
+    // The seeds are kept, and the extended networks add nothing to them.
+    std::vector<Network> result =
+        ExtendNetwork(n, networks, symmetric, false, keep_best_count, &gen,
+                      NetworkScore(), expected);
+    EXPECT_EQ(result.size(), expected.size()) << "symmetric=" << symmetric;
+    result = ExtendNetwork(n, {}, symmetric, false, keep_best_count, &gen,
+                           NetworkScore(), expected);
+    EXPECT_EQ(result.size(), expected.size()) << "symmetric=" << symmetric;
+  }
+}
+
+TEST(AddComparatorsPipelined, SameAsExtendNetwork) {
+  for (bool symmetric : {false, true}) {
+    for (int keep_best_count : {std::numeric_limits<int>::max(), 10}) {
+      int n = 8;
+      std::mt19937 gen;
+      std::vector<Network> networks = CreateFirstLayer(n, symmetric);
+      for (Network &network : networks) {
+        network.AddEmptyLayer();
+      }
+      networks = ExtendNetwork(n, networks, symmetric, false,
+                               std::numeric_limits<int>::max(), &gen);
+      for (Network &network : networks) {
+        network.AddEmptyLayer();
+      }
+      std::vector<Network> expected = networks;
+      for (int k = 0; k < n / 2; k++) {
+        expected =
+            ExtendNetwork(n, expected, symmetric, true, keep_best_count, &gen);
+      }
+      std::vector<Network> result = AddComparatorsPipelined(
+          n, networks, symmetric, n / 2, keep_best_count, &gen);
+      EXPECT_EQ(result, expected)
+          << "symmetric=" << symmetric
+          << ", keep_best_count=" << keep_best_count;
+    }
+  }
+}
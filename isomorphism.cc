@@ -4,52 +4,494 @@
 #include <array>
 #include <atomic>
 #include <bit>
+#include <chrono>
 #include <format>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <random>
-#include <thread>
+#include <span>
+#include <utility>
 #include <vector>
 
+#include "gflags/gflags.h"
 #include "glog/logging.h"
 
+#include "canonical_form.h"
+#include "dominance_cache.h"
+#include "dominance_index.h"
 #include "math_utils.h"
 #include "output_type.h"
+#include "redundancy_snapshot.h"
+#include "sorted_set.h"
+#include "thread_pool.h"
+
+DEFINE_double(backtracking_timeout, 0,
+              "If positive, a subset-isomorphism search of the exact pass of "
+              "FindRedundantOutputs gives up after this many seconds and the "
+              "larger set is kept as not redundant.");
+
+DEFINE_int32(redundancy_max_cheap_passes, 5,
+             "The maximum number of passes of FindRedundantOutputs that "
+             "compare the output sets in random channel orders before the "
+             "exact pass (at most 2 if fast).");
+DEFINE_double(redundancy_min_pass_yield, 0.02,
+              "FindRedundantOutputs goes to the exact pass once a cheap pass "
+              "removes less than this fraction of the remaining output sets.");
+DEFINE_int64(redundancy_max_kept_candidates, int64_t(1) << 26,
+             "The maximum number of candidate pairs from the invariant index "
+             "that FindRedundantOutputs keeps for the next passes; beyond it, "
+             "every pass looks them up again.");
 
 namespace {
 
-std::vector<OutputType>
-SortByWeight(int n, const std::vector<OutputType> &set,
-             const std::vector<uint64_t> &count_one_by_col,
-             std::vector<int> *inv_perm) {
-  CHECK_NOTNULL(inv_perm);
-  std::stable_sort(inv_perm->begin(), inv_perm->end(), [&](int i, int j) {
-    return count_one_by_col[i] < count_one_by_col[j];
-  });
-  std::vector<OutputType> set_perm;
-  set_perm.reserve(set.size());
-  for (OutputType x : set) {
+// Projections to at most this many bits are stored as tables of counts.
+constexpr int kMaxProjectionTableBits = 12;
+
+// Counts the outputs with each channel set with bit-sliced (vertical)
+// counters: bit c of ones_, twos_, fours_ and eights_ are the bits of the
+// count of channel c modulo 16. The outputs are added by blocks of 16 with a
+// tree of carry-save adders (as in the Harley-Seal popcount), which adds them
+// to all the channels at once without branches, and only the carries out of
+// eights_ (the multiples of 16) go to counts[0..n-1]. Flush adds the rest.
+class ColumnCounter {
+public:
+  explicit ColumnCounter(uint64_t *counts) : counts_(counts) {}
+
+  void Add(OutputType x) {
+    block_[size_++] = x;
+    if (size_ == kBlockSize) {
+      AddBlock();
+      size_ = 0;
+    }
+  }
+
+  void Flush() {
+    for (int k = 0; k < size_; k++) {
+      AddPlane(block_[k], 0);
+    }
+    size_ = 0;
+    AddPlane(ones_, 0);
+    AddPlane(twos_, 1);
+    AddPlane(fours_, 2);
+    AddPlane(eights_, 3);
+    ones_ = twos_ = fours_ = eights_ = 0;
+  }
+
+private:
+  static constexpr int kBlockSize = 16;
+
+  // Sets (high, low) to the bitwise sum of a, b and c.
+  static void CarrySaveAdd(OutputType a, OutputType b, OutputType c,
+                           OutputType *high, OutputType *low) {
+    OutputType u = a ^ b;
+    *high = (a & b) | (u & c);
+    *low = u ^ c;
+  }
+
+  void AddBlock() {
+    const OutputType *x = block_.data();
+    OutputType twos_a, twos_b, fours_a, fours_b, eights_a, eights_b, sixteens;
+    CarrySaveAdd(ones_, x[0], x[1], &twos_a, &ones_);
+    CarrySaveAdd(ones_, x[2], x[3], &twos_b, &ones_);
+    CarrySaveAdd(twos_, twos_a, twos_b, &fours_a, &twos_);
+    CarrySaveAdd(ones_, x[4], x[5], &twos_a, &ones_);
+    CarrySaveAdd(ones_, x[6], x[7], &twos_b, &ones_);
+    CarrySaveAdd(twos_, twos_a, twos_b, &fours_b, &twos_);
+    CarrySaveAdd(fours_, fours_a, fours_b, &eights_a, &fours_);
+    CarrySaveAdd(ones_, x[8], x[9], &twos_a, &ones_);
+    CarrySaveAdd(ones_, x[10], x[11], &twos_b, &ones_);
+    CarrySaveAdd(twos_, twos_a, twos_b, &fours_a, &twos_);
+    CarrySaveAdd(ones_, x[12], x[13], &twos_a, &ones_);
+    CarrySaveAdd(ones_, x[14], x[15], &twos_b, &ones_);
+    CarrySaveAdd(twos_, twos_a, twos_b, &fours_b, &twos_);
+    CarrySaveAdd(fours_, fours_a, fours_b, &eights_b, &fours_);
+    CarrySaveAdd(eights_, eights_a, eights_b, &sixteens, &eights_);
+    AddPlane(sixteens, 4);
+  }
+
+  // Adds 2^shift to the counts of the channels set in plane.
+  void AddPlane(OutputType plane, int shift) {
+    for (; plane; plane &= plane - 1) {
+      counts_[std::countr_zero(plane)] += uint64_t(1) << shift;
+    }
+  }
+
+  uint64_t *counts_;
+  std::array<OutputType, kBlockSize> block_;
+  int size_ = 0;
+  OutputType ones_ = 0;
+  OutputType twos_ = 0;
+  OutputType fours_ = 0;
+  OutputType eights_ = 0;
+};
+
+// Moves the channel inv_perm[i] of every output to i and sorts the set.
+void PermuteChannelsInPlace(int n, std::span<OutputType> set,
+                            const std::vector<int> &inv_perm) {
+  for (OutputType &x : set) {
     OutputType x_perm = 0;
     for (int i = 0; i < n; i++) {
-      x_perm |= ((x >> (*inv_perm)[i]) & OutputType(1)) << i;
+      x_perm |= ((x >> inv_perm[i]) & OutputType(1)) << i;
     }
-    set_perm.push_back(x_perm);
+    x = x_perm;
   }
-  std::sort(set_perm.begin(), set_perm.end());
-  return set_perm;
+  std::sort(set.begin(), set.end());
 }
 
-bool IsIsomorphicToSubsetBacktrackingRecursive(
-    int n, const std::vector<OutputType> &set_a,
-    const std::vector<OutputType> &set_b, bool symmetric,
-    const std::vector<std::vector<OutputType>> &set_b_pasts, int pos,
-    std::vector<int> &perm, std::vector<bool> &used, std::mt19937 *gen) {
+// Returns the sorted set with all n bits flipped.
+std::vector<OutputType> InvertOutputs(int n, std::span<const OutputType> set) {
+  // Flipping the bits reverses the order.
+  std::vector<OutputType> set_inv(set.rbegin(), set.rend());
+  for (OutputType &x : set_inv) {
+    x ^= (OutputType(1) << n) - 1;
+  }
+  return set_inv;
+}
+
+// The channel counts of set_a and set_b, which tell which channels of set_a
+// can be mapped to which channels of set_b. A channel a can only be mapped to
+// a channel b if the outputs of each weight with a set (or unset) are at most
+// as many as those with b set (or unset), and two channels a, a2 can only be
+// mapped to b, b2 if the outputs of each combination of the two bits are at
+// most as many.
+class ChannelCompatibility {
+public:
+  ChannelCompatibility(int n, const internal::ChannelCounts &counts_a,
+                       const internal::ChannelCounts &counts_b)
+      : n_(n), counts_a_(counts_a), counts_b_(counts_b) {}
 
-  OutputType past_mask = (OutputType(1) << pos) - 1; // bit 0..pos-1
+  bool Compatible(int a, int b) const {
+    for (int w = 0; w <= n_; w++) {
+      uint32_t ones_a = counts_a_.one_count_by_weight_col[w * n_ + a];
+      uint32_t ones_b = counts_b_.one_count_by_weight_col[w * n_ + b];
+      if (ones_a > ones_b || counts_a_.count_by_weight[w] - ones_a >
+                                 counts_b_.count_by_weight[w] - ones_b) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool PairCompatible(int a, int b, int a2, int b2) const {
+    int64_t both_a = counts_a_.pair_count[a * n_ + a2];
+    int64_t both_b = counts_b_.pair_count[b * n_ + b2];
+    int64_t first_a = counts_a_.one_count_by_col[a] - both_a;
+    int64_t first_b = counts_b_.one_count_by_col[b] - both_b;
+    int64_t second_a = counts_a_.one_count_by_col[a2] - both_a;
+    int64_t second_b = counts_b_.one_count_by_col[b2] - both_b;
+    int64_t none_a = counts_a_.size - both_a - first_a - second_a;
+    int64_t none_b = counts_b_.size - both_b - first_b - second_b;
+    return both_a <= both_b && first_a <= first_b && second_a <= second_b &&
+           none_a <= none_b;
+  }
+
+private:
+  int n_;
+  const internal::ChannelCounts &counts_a_;
+  const internal::ChannelCounts &counts_b_;
+};
+
+// Returns true if the positions pos..end-1 can be given distinct channels of
+// their domains (Hall's condition), by augmenting paths. In the symmetric
+// case, a channel and its reflection count as one.
+bool HasMatching(int n, bool symmetric, const std::vector<uint64_t> &domains,
+                 int pos, int end) {
+  std::vector<uint64_t> pair_domains(domains.begin() + pos,
+                                     domains.begin() + end);
   if (symmetric) {
-    past_mask |= past_mask << (n - pos); // bit n-pos .. n-1
+    for (uint64_t &domain : pair_domains) {
+      uint64_t low = domain & ((uint64_t(1) << (n / 2)) - 1);
+      uint64_t high = 0;
+      for (uint64_t d = domain >> (n / 2); d; d &= d - 1) {
+        high |= uint64_t(1) << (n / 2 - 1 - std::countr_zero(d));
+      }
+      domain = low | high;
+    }
+  }
+  // owner[c] is the position matched to channel c, or -1.
+  std::vector<int> owner(n, -1);
+  uint64_t visited = 0;
+  auto augment = [&](auto &self, int p) -> bool {
+    for (uint64_t d = pair_domains[p] & ~visited; d; d &= d - 1) {
+      int c = std::countr_zero(d);
+      visited |= uint64_t(1) << c;
+      if (owner[c] < 0 || self(self, owner[c])) {
+        owner[c] = p;
+        return true;
+      }
+    }
+    return false;
+  };
+  for (int p = 0; p < pair_domains.size(); p++) {
+    visited = 0;
+    if (!augment(augment, p)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The subset-isomorphism backtracking of set_a into set_b. It maps the
+// channels of set_a to the positions 0, 1, ... of set_b (and their reflections
+// if symmetric) one at a time.
+//
+// The search first runs on the calling thread. If it has not finished after
+// options.sequential_node_limit nodes, it is restarted with the first
+// kParallelLevels levels split into tasks of the thread pool, which idle
+// workers steal. The tasks stop as soon as one of them finds a permutation.
+class BacktrackingSearch {
+public:
+  BacktrackingSearch(std::span<const OutputType> set_a,
+                     const internal::SetProjections &projections_b,
+                     const ChannelCompatibility &compatibility,
+                     const internal::BacktrackingOptions &options)
+      : set_a_(set_a), projections_b_(projections_b),
+        compatibility_(compatibility), options_(options),
+        pool_(options.pool != nullptr ? options.pool : &ThreadPool::Default()),
+        n_(projections_b.n()), symmetric_(projections_b.symmetric()),
+        end_(symmetric_ ? n_ / 2 : n_) {
+    if (options.timeout_seconds > 0) {
+      deadline_ = std::chrono::steady_clock::now() +
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::duration<double>(options.timeout_seconds));
+    }
+  }
+
+  // Runs the search from the initial domains of the positions.
+  bool Run(const std::vector<uint64_t> &domains,
+           internal::BacktrackingStats *stats, std::vector<int> *witness) {
+    State state = NewState();
+    state.domains[0] = domains;
+    if (pool_->num_threads() > 1) {
+      node_limit_ = options_.sequential_node_limit;
+    }
+    bool found = Recursive(state, 0);
+    if (stop_.load(std::memory_order_relaxed) == kNodeLimit) {
+      // A hard instance: search again in parallel.
+      stop_.store(kNone, std::memory_order_relaxed);
+      node_limit_ = 0;
+      parallel_ = true;
+      found = Recursive(state, 0);
+    }
+    Flush(state);
+    if (stats != nullptr) {
+      stats->num_nodes = num_nodes_.load(std::memory_order_relaxed);
+      stats->parallel = parallel_;
+      stats->timed_out = stop_.load(std::memory_order_relaxed) == kTimeout;
+    }
+    found = found && stop_.load(std::memory_order_relaxed) != kTimeout;
+    if (found && witness != nullptr) {
+      *witness = witness_;
+    }
+    return found;
   }
 
+private:
+  // The levels of the first kParallelLevels positions are split into tasks.
+  static constexpr int kParallelLevels = 2;
+  // The nodes between two checks of the deadline and of the node limit.
+  static constexpr int kCheckInterval = 256;
+
+  // Why the search stops early.
+  enum Stop { kNone, kFound, kNodeLimit, kTimeout };
+
+  // The per-thread state of the search.
+  //
+  // levels[pos][k] is set_a[k] with its bits perm[0..pos-1] (and
+  // perm[n-pos..n-1] if symmetric) moved to 0..pos-1 (and n-pos..n-1). Each
+  // level extends the previous one by the bit (or the symmetric pair of bits)
+  // of the new position.
+  //
+  // domains[pos][p] is the mask of the channels of set_a that can still be
+  // mapped to the position p >= pos: the unused channels compatible with p
+  // and, pairwise, with each of perm[0..pos-1].
+  //
+  // channel_to_pos[c] is the position the channel c of set_a is mapped to, for
+  // the channels mapped so far.
+  struct State {
+    std::vector<std::vector<OutputType>> levels;
+    std::vector<std::vector<uint64_t>> domains;
+    std::vector<int> channel_to_pos;
+    std::vector<uint32_t> scratch;
+    int64_t num_nodes = 0;
+    int64_t num_flushed_nodes = 0;
+  };
+
+  State NewState() const {
+    State state;
+    state.levels.assign(n_ + 1, std::vector<OutputType>(set_a_.size(), 0));
+    state.domains.assign(n_ + 1, std::vector<uint64_t>(n_, 0));
+    state.channel_to_pos.assign(n_, -1);
+    return state;
+  }
+
+  // Counts a node and returns false if the search has to stop.
+  bool Continue(State &state) {
+    if (stop_.load(std::memory_order_relaxed) != kNone) {
+      return false;
+    }
+    if (state.num_nodes++ % kCheckInterval != 0) {
+      return true;
+    }
+    Flush(state);
+    if (node_limit_ > 0 &&
+        num_nodes_.load(std::memory_order_relaxed) >= node_limit_) {
+      stop_.store(kNodeLimit, std::memory_order_relaxed);
+      return false;
+    }
+    if (deadline_ && std::chrono::steady_clock::now() > *deadline_) {
+      stop_.store(kTimeout, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // Adds the nodes of a state to the total.
+  void Flush(State &state) {
+    num_nodes_.fetch_add(state.num_nodes - state.num_flushed_nodes,
+                         std::memory_order_relaxed);
+    state.num_flushed_nodes = state.num_nodes;
+  }
+
+  // Maps the channel i to pos: computes the domains and the level of pos + 1.
+  // Returns false if the domains rule out the assignment.
+  bool Assign(State &state, int pos, int i) const {
+    int n = n_;
+    bool symmetric = symmetric_;
+    const std::vector<uint64_t> &domain = state.domains[pos];
+    std::vector<uint64_t> &next_domain = state.domains[pos + 1];
+
+    // Remove i from the domains of the next positions, and the channels that
+    // are not compatible with i at pos.
+    uint64_t used = uint64_t(1) << i;
+    if (symmetric) {
+      used |= uint64_t(1) << (n - 1 - i);
+    }
+    for (int p = pos + 1; p < end_; p++) {
+      next_domain[p] = domain[p] & ~used;
+      for (uint64_t d = next_domain[p]; d; d &= d - 1) {
+        int i2 = std::countr_zero(d);
+        bool compatible = compatibility_.PairCompatible(i, pos, i2, p);
+        if (symmetric) {
+          compatible =
+              compatible &&
+              compatibility_.PairCompatible(i, pos, n - 1 - i2, n - 1 - p) &&
+              compatibility_.PairCompatible(n - 1 - i, n - 1 - pos, i2, p) &&
+              compatibility_.PairCompatible(n - 1 - i, n - 1 - pos,
+                                            n - 1 - i2, n - 1 - p);
+        }
+        if (!compatible) {
+          next_domain[p] &= ~(uint64_t(1) << i2);
+        }
+      }
+      if (next_domain[p] == 0) {
+        return false;
+      }
+    }
+    if (!HasMatching(n, symmetric, next_domain, pos + 1, end_)) {
+      return false;
+    }
+
+    state.channel_to_pos[i] = pos;
+    if (symmetric) {
+      state.channel_to_pos[n - 1 - i] = n - 1 - pos;
+    }
+    const std::vector<OutputType> &level = state.levels[pos];
+    std::vector<OutputType> &next_level = state.levels[pos + 1];
+    if (symmetric) {
+      for (int k = 0; k < set_a_.size(); k++) {
+        OutputType a = set_a_[k];
+        next_level[k] = level[k] | ((a >> i) & OutputType(1)) << pos |
+                        ((a >> (n - 1 - i)) & OutputType(1)) << (n - 1 - pos);
+      }
+    } else {
+      for (int k = 0; k < set_a_.size(); k++) {
+        next_level[k] = level[k] | ((set_a_[k] >> i) & OutputType(1)) << pos;
+      }
+    }
+    return true;
+  }
+
+  bool Recursive(State &state, int pos, const TaskGroup *parent = nullptr) {
+    if (!Continue(state)) {
+      return false;
+    }
+    // Check the partial permutation perm[0..pos-1].
+    if (!projections_b_.Includes(pos, state.levels[pos], state.scratch)) {
+      return false;
+    }
+    if (pos == end_) {
+      std::lock_guard<std::mutex> lock(witness_mutex_);
+      if (witness_.empty()) {
+        witness_ = state.channel_to_pos;
+      }
+      return true;
+    }
+    CHECK_LT(pos, end_);
+
+    if (parallel_ && pos < kParallelLevels) {
+      // One task per channel of the domain, each with its own state.
+      TaskGroup group(pool_, parent);
+      for (uint64_t d = state.domains[pos][pos]; d; d &= d - 1) {
+        int i = std::countr_zero(d);
+        group.Run([this, &state, &group, pos, i]() {
+          if (stop_.load(std::memory_order_relaxed) != kNone) {
+            return;
+          }
+          State child = NewState();
+          child.levels[pos] = state.levels[pos];
+          child.domains[pos] = state.domains[pos];
+          child.channel_to_pos = state.channel_to_pos;
+          if (Assign(child, pos, i) && Recursive(child, pos + 1, &group)) {
+            int expected = kNone;
+            stop_.compare_exchange_strong(expected, kFound);
+            group.Cancel();
+          }
+          Flush(child);
+        });
+      }
+      group.Wait();
+      return stop_.load(std::memory_order_relaxed) == kFound;
+    }
+
+    // Try each channel of the domain for the current position
+    for (uint64_t d = state.domains[pos][pos]; d; d &= d - 1) {
+      int i = std::countr_zero(d);
+      if (Assign(state, pos, i) && Recursive(state, pos + 1, parent)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::span<const OutputType> set_a_;
+  const internal::SetProjections &projections_b_;
+  const ChannelCompatibility &compatibility_;
+  const internal::BacktrackingOptions &options_;
+  ThreadPool *pool_;
+  int n_;
+  bool symmetric_;
+  // The number of positions to assign.
+  int end_;
+  std::optional<std::chrono::steady_clock::time_point> deadline_;
+  int64_t node_limit_ = 0;
+  bool parallel_ = false;
+  std::atomic<int> stop_{kNone};
+  std::atomic<int64_t> num_nodes_{0};
+  // The channel_to_pos of the first leaf found.
+  std::mutex witness_mutex_;
+  std::vector<int> witness_;
+};
+
+// The backtracking that projects and sorts set_a from scratch at every node,
+// kept as the reference for the tests.
+bool IsIsomorphicToSubsetBacktrackingReferenceRecursive(
+    int n, const std::vector<OutputType> &set_a, bool symmetric,
+    const std::vector<std::vector<OutputType>> &set_b_pasts, int pos,
+    std::vector<int> &perm, std::vector<bool> &used) {
   // Check the partial permutation perm[0..pos-1].
   std::vector<OutputType> set_a_past_inv_perm;
   set_a_past_inv_perm.reserve(set_a.size());
@@ -71,40 +513,24 @@ bool IsIsomorphicToSubsetBacktrackingRecursive(
     return false;
   }
 
-  if (pos == n) {
+  if (pos == n || (symmetric && pos == n / 2)) {
     return true;
   }
-  CHECK_LT(pos, n);
-  if (symmetric) {
-    CHECK_EQ(n % 2, 0);
-    if (pos == n / 2) {
-      return true;
-    }
-    CHECK_LT(pos, n - 1 - pos);
-  }
 
-  // Try each unused bit position for the current position
   for (int i = 0; i < n; i++) {
-    if (used[i]) {
+    if (used[i] || (symmetric && used[n - 1 - i])) {
       continue;
     }
-    if (symmetric && used[n - 1 - i]) {
-      continue;
-    }
-
     perm[pos] = i;
     used[i] = true;
     if (symmetric) {
       perm[n - 1 - pos] = n - 1 - i;
       used[n - 1 - i] = true;
     }
-
-    if (IsIsomorphicToSubsetBacktrackingRecursive(n, set_a, set_b, symmetric,
-                                                  set_b_pasts, pos + 1, perm,
-                                                  used, gen)) {
+    if (IsIsomorphicToSubsetBacktrackingReferenceRecursive(
+            n, set_a, symmetric, set_b_pasts, pos + 1, perm, used)) {
       return true;
     }
-
     used[i] = false;
     if (symmetric) {
       used[n - 1 - i] = false;
@@ -113,16 +539,15 @@ bool IsIsomorphicToSubsetBacktrackingRecursive(
   return false;
 }
 
-bool IsIsomorphicToSubsetNegativePrecheckByRow(
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_a_sorted,
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_b_sorted) {
-  for (int bit = 0; bit < 2; bit++) {
-    CHECK_LE(count_by_row_a_sorted[bit].size(),
-             count_by_row_b_sorted[bit].size());
-    for (int i = 0; i < count_by_row_a_sorted[bit].size(); i++) {
-      if (count_by_row_a_sorted[bit][i] < count_by_row_b_sorted[bit][i]) {
-        return false;
-      }
+bool IsIsomorphicToSubsetNegativePrecheckByWeight(
+    int n, const std::vector<uint32_t> &count_by_weight_a,
+    const std::vector<uint32_t> &count_by_weight_b) {
+  CHECK_EQ(count_by_weight_a.size(), n + 1);
+  CHECK_EQ(count_by_weight_b.size(), n + 1);
+  // A permutation keeps the weight of every output.
+  for (int weight = 0; weight <= n; weight++) {
+    if (count_by_weight_a[weight] > count_by_weight_b[weight]) {
+      return false;
     }
   }
   return true;
@@ -143,38 +568,43 @@ bool IsIsomorphicToSubsetNegativePrecheckByCol(
   return true;
 }
 
+// An estimate of the memory of the exact check of a set against its
+// candidates: the inverse of the set, and the tables of the projections of the
+// set and of its inverse, about a count and a key per output and channel.
+int64_t ExactCheckBytes(int n, size_t set_size) {
+  return set_size * sizeof(OutputType) +
+         2 * n * set_size * (sizeof(uint32_t) + sizeof(OutputType));
+}
+
 } // namespace
 
 namespace internal {
 
-std::array<std::vector<uint8_t>, 2>
-AggregateRows(int n, const std::vector<OutputType> &set, bool sort) {
-  std::vector<uint8_t> one_count_by_row(set.size(), 0);
-  std::vector<uint8_t> zero_count_by_row(set.size(), 0);
-  for (int i = 0; i < set.size(); i++) {
-    OutputType x = set[i];
-    one_count_by_row[i] = std::popcount(x);
-    zero_count_by_row[i] = n - one_count_by_row[i];
+std::vector<uint32_t> CountByWeight(int n, std::span<const OutputType> set) {
+  std::vector<uint32_t> count_by_weight(n + 1, 0);
+  for (OutputType x : set) {
+    count_by_weight[std::popcount(x)]++;
   }
-  if (sort) {
-    std::sort(one_count_by_row.begin(), one_count_by_row.end());
-    std::sort(zero_count_by_row.begin(), zero_count_by_row.end());
+  return count_by_weight;
+}
+
+std::vector<uint64_t> CountOnesByColumn(int n,
+                                        std::span<const OutputType> set) {
+  std::vector<uint64_t> one_count_by_col(n, 0);
+  ColumnCounter counter(one_count_by_col.data());
+  for (OutputType x : set) {
+    counter.Add(x);
   }
-  return {zero_count_by_row, one_count_by_row};
+  counter.Flush();
+  return one_count_by_col;
 }
 
 std::array<std::vector<uint64_t>, 2>
-AggregateColumns(int n, const std::vector<OutputType> &set, bool sort) {
-  std::vector<uint64_t> one_count_by_col(n, 0);
-  std::vector<uint64_t> zero_count_by_col(n, 0);
+AggregateColumns(int n, std::span<const OutputType> set, bool sort) {
+  std::vector<uint64_t> one_count_by_col = CountOnesByColumn(n, set);
+  std::vector<uint64_t> zero_count_by_col(n);
   for (int i = 0; i < n; i++) {
-    uint64_t one_count_by_col_i = 0;
-    for (OutputType x : set) {
-      OutputType bit = (x >> i) & OutputType(1);
-      one_count_by_col_i += bit;
-    }
-    one_count_by_col[i] = one_count_by_col_i;
-    zero_count_by_col[i] = set.size() - one_count_by_col_i;
+    zero_count_by_col[i] = set.size() - one_count_by_col[i];
   }
   if (sort) {
     std::sort(one_count_by_col.begin(), one_count_by_col.end());
@@ -183,6 +613,122 @@ AggregateColumns(int n, const std::vector<OutputType> &set, bool sort) {
   return {zero_count_by_col, one_count_by_col};
 }
 
+OutputsInvariants ComputeInvariants(int n, std::span<const OutputType> set) {
+  OutputsInvariants invariants;
+  std::vector<uint32_t> count_by_weight(n + 1, 0);
+  invariants.one_count_by_weight_col.assign((n + 1) * n, 0);
+  for (OutputType x : set) {
+    int weight = std::popcount(x);
+    count_by_weight[weight]++;
+    uint32_t *one_count = &invariants.one_count_by_weight_col[weight * n];
+    for (int i = 0; i < n; i++) {
+      one_count[i] += (x >> i) & OutputType(1);
+    }
+  }
+  std::vector<uint32_t> one_count_by_col(n, 0);
+  for (int weight = 0; weight <= n; weight++) {
+    for (int i = 0; i < n; i++) {
+      one_count_by_col[i] +=
+          invariants.one_count_by_weight_col[weight * n + i];
+    }
+    std::sort(invariants.one_count_by_weight_col.begin() + weight * n,
+              invariants.one_count_by_weight_col.begin() + (weight + 1) * n);
+  }
+  std::vector<uint32_t> zero_count_by_col(n);
+  for (int i = 0; i < n; i++) {
+    zero_count_by_col[i] = set.size() - one_count_by_col[i];
+  }
+  std::sort(zero_count_by_col.begin(), zero_count_by_col.end());
+  std::sort(one_count_by_col.begin(), one_count_by_col.end());
+  invariants.key = zero_count_by_col;
+  invariants.key.insert(invariants.key.end(), one_count_by_col.begin(),
+                        one_count_by_col.end());
+  invariants.key.insert(invariants.key.end(), count_by_weight.begin(),
+                        count_by_weight.end());
+  return invariants;
+}
+
+OutputsInvariants InvertInvariants(int n,
+                                   const OutputsInvariants &invariants) {
+  OutputsInvariants inv;
+  const std::vector<uint32_t> &key = invariants.key;
+  // Zeros and ones swap, and weight w becomes n - w.
+  inv.key.insert(inv.key.end(), key.begin() + n, key.begin() + 2 * n);
+  inv.key.insert(inv.key.end(), key.begin(), key.begin() + n);
+  inv.key.insert(inv.key.end(), key.rbegin(), key.rbegin() + n + 1);
+  inv.one_count_by_weight_col.resize((n + 1) * n);
+  for (int weight = 0; weight <= n; weight++) {
+    int old_weight = n - weight;
+    uint32_t count = key[2 * n + old_weight];
+    for (int i = 0; i < n; i++) {
+      inv.one_count_by_weight_col[weight * n + i] =
+          count -
+          invariants.one_count_by_weight_col[old_weight * n + (n - 1 - i)];
+    }
+  }
+  return inv;
+}
+
+bool InvariantsAllowSubset(int n, const OutputsInvariants &a,
+                           const OutputsInvariants &b) {
+  for (int d = 0; d < a.key.size(); d++) {
+    if (a.key[d] > b.key[d]) {
+      return false;
+    }
+  }
+  for (int weight = 0; weight <= n; weight++) {
+    uint32_t count_a = a.key[2 * n + weight];
+    uint32_t count_b = b.key[2 * n + weight];
+    const uint32_t *ones_a = &a.one_count_by_weight_col[weight * n];
+    const uint32_t *ones_b = &b.one_count_by_weight_col[weight * n];
+    for (int i = 0; i < n; i++) {
+      // The sorted column counts of ones, and of zeros among the outputs of
+      // this weight.
+      if (ones_a[i] > ones_b[i] ||
+          count_a - ones_a[n - 1 - i] > count_b - ones_b[n - 1 - i]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+SubsetSignatures::SubsetSignatures(int64_t num_sets, int64_t max_size) {
+  uint64_t num_bits =
+      std::bit_ceil(std::max<uint64_t>(512, kBitsPerOutput * max_size));
+  log_num_bits_ = std::countr_zero(num_bits);
+  // The two hashes are taken from disjoint bits of a 64-bit product.
+  CHECK_LE(2 * log_num_bits_, 64);
+  num_words_ = num_bits / 64;
+  words_.resize(num_sets * num_words_);
+}
+
+void SubsetSignatures::Compute(int64_t i, std::span<const OutputType> set) {
+  uint64_t *signature = &words_[i * num_words_];
+  std::fill(signature, signature + num_words_, 0);
+  uint64_t mask = (uint64_t(1) << log_num_bits_) - 1;
+  for (OutputType x : set) {
+    // Fibonacci hashing: the top bits of the product select the first bit,
+    // and the next ones the second bit.
+    uint64_t hash = uint64_t(x) * 0x9e3779b97f4a7c15ULL;
+    uint64_t bit_1 = hash >> (64 - log_num_bits_);
+    uint64_t bit_2 = (hash >> (64 - 2 * log_num_bits_)) & mask;
+    signature[bit_1 / 64] |= uint64_t(1) << (bit_1 % 64);
+    signature[bit_2 / 64] |= uint64_t(1) << (bit_2 % 64);
+  }
+}
+
+bool SubsetSignatures::AllowsSubset(int64_t j, int64_t i) const {
+  const uint64_t *signature_j = &words_[j * num_words_];
+  const uint64_t *signature_i = &words_[i * num_words_];
+  for (int64_t k = 0; k < num_words_; k++) {
+    if (signature_j[k] & ~signature_i[k]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool IsIsomorphicToSubsetSlow(int n, const std::vector<OutputType> &set_a,
                               const std::vector<OutputType> &set_b) {
   CHECK(std::is_sorted(set_b.begin(), set_b.end()));
@@ -199,34 +745,197 @@ bool IsIsomorphicToSubsetSlow(int n, const std::vector<OutputType> &set_a,
       set_a_perm.push_back(a_perm);
     }
     std::sort(set_a_perm.begin(), set_a_perm.end());
-    if (std::includes(set_b.begin(), set_b.end(), set_a_perm.begin(),
-                      set_a_perm.end())) {
+    if (SortedIsSubset(set_a_perm, set_b)) {
       return true;
     }
   } while (std::next_permutation(perm.begin(), perm.end()));
   return false;
 }
 
+ChannelCounts ComputeChannelCounts(int n, std::span<const OutputType> set) {
+  ChannelCounts counts;
+  counts.size = set.size();
+  counts.count_by_weight.assign(n + 1, 0);
+  counts.one_count_by_weight_col.assign((n + 1) * n, 0);
+  counts.one_count_by_col.assign(n, 0);
+  counts.pair_count.assign(n * n, 0);
+  // The outputs with each channel set, as bitsets, for the pair counts.
+  int num_words = (set.size() + 63) / 64;
+  std::vector<uint64_t> cols(n * num_words, 0);
+  for (int k = 0; k < set.size(); k++) {
+    OutputType x = set[k];
+    int weight = std::popcount(x);
+    counts.count_by_weight[weight]++;
+    for (OutputType y = x; y; y &= y - 1) {
+      int c = std::countr_zero(y);
+      counts.one_count_by_weight_col[weight * n + c]++;
+      counts.one_count_by_col[c]++;
+      cols[c * num_words + k / 64] |= uint64_t(1) << (k % 64);
+    }
+  }
+  for (int c = 0; c < n; c++) {
+    counts.pair_count[c * n + c] = counts.one_count_by_col[c];
+    for (int d = c + 1; d < n; d++) {
+      const uint64_t *col_c = &cols[c * num_words];
+      const uint64_t *col_d = &cols[d * num_words];
+      uint32_t count = 0;
+      for (int w = 0; w < num_words; w++) {
+        count += std::popcount(col_c[w] & col_d[w]);
+      }
+      counts.pair_count[c * n + d] = count;
+      counts.pair_count[d * n + c] = count;
+    }
+  }
+  return counts;
+}
+
+SetProjections::SetProjections(int n, std::span<const OutputType> set,
+                               bool symmetric)
+    : n_(n), symmetric_(symmetric),
+      channel_counts_(ComputeChannelCounts(n, set)) {
+  if (symmetric) {
+    CHECK_EQ(n % 2, 0);
+  }
+  int max_pos = symmetric ? n / 2 : n;
+  projections_.resize(max_pos + 1);
+  for (int pos = 0; pos <= max_pos; pos++) {
+    OutputType past_mask = (OutputType(1) << pos) - 1; // bit 0..pos-1
+    if (symmetric) {
+      past_mask |= past_mask << (n - pos); // bit n-pos .. n-1
+    }
+    Projection &projection = projections_[pos];
+    projection.offset = counts_.size();
+    int num_bits = symmetric ? 2 * pos : pos;
+    if (num_bits <= kMaxProjectionTableBits) {
+      projection.capacity = size_t(1) << num_bits;
+      counts_.resize(counts_.size() + projection.capacity, 0);
+      for (OutputType x : set) {
+        counts_[projection.offset + TableIndex(pos, x & past_mask)]++;
+      }
+    } else {
+      // At least twice as many slots as values.
+      projection.hashed = true;
+      projection.log_capacity =
+          std::max(1, static_cast<int>(std::bit_width(2 * set.size())));
+      projection.capacity = size_t(1) << projection.log_capacity;
+      counts_.resize(counts_.size() + projection.capacity, 0);
+      projection.key_offset = keys_.size();
+      keys_.resize(keys_.size() + projection.capacity, 0);
+      uint32_t *counts = &counts_[projection.offset];
+      OutputType *keys = &keys_[projection.key_offset];
+      for (OutputType x : set) {
+        x &= past_mask;
+        size_t slot = Hash(projection, x);
+        while (counts[slot] > 0 && keys[slot] != x) {
+          slot = (slot + 1) & (projection.capacity - 1);
+        }
+        keys[slot] = x;
+        counts[slot]++;
+      }
+    }
+    max_capacity_ = std::max(max_capacity_, projection.capacity);
+  }
+}
+
+int64_t SetProjections::Slot(int pos, OutputType x) const {
+  const Projection &projection = projections_[pos];
+  if (!projection.hashed) {
+    return TableIndex(pos, x);
+  }
+  const uint32_t *counts = &counts_[projection.offset];
+  const OutputType *keys = &keys_[projection.key_offset];
+  size_t slot = Hash(projection, x);
+  while (counts[slot] > 0) {
+    if (keys[slot] == x) {
+      return slot;
+    }
+    slot = (slot + 1) & (projection.capacity - 1);
+  }
+  return -1;
+}
+
+bool SetProjections::Includes(int pos,
+                              const std::vector<OutputType> &projected_a,
+                              std::vector<uint32_t> &scratch) const {
+  // Count the values of projected_a until one occurs more often than in the
+  // set, then clear the counts.
+  const uint32_t *counts = &counts_[projections_[pos].offset];
+  if (scratch.size() < max_capacity_) {
+    scratch.assign(max_capacity_, 0);
+  }
+  int end = 0;
+  bool includes = true;
+  for (; end < projected_a.size(); end++) {
+    int64_t slot = Slot(pos, projected_a[end]);
+    if (slot < 0 || ++scratch[slot] > counts[slot]) {
+      includes = false;
+      end += slot >= 0;
+      break;
+    }
+  }
+  for (int k = 0; k < end; k++) {
+    scratch[Slot(pos, projected_a[k])] = 0;
+  }
+  return includes;
+}
+
 bool IsIsomorphicToSubsetBacktracking(int n,
                                       const std::vector<OutputType> &set_a,
                                       const std::vector<OutputType> &set_b,
-                                      bool symmetric, std::mt19937 *gen) {
+                                      bool symmetric) {
+  return IsIsomorphicToSubsetBacktracking(set_a,
+                                          SetProjections(n, set_b, symmetric));
+}
+
+bool IsIsomorphicToSubsetBacktracking(std::span<const OutputType> set_a,
+                                      const SetProjections &projections_b,
+                                      const BacktrackingOptions &options,
+                                      BacktrackingStats *stats,
+                                      std::vector<int> *witness) {
+  int n = projections_b.n();
+  bool symmetric = projections_b.symmetric();
+  CHECK_LE(n, 64);
+  if (stats != nullptr) {
+    *stats = BacktrackingStats();
+  }
+  ChannelCounts counts_a = ComputeChannelCounts(n, set_a);
+  ChannelCompatibility compatibility(n, counts_a,
+                                     projections_b.channel_counts());
+  int end = symmetric ? n / 2 : n;
+  std::vector<uint64_t> domains(n, 0);
+  for (int p = 0; p < end; p++) {
+    for (int i = 0; i < n; i++) {
+      bool compatible = compatibility.Compatible(i, p);
+      if (symmetric) {
+        compatible = compatible &&
+                     compatibility.Compatible(n - 1 - i, n - 1 - p) &&
+                     compatibility.PairCompatible(i, p, n - 1 - i, n - 1 - p);
+      }
+      if (compatible) {
+        domains[p] |= uint64_t(1) << i;
+      }
+    }
+  }
+  if (!HasMatching(n, symmetric, domains, 0, end)) {
+    return false;
+  }
+  return BacktrackingSearch(set_a, projections_b, compatibility, options)
+      .Run(domains, stats, witness);
+}
+
+bool IsIsomorphicToSubsetBacktrackingReference(
+    int n, const std::vector<OutputType> &set_a,
+    const std::vector<OutputType> &set_b, bool symmetric) {
   if (symmetric) {
     CHECK_EQ(n % 2, 0);
   }
-
   CHECK(std::is_sorted(set_b.begin(), set_b.end()));
-  std::vector<int> perm(n);
-  std::vector<bool> used(n, false);
-
   std::vector<std::vector<OutputType>> set_b_pasts;
   for (int pos = 0; pos <= (symmetric ? n / 2 : n); pos++) {
-    // past_mask
     OutputType past_mask = (OutputType(1) << pos) - 1; // bit 0..pos-1
     if (symmetric) {
       past_mask |= past_mask << (n - pos); // bit n-pos .. n-1
     }
-    // set_b_past
     std::vector<OutputType> set_b_past;
     set_b_past.reserve(set_b.size());
     for (OutputType b : set_b) {
@@ -235,101 +944,304 @@ bool IsIsomorphicToSubsetBacktracking(int n,
     std::sort(set_b_past.begin(), set_b_past.end());
     set_b_pasts.push_back(std::move(set_b_past));
   }
-
-  return IsIsomorphicToSubsetBacktrackingRecursive(
-      n, set_a, set_b, symmetric, set_b_pasts, 0, perm, used, gen);
+  std::vector<int> perm(n);
+  std::vector<bool> used(n, false);
+  return IsIsomorphicToSubsetBacktrackingReferenceRecursive(
+      n, set_a, symmetric, set_b_pasts, 0, perm, used);
 }
 
-bool IsIsomorphicToSubset(
-    int n, const std::vector<OutputType> &set_a,
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_a_sorted,
-    const std::array<std::vector<uint64_t>, 2> &count_by_col_a_sorted,
-    const std::vector<OutputType> &set_b,
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_b_sorted,
-    const std::array<std::vector<uint64_t>, 2> &count_by_col_b_sorted,
-    bool symmetric, std::mt19937 *gen) {
-  CHECK(std::is_sorted(set_b.begin(), set_b.end()));
+// The canonical labels of the sets of the exact pass and of their inverses,
+// which identify them in the dominance cache, computed on first use.
+//
+// The hash of an inverse is derived from the canonical form of the set, as it
+// is also an invariant of the isomorphism class of the inverse: the
+// complement of the form, or the form itself if symmetric (the inverse is then
+// the reflection of the set). Only the positions, which the witnesses of the
+// positive results need, take a second search, on the inverse as
+// InvertOutputs returns it.
+class LazyCanonicalLabels {
+public:
+  LazyCanonicalLabels(int n, const OutputsCollection &sets, bool symmetric)
+      : n_(n), sets_(sets), symmetric_(symmetric), labels_(sets.size()),
+        once_flags_(sets.size()),
+        positions_inv_once_flags_(sets.size()) {}
 
-  if (!IsIsomorphicToSubsetNegativePrecheck(
-          n, set_a, count_by_row_a_sorted, count_by_col_a_sorted, set_b,
-          count_by_row_b_sorted, count_by_col_b_sorted)) {
+  uint64_t Hash(int k, bool inverse) {
+    Compute(k);
+    return inverse ? labels_[k].hash_inv : labels_[k].hash;
+  }
+
+  // The channel of the canonical form of each channel of the set (in the
+  // form that Hash identifies).
+  const std::vector<int> &Positions(int k, bool inverse) {
+    Compute(k);
+    if (!inverse) {
+      return labels_[k].positions;
+    }
+    std::call_once(positions_inv_once_flags_[k], [&]() {
+      CanonicalForm(n_, InvertOutputs(n_, sets_[k]), symmetric_, 256,
+                    &labels_[k].positions_inv);
+    });
+    return labels_[k].positions_inv;
+  }
+
+private:
+  struct Label {
+    uint64_t hash = 0;
+    uint64_t hash_inv = 0;
+    std::vector<int> positions;
+    std::vector<int> positions_inv;
+  };
+
+  void Compute(int k) {
+    std::call_once(once_flags_[k], [&]() {
+      Label &label = labels_[k];
+      std::vector<OutputType> form =
+          CanonicalForm(n_, sets_[k], symmetric_, 256, &label.positions);
+      label.hash = HashOutputs(form);
+      if (symmetric_) {
+        label.hash_inv = label.hash;
+        return;
+      }
+      for (OutputType &x : form) {
+        x ^= (OutputType(1) << n_) - 1;
+      }
+      std::reverse(form.begin(), form.end());
+      label.hash_inv = HashOutputs(form);
+    });
+  }
+
+  int n_;
+  const OutputsCollection &sets_;
+  bool symmetric_;
+  std::vector<Label> labels_;
+  std::vector<std::once_flag> once_flags_;
+  std::vector<std::once_flag> positions_inv_once_flags_;
+};
+
+// Returns true if a cached witness (in the channels of the canonical forms)
+// maps set_a into set_b.
+bool WitnessHolds(int n, bool symmetric, std::span<const OutputType> set_a,
+                  const std::vector<int> &positions_a,
+                  std::span<const OutputType> set_b,
+                  const std::vector<int> &positions_b,
+                  const std::vector<uint8_t> &canonical_witness) {
+  if (canonical_witness.size() != n) {
     return false;
   }
+  std::vector<int> channel_b(n);
+  for (int c = 0; c < n; c++) {
+    channel_b[positions_b[c]] = c;
+  }
+  std::vector<int> witness(n);
+  uint64_t image = 0;
+  for (int c = 0; c < n; c++) {
+    int position = canonical_witness[positions_a[c]];
+    if (position >= n) {
+      return false;
+    }
+    witness[c] = channel_b[position];
+    image |= uint64_t(1) << witness[c];
+  }
+  if (std::popcount(image) != n) {
+    return false;
+  }
+  if (symmetric) {
+    for (int c = 0; c < n; c++) {
+      if (witness[n - 1 - c] != n - 1 - witness[c]) {
+        return false;
+      }
+    }
+  }
+  std::vector<OutputType> permuted_a;
+  permuted_a.reserve(set_a.size());
+  for (OutputType a : set_a) {
+    OutputType x = 0;
+    for (int c = 0; c < n; c++) {
+      x |= ((a >> c) & OutputType(1)) << witness[c];
+    }
+    permuted_a.push_back(x);
+  }
+  std::sort(permuted_a.begin(), permuted_a.end());
+  return SortedIsSubset(permuted_a, set_b);
+}
 
-  return IsIsomorphicToSubsetBacktracking(n, set_a, set_b, symmetric, gen);
+// The statistics of the backtracking calls of a pass.
+struct BacktrackingTotals {
+  std::atomic<int64_t> num_calls{0};
+  std::atomic<int64_t> num_nodes{0};
+  std::atomic<int64_t> max_nodes{0};
+  std::atomic<int64_t> num_parallel{0};
+  std::atomic<int64_t> num_timed_out{0};
+  std::atomic<int64_t> num_cache_hits{0};
+
+  void Add(const BacktrackingStats &stats) {
+    num_calls.fetch_add(1, std::memory_order_relaxed);
+    num_nodes.fetch_add(stats.num_nodes, std::memory_order_relaxed);
+    int64_t max = max_nodes.load(std::memory_order_relaxed);
+    while (stats.num_nodes > max &&
+           !max_nodes.compare_exchange_weak(max, stats.num_nodes,
+                                            std::memory_order_relaxed)) {
+    }
+    num_parallel.fetch_add(stats.parallel, std::memory_order_relaxed);
+    num_timed_out.fetch_add(stats.timed_out, std::memory_order_relaxed);
+  }
+};
+
+// Tests whether set_a (the set index_a of labels) is isomorphic to a subset
+// of set_b (the set index_b, or its inverse if inverse_b) with the
+// backtracking, unless the dominance cache (if not null) already knows.
+bool IsIsomorphicToSubsetCached(
+    std::span<const OutputType> set_a, std::span<const OutputType> set_b,
+    const SetProjections &projections_b, LazyCanonicalLabels *labels,
+    int index_a, int index_b, bool inverse_b, DominanceCache *cache,
+    const BacktrackingOptions &options, BacktrackingTotals *totals) {
+  int n = projections_b.n();
+  bool symmetric = projections_b.symmetric();
+  DominanceCache::Key key;
+  if (cache != nullptr) {
+    key = {labels->Hash(index_a, false), labels->Hash(index_b, inverse_b), n,
+           symmetric};
+    if (std::optional<DominanceCache::Entry> entry = cache->Lookup(key)) {
+      if (!entry->is_subset ||
+          WitnessHolds(n, symmetric, set_a, labels->Positions(index_a, false),
+                       set_b, labels->Positions(index_b, inverse_b),
+                       entry->witness)) {
+        totals->num_cache_hits.fetch_add(1, std::memory_order_relaxed);
+        return entry->is_subset;
+      }
+    }
+  }
+  BacktrackingStats stats;
+  std::vector<int> witness;
+  bool is_subset = IsIsomorphicToSubsetBacktracking(set_a, projections_b,
+                                                    options, &stats, &witness);
+  totals->Add(stats);
+  if (cache != nullptr && !stats.timed_out) {
+    DominanceCache::Entry entry;
+    entry.is_subset = is_subset;
+    if (is_subset) {
+      const std::vector<int> &positions_a = labels->Positions(index_a, false);
+      const std::vector<int> &positions_b =
+          labels->Positions(index_b, inverse_b);
+      entry.witness.resize(n);
+      for (int c = 0; c < n; c++) {
+        entry.witness[positions_a[c]] = positions_b[witness[c]];
+      }
+    }
+    cache->Insert(key, std::move(entry));
+  }
+  return is_subset;
+}
+
+// A smaller collection j that can make a collection i redundant, with the
+// directions (i itself or its inverse) that their invariants allow. The
+// directions are first those of the index keys, and then those of all the
+// invariants once checked.
+struct Candidate {
+  int j;
+  bool direct;
+  bool inverse;
+  bool checked = false;
+};
+
+// Returns the candidates of i: the collections of the index whose keys are
+// dominated by that of i or, if with_inverse, of its inverse, in increasing
+// order.
+std::vector<Candidate> FindCandidates(
+    int i, const DominanceIndex &index,
+    const std::vector<OutputsInvariants> &invariants_collection,
+    const std::vector<OutputsInvariants> &invariants_inv_collection,
+    bool with_inverse) {
+  std::vector<int> direct =
+      index.FindDominated(invariants_collection[i].key, i);
+  std::vector<int> inverse;
+  if (with_inverse) {
+    inverse = index.FindDominated(invariants_inv_collection[i].key, i);
+  }
+  std::vector<Candidate> candidates;
+  auto it = direct.begin();
+  auto it_inv = inverse.begin();
+  while (it != direct.end() || it_inv != inverse.end()) {
+    int j = std::min(it != direct.end() ? *it : i,
+                     it_inv != inverse.end() ? *it_inv : i);
+    bool is_direct = it != direct.end() && *it == j;
+    bool is_inverse = it_inv != inverse.end() && *it_inv == j;
+    candidates.push_back({j, is_direct, is_inverse});
+    it += is_direct;
+    it_inv += is_inverse;
+  }
+  return candidates;
 }
 
-// Return true if outputs_collection[i] is redundant.
+// Return true if outputs_collection[i] is redundant, i.e. one of the
+// candidates is isomorphic to a subset of it (or of its inverse, in the exact
+// pass). The directions of the candidates that it tests are checked against
+// the invariants.
 bool IsRedundant(
-    int n, int i,
-    const std::vector<std::vector<OutputType>> &outputs_collection,
-    const std::vector<std::array<std::vector<uint8_t>, 2>>
-        &count_by_row_sorted_collection,
-    const std::vector<std::array<std::vector<uint64_t>, 2>>
-        &count_by_col_sorted_collection,
-    const std::vector<std::vector<OutputType>> &outputs_collection_inv,
-    const std::vector<std::array<std::vector<uint8_t>, 2>>
-        &count_by_row_inv_sorted_collection,
-    const std::vector<std::array<std::vector<uint64_t>, 2>>
-        &count_by_col_inv_sorted_collection,
-    const std::vector<std::atomic<bool>> &is_redundant_atomic, bool fast,
-    bool is_last_pass, bool symmetric, std::mt19937 *gen) {
-  auto size_i = outputs_collection[i].size();
-  for (int j = 0; j < outputs_collection.size(); j++) {
+    int n, int i, std::vector<Candidate> &candidates,
+    const OutputsCollection &outputs_collection,
+    const std::vector<OutputsInvariants> &invariants_collection,
+    const std::vector<OutputsInvariants> &invariants_inv_collection,
+    const SubsetSignatures &signatures,
+    const std::vector<std::atomic<bool>> &is_redundant_atomic,
+    bool is_exact_pass, bool symmetric, const BacktrackingOptions &options,
+    DominanceCache *cache, LazyCanonicalLabels *labels,
+    BacktrackingTotals *totals) {
+  // The projections of i and of its inverse for the backtracking, computed on
+  // first use and shared by all the candidates.
+  std::optional<SetProjections> projections;
+  std::optional<SetProjections> projections_inv;
+  std::vector<OutputType> set_inv;
+  for (Candidate &candidate : candidates) {
+    int j = candidate.j;
     if (is_redundant_atomic[j].load()) {
       continue;
     }
-    if (j == i) {
-      continue;
-    }
-    auto size_j = outputs_collection[j].size();
-    if (size_i < size_j) {
-      break;
-    }
-    if (size_i == size_j && i < j) {
-      break;
-    }
     // (size_i, i) > (size_j, j)
-    if (fast || !is_last_pass) {
-      if (!IsIsomorphicToSubsetNegativePrecheckByCol(
-              n, count_by_col_sorted_collection[j],
-              count_by_col_sorted_collection[i])) {
-        continue;
-      }
-      if (std::includes(
-              outputs_collection[i].begin(), outputs_collection[i].end(),
-              outputs_collection[j].begin(), outputs_collection[j].end())) {
+    CHECK_LT(j, i);
+    if (!candidate.checked) {
+      candidate.direct = candidate.direct &&
+                         InvariantsAllowSubset(n, invariants_collection[j],
+                                               invariants_collection[i]);
+      candidate.inverse =
+          candidate.inverse &&
+          InvariantsAllowSubset(n, invariants_collection[j],
+                                invariants_inv_collection[i]);
+      candidate.checked = true;
+    }
+    bool check = candidate.direct;
+    bool check_inv = candidate.inverse;
+    if (!is_exact_pass) {
+      // The collections are compared as they are, so the signatures of the
+      // current channel order can rule out most pairs.
+      if (check && signatures.AllowsSubset(j, i) &&
+          SortedIsSubset(outputs_collection[j], outputs_collection[i])) {
         return true;
       }
-      if (!outputs_collection_inv.empty()) {
-        if (!IsIsomorphicToSubsetNegativePrecheckByCol(
-                n, count_by_col_sorted_collection[j],
-                count_by_col_inv_sorted_collection[i])) {
-          continue;
+    } else {
+      // exact pass. The invariants contain the sorted column counts and the
+      // counts by weight, so they imply the negative precheck.
+      if (check) {
+        if (!projections) {
+          projections.emplace(n, outputs_collection[i], symmetric);
         }
-        if (std::includes(outputs_collection_inv[i].begin(),
-                          outputs_collection_inv[i].end(),
-                          outputs_collection[j].begin(),
-                          outputs_collection[j].end())) {
+        if (IsIsomorphicToSubsetCached(
+                outputs_collection[j], outputs_collection[i], *projections,
+                labels, j, i, false, cache, options, totals)) {
           return true;
         }
       }
-    } else {
-      // last pass
-      if (IsIsomorphicToSubset(
-              n, outputs_collection[j], count_by_row_sorted_collection[j],
-              count_by_col_sorted_collection[j], outputs_collection[i],
-              count_by_row_sorted_collection[i],
-              count_by_col_sorted_collection[i], symmetric, gen)) {
-        return true;
-      }
-      CHECK(!outputs_collection_inv.empty());
-      if (IsIsomorphicToSubset(
-              n, outputs_collection[j], count_by_row_sorted_collection[j],
-              count_by_col_sorted_collection[j], outputs_collection_inv[i],
-              count_by_row_inv_sorted_collection[i],
-              count_by_col_inv_sorted_collection[i], symmetric, gen)) {
-        return true;
+      if (check_inv) {
+        if (!projections_inv) {
+          set_inv = InvertOutputs(n, outputs_collection[i]);
+          projections_inv.emplace(n, set_inv, symmetric);
+        }
+        if (IsIsomorphicToSubsetCached(outputs_collection[j], set_inv,
+                                       *projections_inv, labels, j, i, true,
+                                       cache, options, totals)) {
+          return true;
+        }
       }
     }
   }
@@ -341,8 +1253,17 @@ bool IsRedundant(
 std::pair<std::vector<OutputType>, std::vector<int>>
 SortByWeight(int n, const std::vector<OutputType> &set,
              std::mt19937 *nullable_gen, bool symmetric) {
+  std::vector<OutputType> set_perm = set;
+  std::vector<int> perm =
+      SortByWeightInPlace(n, set_perm, nullable_gen, symmetric);
+  return {std::move(set_perm), std::move(perm)};
+}
+
+std::vector<int> SortByWeightInPlace(int n, std::span<OutputType> set,
+                                     std::mt19937 *nullable_gen,
+                                     bool symmetric) {
   std::vector<uint64_t> count_one_by_col =
-      internal::AggregateColumns(n, set, false)[1];
+      internal::CountOnesByColumn(n, set);
   std::vector<int> inv_perm(n);
   std::iota(inv_perm.begin(), inv_perm.end(), 0);
   if (nullable_gen) {
@@ -360,17 +1281,35 @@ SortByWeight(int n, const std::vector<OutputType> &set,
       std::shuffle(inv_perm.begin(), inv_perm.end(), *nullable_gen);
     }
   }
-  std::vector<OutputType> set_perm =
-      SortByWeight(n, set, count_one_by_col, &inv_perm);
-  return {set_perm, InversePermutation(inv_perm)};
+  std::stable_sort(inv_perm.begin(), inv_perm.end(), [&](int i, int j) {
+    return count_one_by_col[i] < count_one_by_col[j];
+  });
+  PermuteChannelsInPlace(n, set, inv_perm);
+  return InversePermutation(inv_perm);
+}
+
+bool IsIsomorphicToSubset(int n, const std::vector<OutputType> &set_a,
+                          const std::vector<OutputType> &set_b, bool symmetric,
+                          std::vector<int> *witness) {
+  CHECK(std::is_sorted(set_b.begin(), set_b.end()));
+  if (!IsIsomorphicToSubsetNegativePrecheck(
+          n, set_a, internal::CountByWeight(n, set_a),
+          internal::AggregateColumns(n, set_a, true), set_b,
+          internal::CountByWeight(n, set_b),
+          internal::AggregateColumns(n, set_b, true))) {
+    return false;
+  }
+  return internal::IsIsomorphicToSubsetBacktracking(
+      set_a, internal::SetProjections(n, set_b, symmetric), {}, nullptr,
+      witness);
 }
 
 bool IsIsomorphicToSubsetNegativePrecheck(
     int n, const std::vector<OutputType> &set_a,
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_a_sorted,
+    const std::vector<uint32_t> &count_by_weight_a,
     const std::array<std::vector<uint64_t>, 2> &count_by_col_a_sorted,
     const std::vector<OutputType> &set_b,
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_b_sorted,
+    const std::vector<uint32_t> &count_by_weight_b,
     const std::array<std::vector<uint64_t>, 2> &count_by_col_b_sorted) {
   if (set_a.size() > set_b.size()) {
     return false;
@@ -379,20 +1318,23 @@ bool IsIsomorphicToSubsetNegativePrecheck(
                                                  count_by_col_b_sorted)) {
     return false;
   }
-  if (!IsIsomorphicToSubsetNegativePrecheckByRow(count_by_row_a_sorted,
-                                                 count_by_row_b_sorted)) {
+  if (!IsIsomorphicToSubsetNegativePrecheckByWeight(n, count_by_weight_a,
+                                                    count_by_weight_b)) {
     return false;
   }
   return true;
 }
 
 std::vector<bool>
-FindRedundantOutputs(int n,
-                     std::vector<std::vector<OutputType>> outputs_collection,
-                     bool fast, bool symmetric, std::mt19937 *gen) {
-  CHECK(std::is_sorted(
-      outputs_collection.begin(), outputs_collection.end(),
-      [](const auto &a, const auto &b) { return a.size() < b.size(); }));
+FindRedundantOutputs(int n, OutputsCollection *outputs_collection_ptr,
+                     bool fast, bool symmetric, std::mt19937 *gen,
+                     DominanceCache *cache, int64_t num_non_redundant) {
+  CHECK_NOTNULL(outputs_collection_ptr);
+  OutputsCollection &outputs_collection = *outputs_collection_ptr;
+  CHECK_LE(num_non_redundant, outputs_collection.size());
+  for (int i = 1; i < outputs_collection.size(); i++) {
+    CHECK_LE(outputs_collection[i - 1].size(), outputs_collection[i].size());
+  }
 
   if (symmetric) {
     // Symmetry check is expensive for large n, so we only verify it for n < 16.
@@ -403,145 +1345,264 @@ FindRedundantOutputs(int n,
       // the check.
       LOG(INFO)
           << "FindRedundantOutputs: Checking if all outputs are symmetric";
-      for (const auto &outputs : outputs_collection) {
-        CHECK(IsSymmetric(n, outputs));
+      for (int i = 0; i < outputs_collection.size(); i++) {
+        CHECK(IsSymmetric(n, outputs_collection[i]));
       }
     }
   }
 
-  LOG(INFO) << "Computing count by row and column";
-  std::vector<std::array<std::vector<uint8_t>, 2>>
-      count_by_row_sorted_collection;
-  std::vector<std::array<std::vector<uint8_t>, 2>>
-      count_by_row_inv_sorted_collection;
-  std::vector<std::array<std::vector<uint64_t>, 2>>
-      count_by_col_sorted_collection;
-  std::vector<std::array<std::vector<uint64_t>, 2>>
-      count_by_col_inv_sorted_collection;
+  LOG(INFO) << "Computing invariants";
+  std::vector<internal::OutputsInvariants> invariants_collection;
+  std::vector<internal::OutputsInvariants> invariants_inv_collection;
   {
-    // Compute count by row and column in parallel
-    count_by_row_sorted_collection.resize(outputs_collection.size());
-    count_by_row_inv_sorted_collection.resize(outputs_collection.size());
-    count_by_col_sorted_collection.resize(outputs_collection.size());
-    count_by_col_inv_sorted_collection.resize(outputs_collection.size());
-    std::atomic<int> next_i(0);
-    int num_threads = std::thread::hardware_concurrency();
-    CHECK_GT(num_threads, 0);
-    auto worker = [&]() {
-      while (true) {
-        int i = next_i.fetch_add(1);
-        if (i >= outputs_collection.size()) {
-          break;
-        }
-        const auto &outputs = outputs_collection[i];
-        count_by_row_sorted_collection[i] =
-            internal::AggregateRows(n, outputs, true);
-        count_by_row_inv_sorted_collection[i] = {
-            count_by_row_sorted_collection[i][1],
-            count_by_row_sorted_collection[i][0]};
-        count_by_col_sorted_collection[i] =
-            internal::AggregateColumns(n, outputs, true);
-        count_by_col_inv_sorted_collection[i] = {
-            count_by_col_sorted_collection[i][1],
-            count_by_col_sorted_collection[i][0]};
+    // Compute the invariants in parallel
+    invariants_collection.resize(outputs_collection.size());
+    invariants_inv_collection.resize(outputs_collection.size());
+    ParallelFor(0, outputs_collection.size(), [&](int i) {
+      invariants_collection[i] =
+          internal::ComputeInvariants(n, outputs_collection[i]);
+      invariants_inv_collection[i] =
+          internal::InvertInvariants(n, invariants_collection[i]);
+    });
+  }
+
+  std::vector<std::atomic<bool>> is_redundant_atomic(outputs_collection.size());
+  // The sets known not to be redundant from a snapshot of an interrupted run,
+  // which are not checked again, and the ones checked by the exact pass.
+  std::vector<bool> is_known_non_redundant(outputs_collection.size());
+  std::vector<std::atomic<bool>> is_checked(outputs_collection.size());
+  std::optional<RedundancySnapshot> snapshot;
+  if (!FLAGS_checkpoint_dir.empty()) {
+    snapshot.emplace(FLAGS_checkpoint_dir,
+                     RedundancySnapshot::Fingerprint(n, outputs_collection,
+                                                     fast, symmetric,
+                                                     num_non_redundant),
+                     outputs_collection.size(), FLAGS_checkpoint_interval);
+    if (FLAGS_resume) {
+      std::vector<RedundancySnapshot::State> states = snapshot->Load();
+      for (int i = 0; i < outputs_collection.size(); i++) {
+        is_redundant_atomic[i] = states[i] == RedundancySnapshot::kRedundant;
+        is_known_non_redundant[i] =
+            states[i] == RedundancySnapshot::kNotRedundant;
       }
-    };
-    std::vector<std::thread> threads;
-    for (int t = 0; t < num_threads; t++) {
-      threads.emplace_back(worker);
     }
-    for (auto &thread : threads) {
-      thread.join();
+  }
+  auto get_states = [&]() {
+    std::vector<RedundancySnapshot::State> states(outputs_collection.size());
+    for (int i = 0; i < outputs_collection.size(); i++) {
+      if (is_redundant_atomic[i].load()) {
+        states[i] = RedundancySnapshot::kRedundant;
+      } else if (is_known_non_redundant[i] || is_checked[i].load()) {
+        states[i] = RedundancySnapshot::kNotRedundant;
+      }
     }
+    return states;
+  };
+  // Subset signatures of the collections in their current channel order.
+  int64_t max_size = 0;
+  for (int i = 0; i < outputs_collection.size(); i++) {
+    max_size = std::max<int64_t>(max_size, outputs_collection[i].size());
   }
-
-  std::vector<std::atomic<bool>> is_redundant_atomic(outputs_collection.size());
-  int num_passes = 6;
+  internal::SubsetSignatures signatures(outputs_collection.size(), max_size);
+  // positions[i * n + c] is the current channel of the channel c of the
+  // collection i, which the passes permute in place.
+  std::vector<uint8_t> positions(outputs_collection.size() * n);
+  for (int i = 0; i < outputs_collection.size(); i++) {
+    std::iota(&positions[i * n], &positions[(i + 1) * n], 0);
+  }
+  internal::BacktrackingOptions options;
+  options.timeout_seconds = FLAGS_backtracking_timeout;
+  // The cheap passes compare the collections in random channel orders (with
+  // the channels sorted by weight), and the exact pass, unless fast, searches
+  // the permutations with the backtracking. The cheap passes stop when one of
+  // them removes too few collections.
+  int max_cheap_passes = FLAGS_redundancy_max_cheap_passes;
   if (fast) {
-    num_passes = 2;
-  }
-  int num_threads = std::thread::hardware_concurrency();
-  CHECK_GT(num_threads, 0);
-  for (int pass = 0; pass < num_passes; pass++) {
-    std::cout << "Pass " << pass << ". Count: "
-              << std::count(is_redundant_atomic.begin(),
-                            is_redundant_atomic.end(), false)
-              << std::endl;
-    std::vector<std::vector<OutputType>> outputs_collection_inv;
-    if (!fast) {
-      if (pass + 2 >= num_passes) { // last two passes
-        outputs_collection_inv = outputs_collection;
-      }
+    max_cheap_passes = std::min(max_cheap_passes, 2);
+  }
+  CHECK_GE(max_cheap_passes, 1);
+  // The candidates of each remaining collection, found in the invariant index
+  // by the first pass and reused by the next ones, unless there are too many.
+  std::vector<std::vector<internal::Candidate>> candidates_collection(
+      outputs_collection.size());
+  bool has_candidates = false;
+  bool can_keep_candidates = true;
+  // The number of remaining collections to check.
+  auto count_remaining = [&]() {
+    int64_t count = 0;
+    for (int i = num_non_redundant; i < outputs_collection.size(); i++) {
+      count += !is_redundant_atomic[i].load() && !is_known_non_redundant[i];
     }
+    return count;
+  };
+  int64_t num_remaining = count_remaining();
+  bool low_yield = false;
+  for (int pass = 0;; pass++) {
+    bool is_exact_pass =
+        !fast && (pass == max_cheap_passes || low_yield);
+    if (!is_exact_pass && (pass == max_cheap_passes || low_yield)) {
+      break;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::cout << "Pass " << pass << ". Count: " << num_remaining << std::endl;
+    // The random streams of the sorts of the pass, which only depend on gen
+    // and on the indices, so that the result does not depend on the threads.
+    uint64_t sort_seed = RandomSeed(gen);
     // SortByWeight in parallel
-    {
-      std::atomic<int> next_i(0);
-      auto worker = [&]() {
-        while (true) {
-          int i = next_i.fetch_add(1);
-          if (i >= outputs_collection.size()) {
-            break;
-          }
-          if (is_redundant_atomic[i].load()) {
-            continue;
-          }
-          outputs_collection[i] =
-              SortByWeight(n, outputs_collection[i], gen, symmetric).first;
-          if (outputs_collection_inv.empty()) {
-            continue;
-          }
-          for (OutputType &x : outputs_collection_inv[i]) {
-            x ^= (OutputType(1) << n) - 1;
-          }
-          outputs_collection_inv[i] =
-              SortByWeight(n, outputs_collection_inv[i], gen, symmetric).first;
-        }
-      };
-      std::vector<std::thread> threads;
-      for (int t = 0; t < num_threads; t++) {
-        threads.emplace_back(worker);
+    ParallelFor(0, outputs_collection.size(), [&](int i) {
+      if (is_redundant_atomic[i].load()) {
+        return;
+      }
+      std::mt19937 task_gen = TaskGenerator(sort_seed, i);
+      std::vector<int> perm = SortByWeightInPlace(
+          n, outputs_collection.Mutable(i), &task_gen, symmetric);
+      for (int c = 0; c < n; c++) {
+        positions[i * n + c] = perm[positions[i * n + c]];
       }
-      for (auto &thread : threads) {
-        thread.join();
+      signatures.Compute(i, outputs_collection[i]);
+    });
+    // Index the invariants of the remaining collections. Only the ones whose
+    // invariants are dominated by those of i (or of its inverse) can make i
+    // redundant.
+    DominanceIndex index(3 * n + 1);
+    // num_remaining_before[i] is the number of remaining collections before i,
+    // which a linear scan would check for i.
+    std::vector<int64_t> num_remaining_before(outputs_collection.size());
+    int64_t num_remaining_in_scan = 0;
+    for (int i = 0; i < outputs_collection.size(); i++) {
+      num_remaining_before[i] = num_remaining_in_scan;
+      if (!is_redundant_atomic[i].load()) {
+        if (!has_candidates) {
+          index.Add(i, invariants_collection[i].key);
+        }
+        num_remaining_in_scan++;
       }
     }
+    if (!has_candidates) {
+      index.Build();
+    }
+    bool keep_candidates =
+        !has_candidates && can_keep_candidates && !is_exact_pass;
+    std::atomic<int64_t> num_kept_candidates(0);
+    std::atomic<bool> too_many_candidates(false);
+    std::atomic<int64_t> num_linear_pairs(0);
+    std::atomic<int64_t> num_candidate_pairs(0);
+    internal::BacktrackingTotals totals;
+    // The canonical labels of the sets of the exact pass for the cache.
+    std::optional<internal::LazyCanonicalLabels> labels;
+    if (cache != nullptr && is_exact_pass) {
+      labels.emplace(n, outputs_collection, symmetric);
+    }
     // Check redundancy in parallel
-    {
-      std::atomic<int> next_i(0);
-      auto worker = [&]() {
-        while (true) {
-          int i = next_i.fetch_add(1);
-          if (i >= outputs_collection.size()) {
-            break;
-          }
-          if (i % 64 == 0 || i + 1 == outputs_collection.size() ||
-              (!fast && pass + 1 == num_passes)) {
-            std::cout << std::format("Progress: {}/{} \r", i,
-                                     outputs_collection.size())
-                      << std::flush;
-          }
-          if (is_redundant_atomic[i].load()) {
-            continue;
-          }
-          is_redundant_atomic[i].store(internal::IsRedundant(
-              n, i, outputs_collection, count_by_row_sorted_collection,
-              count_by_col_sorted_collection, outputs_collection_inv,
-              count_by_row_inv_sorted_collection,
-              count_by_col_inv_sorted_collection, is_redundant_atomic, fast,
-              pass + 1 == num_passes, symmetric, gen));
+    ParallelFor(0, outputs_collection.size(), [&](int i) {
+      if (i % 64 == 0 || i + 1 == outputs_collection.size() ||
+          is_exact_pass) {
+        std::cout << std::format("Progress: {}/{} \r", i,
+                                 outputs_collection.size())
+                  << std::flush;
+      }
+      if (is_redundant_atomic[i].load() || i < num_non_redundant ||
+          is_known_non_redundant[i]) {
+        return;
+      }
+      MemoryBudget::Reservation reservation;
+      if (is_exact_pass) {
+        reservation = MemoryBudget::Default().Reserve(
+            ExactCheckBytes(n, outputs_collection[i].size()));
+      }
+      std::vector<internal::Candidate> &candidates = candidates_collection[i];
+      if (!has_candidates) {
+        candidates = internal::FindCandidates(
+            i, index, invariants_collection, invariants_inv_collection,
+            /*with_inverse=*/!fast);
+      }
+      num_linear_pairs.fetch_add(num_remaining_before[i]);
+      num_candidate_pairs.fetch_add(candidates.size());
+      bool is_redundant = internal::IsRedundant(
+          n, i, candidates, outputs_collection, invariants_collection,
+          invariants_inv_collection, signatures, is_redundant_atomic,
+          is_exact_pass, symmetric, options, labels ? cache : nullptr,
+          labels ? &*labels : nullptr, &totals);
+      if (is_redundant || is_exact_pass ||
+          (!has_candidates && !keep_candidates)) {
+        std::vector<internal::Candidate>().swap(candidates);
+      } else {
+        // IsRedundant checked the invariants of all the remaining candidates.
+        std::erase_if(candidates, [&](const internal::Candidate &candidate) {
+          return is_redundant_atomic[candidate.j].load() ||
+                 (!candidate.direct && !candidate.inverse);
+        });
+        if (keep_candidates &&
+            num_kept_candidates.fetch_add(candidates.size()) +
+                    candidates.size() >
+                FLAGS_redundancy_max_kept_candidates) {
+          too_many_candidates.store(true);
         }
-      };
-
-      std::vector<std::thread> threads;
-      for (int t = 0; t < num_threads; t++) {
-        threads.emplace_back(worker);
       }
-      for (auto &thread : threads) {
-        thread.join();
+      is_redundant_atomic[i].store(is_redundant);
+      if (is_exact_pass && !is_redundant) {
+        is_checked[i].store(true);
       }
-    }
+      if (snapshot && (is_exact_pass || i % 1024 == 0)) {
+        snapshot->MaybeSave(get_states);
+      }
+    });
     std::cout << '\n';
+    if (is_exact_pass) {
+      MemoryBudget::Default().LogAdmissionDelay(
+          std::format("Pass {} of FindRedundantOutputs", pass));
+    }
+    int64_t num_remaining_after = count_remaining();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cout << std::format("Pass {}: removed {} of {} in {:.3f} s", pass,
+                             num_remaining - num_remaining_after,
+                             num_remaining, seconds)
+              << std::endl;
+    std::cout << std::format("Pass {}: {} candidate pairs from the invariant "
+                             "index, {} pairs in a linear scan",
+                             pass, num_candidate_pairs.load(),
+                             num_linear_pairs.load())
+              << std::endl;
+    if (totals.num_calls.load() > 0) {
+      std::cout << std::format("Pass {}: {} backtracking calls, {} nodes (max "
+                               "{}), {} split into tasks, {} timed out",
+                               pass, totals.num_calls.load(),
+                               totals.num_nodes.load(), totals.max_nodes.load(),
+                               totals.num_parallel.load(),
+                               totals.num_timed_out.load())
+                << std::endl;
+    }
+    if (labels) {
+      std::cout << std::format("Pass {}: {} dominance cache hits, {} entries",
+                               pass, totals.num_cache_hits.load(),
+                               cache->size())
+                << std::endl;
+    }
+    if (is_exact_pass) {
+      break;
+    }
+    low_yield = num_remaining - num_remaining_after <
+                FLAGS_redundancy_min_pass_yield * num_remaining;
+    num_remaining = num_remaining_after;
+    if (keep_candidates) {
+      if (too_many_candidates.load()) {
+        // The next passes look them up in the index again.
+        for (auto &candidates : candidates_collection) {
+          std::vector<internal::Candidate>().swap(candidates);
+        }
+        can_keep_candidates = false;
+      } else {
+        has_candidates = true;
+      }
+    }
   }
+  // Move the channels back.
+  ParallelFor(0, outputs_collection.size(), [&](int i) {
+    std::vector<int> inv_perm(&positions[i * n], &positions[(i + 1) * n]);
+    PermuteChannelsInPlace(n, outputs_collection.Mutable(i), inv_perm);
+  });
   std::vector<bool> is_redundant(outputs_collection.size());
   for (int i = 0; i < outputs_collection.size(); i++) {
     is_redundant[i] = is_redundant_atomic[i].load();
@@ -1,47 +1,222 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <random>
+#include <span>
 #include <utility>
 #include <vector>
 
+#include "gflags/gflags.h"
+
+#include "dominance_cache.h"
 #include "output_type.h"
+#include "outputs_collection.h"
+#include "thread_pool.h"
+
+// The time limit of a subset-isomorphism search in FindRedundantOutputs.
+DECLARE_double(backtracking_timeout);
+// The schedule of the passes of FindRedundantOutputs.
+DECLARE_int32(redundancy_max_cheap_passes);
+DECLARE_double(redundancy_min_pass_yield);
+DECLARE_int64(redundancy_max_kept_candidates);
 
 // set_a[i] and set_b[i] are n-bit integers.
 // It returns true if set_a is isomorphic to a subset of set_b,
 // i.e. there exists a permutation perm in S_n such that set(perm(set_a))
 // \subseteq set(set_b), where perm(set_a) is [perm(a) for a in set_a], where
 // perm(a) permutes the n bits of a.
+// If it returns true and witness is not null, (*witness)[c] is set to
+// perm(c), the channel of set_b that the channel c of set_a is mapped to.
 bool IsIsomorphicToSubset(int n, const std::vector<OutputType> &set_a,
                           const std::vector<OutputType> &set_b, bool symmetric,
-                          std::mt19937 *gen);
+                          std::vector<int> *witness = nullptr);
 
 // It returns false if set_a is not isomorphic to a subset of set_b.
 // It returns true if unknown.
+// count_by_weight_* are from internal::CountByWeight and count_by_col_*_sorted
+// from internal::AggregateColumns(..., true).
 bool IsIsomorphicToSubsetNegativePrecheck(
     int n, const std::vector<OutputType> &set_a,
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_a_sorted,
+    const std::vector<uint32_t> &count_by_weight_a,
     const std::array<std::vector<uint64_t>, 2> &count_by_col_a_sorted,
     const std::vector<OutputType> &set_b,
-    const std::array<std::vector<uint8_t>, 2> &count_by_row_b_sorted,
+    const std::vector<uint32_t> &count_by_weight_b,
     const std::array<std::vector<uint64_t>, 2> &count_by_col_b_sorted);
 
 // Returns the sorted set and the permutation that achieves the sort.
 std::pair<std::vector<OutputType>, std::vector<int>>
 SortByWeight(int n, const std::vector<OutputType> &set,
              std::mt19937 *gen = nullptr, bool symmetric = false);
+// The same in place. It returns the permutation.
+std::vector<int> SortByWeightInPlace(int n, std::span<OutputType> set,
+                                     std::mt19937 *gen = nullptr,
+                                     bool symmetric = false);
 
 // It returns a vector of bools, where the i-th element is true if the i-th
 // output is redundant.
-std::vector<bool>
-FindRedundantOutputs(int n,
-                     std::vector<std::vector<OutputType>> outputs_collection,
-                     bool fast, bool symmetric, std::mt19937 *gen);
+// The cheap passes compare the sets in random channel orders, until one of them
+// removes less than --redundancy_min_pass_yield of the remaining sets (or after
+// --redundancy_max_cheap_passes), and then, unless fast, the exact pass tests
+// the remaining candidate pairs with the backtracking.
+// If cache is not null, the results of the subset-isomorphism searches of the
+// exact pass are looked up in and added to it.
+// gen is only used on the calling thread, to seed the streams of the parallel
+// tasks, so the result only depends on gen and not on the number of threads
+// (unless --backtracking_timeout stops some searches).
+// The passes permute the channels of the sets in place, without copying them,
+// and the sets are restored before it returns.
+// The first num_non_redundant sets are known not to be redundant, e.g. the ones
+// kept by a previous call: they are only compared with the next ones.
+std::vector<bool> FindRedundantOutputs(int n,
+                                       OutputsCollection *outputs_collection,
+                                       bool fast, bool symmetric,
+                                       std::mt19937 *gen,
+                                       DominanceCache *cache = nullptr,
+                                       int64_t num_non_redundant = 0);
 
 namespace internal {
-std::array<std::vector<uint8_t>, 2>
-AggregateRows(int n, const std::vector<OutputType> &set, bool sort);
+// Invariants of a set of outputs under permutations of the channels. If set_a
+// is isomorphic to a subset of set_b, every invariant of set_a is dominated by
+// (<=) the invariant of set_b.
+struct OutputsInvariants {
+  // The key of the dominance index: the sorted column counts of zeros and of
+  // ones, followed by the number of outputs of each weight 0..n.
+  std::vector<uint32_t> key;
+  // The sorted column counts of ones among the outputs of weight w are at
+  // [w * n, (w + 1) * n).
+  std::vector<uint32_t> one_count_by_weight_col;
+};
+OutputsInvariants ComputeInvariants(int n, std::span<const OutputType> set);
+// Returns the invariants of the set with all n bits flipped.
+OutputsInvariants InvertInvariants(int n,
+                                   const OutputsInvariants &invariants);
+// Returns false if a set with invariants a is not isomorphic to a subset of a
+// set with invariants b.
+bool InvariantsAllowSubset(int n, const OutputsInvariants &a,
+                           const OutputsInvariants &b);
+
+// Bloom filters of sets of outputs, with two hash functions. If set_a is a
+// subset of set_b, the signature of set_a is contained in that of set_b.
+// Unlike the invariants, they depend on the order of the channels. The
+// signatures have the same width, a power of two of at least
+// kBitsPerOutput bits per output of the largest set (and at least 512 bits),
+// so that the signatures of the large sets are not saturated.
+class SubsetSignatures {
+public:
+  static constexpr int kBitsPerOutput = 4;
+
+  // The empty signatures of num_sets sets of up to max_size outputs.
+  SubsetSignatures(int64_t num_sets, int64_t max_size);
+
+  int num_bits() const { return 64 * num_words_; }
+  // Sets the signature of the set i. The signatures of different sets can be
+  // set in parallel.
+  void Compute(int64_t i, std::span<const OutputType> set);
+  // Returns false if the set j is not a subset of the set i.
+  bool AllowsSubset(int64_t j, int64_t i) const;
+
+private:
+  int log_num_bits_ = 0;
+  int64_t num_words_ = 0;
+  std::vector<uint64_t> words_;
+};
+
+// Returns the number of outputs of each weight 0..n.
+std::vector<uint32_t> CountByWeight(int n, std::span<const OutputType> set);
+// Returns the number of outputs with each channel set, computed in one pass
+// over the set with bit-sliced counters.
+std::vector<uint64_t> CountOnesByColumn(int n, std::span<const OutputType> set);
+// Returns the counts of zeros and of ones of each channel, sorted if sort.
 std::array<std::vector<uint64_t>, 2>
-AggregateColumns(int n, const std::vector<OutputType> &set, bool sort);
+AggregateColumns(int n, std::span<const OutputType> set, bool sort);
+
+// Counts of the outputs of a set by channel, which bound the channels of
+// set_b that a channel of set_a can be mapped to.
+struct ChannelCounts {
+  int size = 0;
+  // The number of outputs of each weight 0..n.
+  std::vector<uint32_t> count_by_weight;
+  // The number of outputs of weight w with channel c set is at [w * n + c].
+  std::vector<uint32_t> one_count_by_weight_col;
+  std::vector<uint32_t> one_count_by_col;
+  // The number of outputs with channels c and d set is at [c * n + d].
+  std::vector<uint32_t> pair_count;
+};
+ChannelCounts ComputeChannelCounts(int n, std::span<const OutputType> set);
+
+// The projections of a set of outputs to the channels 0..pos-1 (and
+// n-pos..n-1 if symmetric) for each pos, as the backtracking compares them.
+// They are computed once per set (with its channel counts) and reused for every
+// set_a tested against it. Each projection is a table of counts, indexed by the
+// projected value if it has few bits and by an open-addressing hash of it
+// otherwise.
+class SetProjections {
+public:
+  SetProjections(int n, std::span<const OutputType> set, bool symmetric);
+
+  int n() const { return n_; }
+  bool symmetric() const { return symmetric_; }
+  const ChannelCounts &channel_counts() const { return channel_counts_; }
+  // Returns true if the multiset projected_a (values with the bits of the
+  // projection to pos only) is included in the projection of the set to pos.
+  // scratch is a table of zeros that is returned as such.
+  bool Includes(int pos, const std::vector<OutputType> &projected_a,
+                std::vector<uint32_t> &scratch) const;
+
+private:
+  struct Projection {
+    // The slots are [offset, offset + capacity) in counts_, and the values of
+    // a hashed table are at [key_offset, key_offset + capacity) in keys_.
+    int64_t offset = 0;
+    int64_t key_offset = 0;
+    size_t capacity = 0;
+    bool hashed = false;
+    int log_capacity = 0;
+  };
+
+  // Returns the index of a projected value in the table of pos.
+  uint32_t TableIndex(int pos, OutputType x) const {
+    if (!symmetric_) {
+      return x;
+    }
+    OutputType low_mask = (OutputType(1) << pos) - 1;
+    return (x & low_mask) | (x >> (n_ - pos) << pos);
+  }
+  static size_t Hash(const Projection &projection, OutputType x) {
+    return (uint64_t(x) * 0x9e3779b97f4a7c15ULL) >>
+           (64 - projection.log_capacity);
+  }
+  // Returns the slot of a projected value, or -1 if it is not in the set.
+  int64_t Slot(int pos, OutputType x) const;
+
+  int n_ = 0;
+  bool symmetric_ = false;
+  std::vector<Projection> projections_;
+  std::vector<uint32_t> counts_;
+  std::vector<OutputType> keys_;
+  size_t max_capacity_ = 0;
+  ChannelCounts channel_counts_;
+};
+
+struct BacktrackingOptions {
+  // If the search has not finished after this many nodes on the calling
+  // thread, it is restarted with its first levels split into tasks of the
+  // thread pool. 0 means never.
+  int64_t sequential_node_limit = 1 << 14;
+  // If positive, the search gives up after this many seconds and returns
+  // false, i.e. set_a is conservatively not considered a subset.
+  double timeout_seconds = 0;
+  // The pool of the tasks, or null for ThreadPool::Default().
+  ThreadPool *pool = nullptr;
+};
+struct BacktrackingStats {
+  // The number of nodes visited, over all threads and both runs.
+  int64_t num_nodes = 0;
+  // Whether the search was split into tasks.
+  bool parallel = false;
+  bool timed_out = false;
+};
 
 // Slow and simple algorithm that checks all permutations of set_a.
 bool IsIsomorphicToSubsetSlow(int n, const std::vector<OutputType> &set_a,
@@ -50,5 +225,17 @@ bool IsIsomorphicToSubsetSlow(int n, const std::vector<OutputType> &set_a,
 bool IsIsomorphicToSubsetBacktracking(int n,
                                       const std::vector<OutputType> &set_a,
                                       const std::vector<OutputType> &set_b,
-                                      bool symmetric, std::mt19937 *gen);
+                                      bool symmetric);
+// The same with the projections of set_b computed in advance. The witness is
+// set as in IsIsomorphicToSubset.
+bool IsIsomorphicToSubsetBacktracking(std::span<const OutputType> set_a,
+                                      const SetProjections &projections_b,
+                                      const BacktrackingOptions &options = {},
+                                      BacktrackingStats *stats = nullptr,
+                                      std::vector<int> *witness = nullptr);
+// The backtracking that projects and sorts set_a from scratch at every node.
+// It is slower and only kept as a reference.
+bool IsIsomorphicToSubsetBacktrackingReference(
+    int n, const std::vector<OutputType> &set_a,
+    const std::vector<OutputType> &set_b, bool symmetric);
 } // namespace internal
@@ -0,0 +1,118 @@
+/*
+Measure the backtracking of the last pass of FindRedundantOutputs on the output
+sets of real prefixes.
+
+The pairs (j, i) with |set j| <= |set i| that pass the invariants and the
+negative precheck are tested with the incremental backtracking (with the
+projections of set i computed once) and with the reference backtracking, which
+projects and sorts set j from scratch at every node.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "isomorphism.h"
+#include "network.h"
+#include "network_utils.h"
+#include "output_type.h"
+
+DEFINE_string(input_path, "", "The prefixes file, e.g. generated/n12d5.pb.");
+DEFINE_int32(n, 0, "The number of channels.");
+DEFINE_bool(symmetric, false, "Whether the prefixes are symmetric.");
+DEFINE_int32(max_pairs, 100000, "The maximum number of pairs to test.");
+DEFINE_int32(seed, 0, "The random seed.");
+
+namespace {
+
+double Seconds(const std::function<void()> &f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  FLAGS_alsologtostderr = true;
+  FLAGS_log_dir = "/tmp";
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_EQ(argc, 1);
+  CHECK(!FLAGS_input_path.empty());
+  CHECK_GT(FLAGS_n, 0);
+  int n = FLAGS_n;
+
+  std::vector<Network> networks = LoadFromProtoFile(FLAGS_input_path, n);
+  std::mt19937 gen(FLAGS_seed);
+  std::vector<std::vector<OutputType>> sets;
+  for (const Network &network : networks) {
+    sets.push_back(
+        SortByWeight(n, network.outputs, &gen, FLAGS_symmetric).first);
+  }
+  std::stable_sort(sets.begin(), sets.end(), [](const auto &a, const auto &b) {
+    return a.size() < b.size();
+  });
+
+  std::vector<internal::OutputsInvariants> invariants;
+  std::vector<std::vector<uint32_t>> count_by_weight;
+  std::vector<std::array<std::vector<uint64_t>, 2>> count_by_col;
+  for (const auto &set : sets) {
+    invariants.push_back(internal::ComputeInvariants(n, set));
+    count_by_weight.push_back(internal::CountByWeight(n, set));
+    count_by_col.push_back(internal::AggregateColumns(n, set, true));
+  }
+  // The pairs grouped by i, as IsRedundant tests them.
+  std::vector<std::pair<int, int>> pairs;
+  for (int i = 0; i < sets.size() && pairs.size() < FLAGS_max_pairs; i++) {
+    for (int j = 0; j < i && pairs.size() < FLAGS_max_pairs; j++) {
+      if (internal::InvariantsAllowSubset(n, invariants[j], invariants[i]) &&
+          IsIsomorphicToSubsetNegativePrecheck(
+              n, sets[j], count_by_weight[j], count_by_col[j], sets[i],
+              count_by_weight[i], count_by_col[i])) {
+        pairs.emplace_back(j, i);
+      }
+    }
+  }
+  LOG(INFO) << std::format("{} sets, {} pairs to test", sets.size(),
+                           pairs.size());
+  CHECK(!pairs.empty());
+
+  int64_t reference_count = 0;
+  double reference_seconds = Seconds([&]() {
+    for (auto [j, i] : pairs) {
+      reference_count += internal::IsIsomorphicToSubsetBacktrackingReference(
+          n, sets[j], sets[i], FLAGS_symmetric);
+    }
+  });
+  int64_t count = 0;
+  double seconds = Seconds([&]() {
+    for (int k = 0; k < pairs.size();) {
+      int i = pairs[k].second;
+      internal::SetProjections projections(n, sets[i], FLAGS_symmetric);
+      for (; k < pairs.size() && pairs[k].second == i; k++) {
+        count += internal::IsIsomorphicToSubsetBacktracking(
+            sets[pairs[k].first], projections);
+      }
+    }
+  });
+  CHECK_EQ(count, reference_count);
+  LOG(INFO) << std::format("{} isomorphic to a subset", count);
+  LOG(INFO) << std::format("reference   {:8.3f} s {:10.1f} us/pair",
+                           reference_seconds,
+                           reference_seconds / pairs.size() * 1e6);
+  LOG(INFO) << std::format("incremental {:8.3f} s {:10.1f} us/pair ({:.2f}x)",
+                           seconds, seconds / pairs.size() * 1e6,
+                           reference_seconds / seconds);
+  return 0;
+}
@@ -1,17 +1,25 @@
 #include "isomorphism.h"
 
 #include <algorithm>
+#include <bit>
 #include <chrono>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
 #include <numeric>
 #include <random>
 #include <string>
 #include <vector>
 
+#include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
+#include "dominance_cache.h"
 #include "output_type.h"
+#include "outputs_collection.h"
+#include "redundancy_snapshot.h"
+#include "thread_pool.h"
 
 namespace {
 
@@ -77,36 +85,37 @@ GenerateIsomorphicSubset(int n, const std::vector<OutputType> &set_b,
 bool IsIsomorphicToSubsetNegativePrecheck(
     int n, const std::vector<OutputType> &set_a,
     const std::vector<OutputType> &set_b) {
-  std::array<std::vector<uint8_t>, 2> count_by_row_a_sorted =
-      internal::AggregateRows(n, set_a, true);
   std::array<std::vector<uint64_t>, 2> count_by_col_a_sorted =
       internal::AggregateColumns(n, set_a, true);
-  std::array<std::vector<uint8_t>, 2> count_by_row_b_sorted =
-      internal::AggregateRows(n, set_b, true);
   std::array<std::vector<uint64_t>, 2> count_by_col_b_sorted =
       internal::AggregateColumns(n, set_b, true);
   return ::IsIsomorphicToSubsetNegativePrecheck(
-      n, set_a, count_by_row_a_sorted, count_by_col_a_sorted, set_b,
-      count_by_row_b_sorted, count_by_col_b_sorted);
+      n, set_a, internal::CountByWeight(n, set_a), count_by_col_a_sorted,
+      set_b, internal::CountByWeight(n, set_b), count_by_col_b_sorted);
 }
 
 // Test that core implementations agree on the result
 void TestCoreImplementationAgreement(int n,
                                      const std::vector<OutputType> &set_a,
-                                     const std::vector<OutputType> &set_b,
-                                     std::mt19937 *gen) {
+                                     const std::vector<OutputType> &set_b) {
   // Run core implementations
   bool neg_precheck_result =
       IsIsomorphicToSubsetNegativePrecheck(n, set_a, set_b);
   bool slow_result = internal::IsIsomorphicToSubsetSlow(n, set_a, set_b);
   bool backtracking_result =
-      internal::IsIsomorphicToSubsetBacktracking(n, set_a, set_b, false, gen);
+      internal::IsIsomorphicToSubsetBacktracking(n, set_a, set_b, false);
+  bool reference_result =
+      internal::IsIsomorphicToSubsetBacktrackingReference(n, set_a, set_b,
+                                                          false);
   // TODO: add symmetric case
 
   // Check that slow and backtracking results agree
   EXPECT_EQ(slow_result, backtracking_result)
       << "Slow and backtracking results disagree for n=" << n
       << ", set_a size=" << set_a.size() << ", set_b size=" << set_b.size();
+  EXPECT_EQ(reference_result, backtracking_result)
+      << "Reference and backtracking results disagree for n=" << n
+      << ", set_a size=" << set_a.size() << ", set_b size=" << set_b.size();
 
   // Check that precheck returns true when slow function returns true
   if (slow_result) {
@@ -190,7 +199,7 @@ TEST(IsomorphismTest, RandomSmallCases) {
       int set_a_size = std::uniform_int_distribution<int>(0, set_b_size)(gen);
       std::vector<OutputType> set_a = GenerateRandomSet(n, set_a_size, &gen);
 
-      TestCoreImplementationAgreement(n, set_a, set_b, &gen);
+      TestCoreImplementationAgreement(n, set_a, set_b);
     }
   }
 }
@@ -209,7 +218,7 @@ TEST(IsomorphismTest, RandomMediumCases) {
       int set_a_size = std::uniform_int_distribution<int>(0, set_b_size)(gen);
       std::vector<OutputType> set_a = GenerateRandomSet(n, set_a_size, &gen);
 
-      TestCoreImplementationAgreement(n, set_a, set_b, &gen);
+      TestCoreImplementationAgreement(n, set_a, set_b);
     }
   }
 }
@@ -228,7 +237,7 @@ TEST(IsomorphismTest, GuaranteedIsomorphicCases) {
       int set_a_size = std::uniform_int_distribution<int>(1, set_b.size())(gen);
       std::vector<OutputType> set_a =
           GenerateIsomorphicSubset(n, set_b, set_a_size, &gen);
-      TestCoreImplementationAgreement(n, set_a, set_b, &gen);
+      TestCoreImplementationAgreement(n, set_a, set_b);
 
       // These should all return true
       EXPECT_TRUE(internal::IsIsomorphicToSubsetSlow(n, set_a, set_b))
@@ -257,7 +266,7 @@ TEST(IsomorphismTest, PerformanceComparison) {
   // Time the backtracking function
   start = std::chrono::high_resolution_clock::now();
   bool backtracking_result =
-      internal::IsIsomorphicToSubsetBacktracking(n, set_a, set_b, false, &gen);
+      internal::IsIsomorphicToSubsetBacktracking(n, set_a, set_b, false);
   end = std::chrono::high_resolution_clock::now();
   auto backtracking_duration =
       std::chrono::duration_cast<std::chrono::microseconds>(end - start);
@@ -331,4 +340,424 @@ TEST(IsomorphismTest, SortByWeight) {
   }
 }
 
+TEST(IsomorphismTest, ColumnCounts) {
+  std::mt19937 gen(0);
+  for (int n : {1, 5, 12, 20, 31}) {
+    // Sizes around the flushes of the bit-sliced counters.
+    for (int size : {0, 1, 254, 255, 256, 1000}) {
+      std::vector<OutputType> set = GenerateRandomSet(n, size, &gen);
+      std::vector<uint64_t> one_count_by_col(n, 0);
+      std::vector<uint32_t> count_by_weight(n + 1, 0);
+      std::vector<uint32_t> one_count_by_weight_col((n + 1) * n, 0);
+      for (OutputType x : set) {
+        int weight = std::popcount(x);
+        count_by_weight[weight]++;
+        for (int c = 0; c < n; c++) {
+          one_count_by_col[c] += (x >> c) & 1;
+          one_count_by_weight_col[weight * n + c] += (x >> c) & 1;
+        }
+      }
+      EXPECT_EQ(internal::CountOnesByColumn(n, set), one_count_by_col)
+          << "n=" << n << " size=" << size;
+      EXPECT_EQ(internal::CountByWeight(n, set), count_by_weight)
+          << "n=" << n << " size=" << size;
+      for (int weight = 0; weight <= n; weight++) {
+        std::sort(one_count_by_weight_col.begin() + weight * n,
+                  one_count_by_weight_col.begin() + (weight + 1) * n);
+      }
+      EXPECT_EQ(internal::ComputeInvariants(n, set).one_count_by_weight_col,
+                one_count_by_weight_col)
+          << "n=" << n << " size=" << size;
+    }
+  }
+}
+
+TEST(IsomorphismTest, InvertInvariants) {
+  std::mt19937 gen(0);
+  for (int n = 1; n <= 8; n++) {
+    for (int trial = 0; trial < 100; trial++) {
+      std::vector<OutputType> set =
+          GenerateRandomSet(n, OutputType(1) << (n - 1), &gen);
+      std::vector<OutputType> set_inv;
+      for (OutputType x : set) {
+        set_inv.push_back(x ^ ((OutputType(1) << n) - 1));
+      }
+      internal::OutputsInvariants expected =
+          internal::ComputeInvariants(n, set_inv);
+      internal::OutputsInvariants actual =
+          internal::InvertInvariants(n, internal::ComputeInvariants(n, set));
+      ASSERT_EQ(actual.key, expected.key) << "n=" << n;
+      ASSERT_EQ(actual.one_count_by_weight_col,
+                expected.one_count_by_weight_col)
+          << "n=" << n;
+    }
+  }
+}
+
+TEST(IsomorphismTest, InvariantsAllowSubset) {
+  std::mt19937 gen(0);
+  for (int n = 3; n <= 8; n++) {
+    for (int trial = 0; trial < 100; trial++) {
+      std::vector<OutputType> set_b =
+          GenerateRandomSet(n, OutputType(1) << (n - 1), &gen);
+      std::uniform_int_distribution<int> size_dist(0, set_b.size());
+      std::vector<OutputType> set_a =
+          GenerateIsomorphicSubset(n, set_b, size_dist(gen), &gen);
+      EXPECT_TRUE(internal::InvariantsAllowSubset(
+          n, internal::ComputeInvariants(n, set_a),
+          internal::ComputeInvariants(n, set_b)));
+    }
+  }
+}
+
+// The signatures are sized to the largest set, so that they reject the
+// non-subsets of large sets as well as of small ones.
+TEST(IsomorphismTest, SubsetSignatures) {
+  std::mt19937 gen(0);
+  int n = 14;
+  for (int size_b : {300, 3000}) {
+    int num_rejected = 0;
+    for (int trial = 0; trial < 200; trial++) {
+      std::vector<OutputType> set_b = GenerateRandomSet(n, size_b, &gen);
+      std::vector<OutputType> set_a;
+      std::sample(set_b.begin(), set_b.end(), std::back_inserter(set_a),
+                  set_b.size() / 3, gen);
+      // Replace a few outputs by outputs that are not in set_b.
+      std::vector<OutputType> set_c = set_a;
+      std::uniform_int_distribution<OutputType> dist(0, (1 << n) - 1);
+      for (int k = 0; k < 5; k++) {
+        OutputType x = dist(gen);
+        while (std::binary_search(set_b.begin(), set_b.end(), x)) {
+          x = dist(gen);
+        }
+        set_c[k] = x;
+      }
+      internal::SubsetSignatures signatures(3, set_b.size());
+      signatures.Compute(0, set_b);
+      signatures.Compute(1, set_a);
+      signatures.Compute(2, set_c);
+      ASSERT_TRUE(signatures.AllowsSubset(1, 0));
+      num_rejected += !signatures.AllowsSubset(2, 0);
+    }
+    EXPECT_GT(num_rejected, 190) << "size_b=" << size_b;
+  }
+}
+
+TEST(IsomorphismTest, ChannelCounts) {
+  std::mt19937 gen(0);
+  int n = 10;
+  std::vector<OutputType> set = GenerateRandomSet(n, 200, &gen);
+  internal::ChannelCounts counts = internal::ComputeChannelCounts(n, set);
+  EXPECT_EQ(counts.size, set.size());
+  for (int c = 0; c < n; c++) {
+    for (int d = 0; d < n; d++) {
+      int expected = std::count_if(set.begin(), set.end(), [&](OutputType x) {
+        return (x >> c & 1) && (x >> d & 1);
+      });
+      EXPECT_EQ(counts.pair_count[c * n + d], expected);
+    }
+    for (int w = 0; w <= n; w++) {
+      int expected = std::count_if(set.begin(), set.end(), [&](OutputType x) {
+        return std::popcount(x) == w && (x >> c & 1);
+      });
+      EXPECT_EQ(counts.one_count_by_weight_col[w * n + c], expected);
+    }
+  }
+}
+
+TEST(IsomorphismTest, SetProjections) {
+  std::mt19937 gen(0);
+  for (int n : {4, 8, 14}) {
+    for (bool symmetric : {false, true}) {
+      for (int trial = 0; trial < 20; trial++) {
+        std::vector<OutputType> set =
+            GenerateRandomSet(n, OutputType(1) << (n - 1), &gen);
+        internal::SetProjections projections(n, set, symmetric);
+        std::vector<uint32_t> scratch;
+        for (int pos = 0; pos <= (symmetric ? n / 2 : n); pos++) {
+          OutputType past_mask = (OutputType(1) << pos) - 1;
+          if (symmetric) {
+            past_mask |= past_mask << (n - pos);
+          }
+          std::vector<OutputType> projected_set;
+          for (OutputType x : set) {
+            projected_set.push_back(x & past_mask);
+          }
+          std::sort(projected_set.begin(), projected_set.end());
+          // Projections of subsets and of random sets, with duplicates.
+          std::vector<OutputType> subset;
+          std::sample(set.begin(), set.end(), std::back_inserter(subset),
+                      set.size() / 2, gen);
+          for (const auto &a :
+               {subset, GenerateRandomSet(n, set.size() / 4, &gen),
+                GenerateRandomSet(n, set.size(), &gen)}) {
+            std::vector<OutputType> projected_a;
+            for (OutputType x : a) {
+              projected_a.push_back(x & past_mask);
+            }
+            std::vector<OutputType> sorted_a = projected_a;
+            std::sort(sorted_a.begin(), sorted_a.end());
+            bool expected =
+                std::includes(projected_set.begin(), projected_set.end(),
+                              sorted_a.begin(), sorted_a.end());
+            ASSERT_EQ(projections.Includes(pos, projected_a, scratch),
+                      expected)
+                << "n=" << n << " symmetric=" << symmetric << " pos=" << pos;
+            ASSERT_TRUE(std::all_of(scratch.begin(), scratch.end(),
+                                    [](uint32_t count) { return count == 0; }));
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(IsomorphismTest, BacktrackingMatchesReference) {
+  std::mt19937 gen(0);
+  // n >= 13 (or 14 if symmetric) uses hashed projections.
+  for (int n : {6, 10, 14, 16}) {
+    for (bool symmetric : {false, true}) {
+      for (int trial = 0; trial < 10; trial++) {
+        // Small sets, so that the search for a random set_a fails early.
+        std::vector<OutputType> set_b = GenerateRandomSet(n, 64, &gen);
+        if (symmetric) {
+          // Close the set under ReflectAndInvert.
+          std::vector<OutputType> closed = set_b;
+          for (OutputType x : set_b) {
+            closed.push_back(ReflectAndInvert(n, x));
+          }
+          std::sort(closed.begin(), closed.end());
+          closed.erase(std::unique(closed.begin(), closed.end()),
+                       closed.end());
+          set_b = closed;
+        }
+        // A subset permuted by a permutation that commutes with the
+        // reflection, and a random set.
+        std::vector<int> perm(n);
+        std::iota(perm.begin(), perm.end(), 0);
+        std::shuffle(perm.begin(), perm.begin() + n / 2, gen);
+        for (int i = 0; i < n / 2; i++) {
+          perm[n - 1 - i] = n - 1 - perm[i];
+        }
+        std::vector<OutputType> subset;
+        std::sample(set_b.begin(), set_b.end(), std::back_inserter(subset),
+                    set_b.size() / 3, gen);
+        subset = PermuteChannels(subset, perm);
+        std::sort(subset.begin(), subset.end());
+        for (const auto &set_a :
+             {subset, GenerateRandomSet(n, 16, &gen)}) {
+          ASSERT_EQ(internal::IsIsomorphicToSubsetBacktracking(
+                        n, set_a, set_b, symmetric),
+                    internal::IsIsomorphicToSubsetBacktrackingReference(
+                        n, set_a, set_b, symmetric))
+              << "n=" << n << " symmetric=" << symmetric
+              << " trial=" << trial;
+        }
+        EXPECT_TRUE(internal::IsIsomorphicToSubsetBacktracking(
+            n, subset, set_b, symmetric));
+      }
+    }
+  }
+}
+
+TEST(IsomorphismTest, ParallelBacktracking) {
+  std::mt19937 gen(0);
+  // Split every search into tasks.
+  ThreadPool pool(4);
+  internal::BacktrackingOptions options;
+  options.sequential_node_limit = 1;
+  options.pool = &pool;
+  int num_parallel = 0;
+  for (int n : {8, 12}) {
+    for (bool symmetric : {false, true}) {
+      for (int trial = 0; trial < 10; trial++) {
+        std::vector<OutputType> set_b = GenerateRandomSet(n, 64, &gen);
+        if (symmetric) {
+          std::vector<OutputType> closed = set_b;
+          for (OutputType x : set_b) {
+            closed.push_back(ReflectAndInvert(n, x));
+          }
+          std::sort(closed.begin(), closed.end());
+          closed.erase(std::unique(closed.begin(), closed.end()),
+                       closed.end());
+          set_b = closed;
+        }
+        std::vector<OutputType> subset;
+        std::sample(set_b.begin(), set_b.end(), std::back_inserter(subset),
+                    set_b.size() / 3, gen);
+        internal::SetProjections projections_b(n, set_b, symmetric);
+        for (const auto &set_a : {subset, GenerateRandomSet(n, 16, &gen)}) {
+          internal::BacktrackingStats stats;
+          ASSERT_EQ(internal::IsIsomorphicToSubsetBacktracking(
+                        set_a, projections_b, options, &stats),
+                    internal::IsIsomorphicToSubsetBacktrackingReference(
+                        n, set_a, set_b, symmetric))
+              << "n=" << n << " symmetric=" << symmetric
+              << " trial=" << trial;
+          EXPECT_FALSE(stats.timed_out);
+          num_parallel += stats.parallel;
+        }
+      }
+    }
+  }
+  EXPECT_GT(num_parallel, 0);
+}
+
+TEST(IsomorphismTest, BacktrackingTimeout) {
+  std::mt19937 gen(0);
+  int n = 12;
+  std::vector<OutputType> set_b = GenerateRandomSet(n, 64, &gen);
+  std::vector<OutputType> set_a(set_b.begin(), set_b.begin() + 20);
+  internal::SetProjections projections_b(n, set_b, false);
+  internal::BacktrackingStats stats;
+  EXPECT_TRUE(internal::IsIsomorphicToSubsetBacktracking(
+      set_a, projections_b, {}, &stats));
+  EXPECT_GT(stats.num_nodes, 0);
+  EXPECT_FALSE(stats.timed_out);
+  // A timeout that has passed at the first node.
+  internal::BacktrackingOptions options;
+  options.timeout_seconds = 1e-9;
+  EXPECT_FALSE(internal::IsIsomorphicToSubsetBacktracking(
+      set_a, projections_b, options, &stats));
+  EXPECT_TRUE(stats.timed_out);
+}
+
+TEST(IsomorphismTest, FindRedundantOutputs) {
+  int n = 5;
+  OutputType mask = (OutputType(1) << n) - 1;
+  std::mt19937 gen(0);
+  for (int trial = 0; trial < 5; trial++) {
+    std::vector<std::vector<OutputType>> outputs_collection;
+    std::uniform_int_distribution<int> size_dist(1, 12);
+    for (int i = 0; i < 40; i++) {
+      outputs_collection.push_back(GenerateRandomSet(n, size_dist(gen), &gen));
+    }
+    std::stable_sort(
+        outputs_collection.begin(), outputs_collection.end(),
+        [](const auto &a, const auto &b) { return a.size() < b.size(); });
+    // i is redundant iff a smaller collection is isomorphic to a subset of it
+    // or of its inverse.
+    std::vector<bool> expected(outputs_collection.size(), false);
+    for (int i = 0; i < outputs_collection.size(); i++) {
+      std::vector<OutputType> inv;
+      for (OutputType x : outputs_collection[i]) {
+        inv.push_back(x ^ mask);
+      }
+      std::sort(inv.begin(), inv.end());
+      for (int j = 0; j < i && !expected[i]; j++) {
+        expected[i] = internal::IsIsomorphicToSubsetSlow(
+                          n, outputs_collection[j], outputs_collection[i]) ||
+                      internal::IsIsomorphicToSubsetSlow(
+                          n, outputs_collection[j], inv);
+      }
+    }
+    OutputsCollection collection(outputs_collection);
+    EXPECT_EQ(FindRedundantOutputs(n, &collection, /*fast=*/false,
+                                   /*symmetric=*/false, &gen),
+              expected)
+        << "trial=" << trial;
+    // The sets are permuted in place and restored.
+    EXPECT_EQ(collection.ToVectors(), outputs_collection);
+    // The second run with a cache reuses the results of the first one.
+    DominanceCache cache(1 << 20);
+    for (int run = 0; run < 2; run++) {
+      EXPECT_EQ(FindRedundantOutputs(n, &collection, /*fast=*/false,
+                                     /*symmetric=*/false, &gen, &cache),
+                expected)
+          << "trial=" << trial << " run=" << run;
+    }
+    // Nor does it depend on the schedule of the cheap passes, or on whether
+    // their candidates are kept.
+    for (int max_cheap_passes : {1, 3}) {
+      for (int64_t max_kept_candidates : {0, 1 << 20}) {
+        gflags::FlagSaver flag_saver;
+        FLAGS_redundancy_max_cheap_passes = max_cheap_passes;
+        FLAGS_redundancy_min_pass_yield = 0;
+        FLAGS_redundancy_max_kept_candidates = max_kept_candidates;
+        EXPECT_EQ(FindRedundantOutputs(n, &collection, /*fast=*/false,
+                                       /*symmetric=*/false, &gen),
+                  expected)
+            << "trial=" << trial << " max_cheap_passes=" << max_cheap_passes
+            << " max_kept_candidates=" << max_kept_candidates;
+      }
+    }
+    // A run resumed from the snapshot of the first one skips the sets it
+    // checked, with the same result.
+    {
+      gflags::FlagSaver flag_saver;
+      FLAGS_checkpoint_dir = "/tmp/test_redundancy_snapshot";
+      FLAGS_checkpoint_interval = 0;
+      std::filesystem::remove_all(FLAGS_checkpoint_dir);
+      EXPECT_EQ(FindRedundantOutputs(n, &collection, /*fast=*/false,
+                                     /*symmetric=*/false, &gen),
+                expected)
+          << "trial=" << trial;
+      EXPECT_FALSE(std::filesystem::is_empty(FLAGS_checkpoint_dir));
+      FLAGS_resume = true;
+      EXPECT_EQ(FindRedundantOutputs(n, &collection, /*fast=*/false,
+                                     /*symmetric=*/false, &gen),
+                expected)
+          << "trial=" << trial;
+    }
+    // The non-redundant sets of the first half, given as such, give the same
+    // result for the second half.
+    int half = outputs_collection.size() / 2;
+    OutputsCollection frontier;
+    for (int i = 0; i < half; i++) {
+      if (!expected[i]) {
+        frontier.Add(outputs_collection[i]);
+      }
+    }
+    int num_non_redundant = frontier.size();
+    for (int i = half; i < outputs_collection.size(); i++) {
+      frontier.Add(outputs_collection[i]);
+    }
+    std::vector<bool> is_redundant =
+        FindRedundantOutputs(n, &frontier, /*fast=*/false, /*symmetric=*/false,
+                             &gen, nullptr, num_non_redundant);
+    EXPECT_EQ(std::vector<bool>(is_redundant.begin() + num_non_redundant,
+                                is_redundant.end()),
+              std::vector<bool>(expected.begin() + half, expected.end()))
+        << "trial=" << trial;
+  }
+}
+
+TEST(IsomorphismTest, Witness) {
+  std::mt19937 gen(0);
+  for (int n : {6, 10}) {
+    for (bool symmetric : {false, true}) {
+      for (int trial = 0; trial < 20; trial++) {
+        std::vector<OutputType> set_b = GenerateRandomSet(n, 64, &gen);
+        std::vector<int> perm(n);
+        std::iota(perm.begin(), perm.end(), 0);
+        std::shuffle(perm.begin(), perm.begin() + n / 2, gen);
+        for (int i = 0; i < n / 2; i++) {
+          perm[n - 1 - i] = n - 1 - perm[i];
+        }
+        std::vector<OutputType> subset;
+        std::sample(set_b.begin(), set_b.end(), std::back_inserter(subset),
+                    set_b.size() / 2, gen);
+        subset = PermuteChannels(subset, perm);
+        std::sort(subset.begin(), subset.end());
+        std::vector<int> witness;
+        ASSERT_TRUE(
+            IsIsomorphicToSubset(n, subset, set_b, symmetric, &witness));
+        ASSERT_EQ(witness.size(), n);
+        for (OutputType a : subset) {
+          OutputType b = 0;
+          for (int c = 0; c < n; c++) {
+            b |= ((a >> c) & OutputType(1)) << witness[c];
+          }
+          EXPECT_TRUE(std::binary_search(set_b.begin(), set_b.end(), b));
+        }
+        if (symmetric) {
+          for (int c = 0; c < n; c++) {
+            EXPECT_EQ(witness[n - 1 - c], n - 1 - witness[c]);
+          }
+        }
+      }
+    }
+  }
+}
+
 } // namespace
@@ -20,3 +20,21 @@ std::vector<int> InversePermutation(const std::vector<int> &perm) {
   }
   return inv_perm;
 }
+
+uint64_t RandomSeed(std::mt19937 *gen) {
+  uint64_t high = (*gen)();
+  return (high << 32) | (*gen)();
+}
+
+std::mt19937 TaskGenerator(uint64_t seed, uint64_t index) {
+  // splitmix64 of the seed and the index, so that nearby indices get
+  // unrelated seeds.
+  uint64_t x = seed + (index + 1) * 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  // Both halves seed the state, so that the streams are not limited to 2^32.
+  std::seed_seq seed_seq{static_cast<uint32_t>(x),
+                         static_cast<uint32_t>(x >> 32)};
+  return std::mt19937(seed_seq);
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <random>
 #include <vector>
 
@@ -8,3 +9,12 @@ std::vector<int> RandomPermutation(int n, std::mt19937 *gen);
 
 // Computes the inverse permutation.
 std::vector<int> InversePermutation(const std::vector<int> &perm);
+
+// Draws a 64-bit seed for TaskGenerator from two outputs of gen, which only
+// yields 32 bits at a time.
+uint64_t RandomSeed(std::mt19937 *gen);
+
+// Returns a generator for the task index of a parallel loop. Its stream only
+// depends on seed and index, so that the loop gives the same results whatever
+// the number of threads and the order in which the tasks run.
+std::mt19937 TaskGenerator(uint64_t seed, uint64_t index);
@@ -125,3 +125,42 @@ TEST(InversePermutationTest, WithRandomPermutation) {
     EXPECT_EQ(inv_inv, perm) << "Failed round trip for n=" << n;
   }
 }
+
+// TaskGenerator Tests
+
+TEST(TaskGeneratorTest, DependsOnlyOnSeedAndIndex) {
+  std::mt19937 gen1 = TaskGenerator(42, 7);
+  std::mt19937 gen2 = TaskGenerator(42, 7);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(gen1(), gen2());
+  }
+}
+
+TEST(TaskGeneratorTest, DistinctStreams) {
+  // The first outputs of the streams of nearby seeds and indices differ.
+  std::set<std::mt19937::result_type> first_outputs;
+  for (uint64_t seed = 0; seed < 10; seed++) {
+    for (uint64_t index = 0; index < 100; index++) {
+      first_outputs.insert(TaskGenerator(seed, index)());
+    }
+  }
+  EXPECT_EQ(first_outputs.size(), 1000);
+}
+
+TEST(TaskGeneratorTest, SeedsDifferingInHighBits) {
+  // The seeds that only differ above the 32 low bits give other streams.
+  std::set<std::mt19937::result_type> first_outputs;
+  for (uint64_t high = 0; high < 100; high++) {
+    first_outputs.insert(TaskGenerator(high << 32, 0)());
+  }
+  EXPECT_EQ(first_outputs.size(), 100);
+}
+
+TEST(RandomSeedTest, UsesTwoDraws) {
+  std::mt19937 gen(0);
+  std::mt19937 expected_gen(0);
+  uint64_t high = expected_gen();
+  uint64_t low = expected_gen();
+  EXPECT_EQ(RandomSeed(&gen), (high << 32) | low);
+  EXPECT_EQ(gen(), expected_gen());
+}
@@ -36,17 +36,18 @@ std::string Layer::ToString() const {
 
 pb::Layer Layer::ToProto() const {
   pb::Layer layer_proto;
-  for (int i = 0; i < matching.size(); i++) {
-    layer_proto.add_matching(matching[i]);
-  }
+  ToProto(&layer_proto);
   return layer_proto;
 }
 
+void Layer::ToProto(pb::Layer *layer_proto) const {
+  layer_proto->mutable_matching()->Assign(matching.begin(), matching.end());
+}
+
 Layer Layer::FromProto(const pb::Layer &layer_proto) {
-  Layer layer(layer_proto.matching_size());
-  for (int i = 0; i < layer_proto.matching_size(); i++) {
-    layer.matching[i] = layer_proto.matching(i);
-  }
+  Layer layer(0);
+  layer.matching.assign(layer_proto.matching().begin(),
+                        layer_proto.matching().end());
   return layer;
 }
 
@@ -79,24 +80,28 @@ std::string Network::ToString(bool one_line) const {
 
 pb::Network Network::ToProto() const {
   pb::Network network_proto;
-  network_proto.set_n(n);
+  ToProto(&network_proto);
+  return network_proto;
+}
+
+void Network::ToProto(pb::Network *network_proto) const {
+  network_proto->set_n(n);
+  // Clear() keeps the cleared layers allocated and Add() reuses them.
+  network_proto->mutable_layer()->Clear();
   for (const auto &layer : layers) {
-    *network_proto.add_layer() = layer.ToProto();
-  }
-  for (const auto &output : outputs) {
-    network_proto.add_output(output);
+    layer.ToProto(network_proto->add_layer());
   }
-  return network_proto;
+  network_proto->mutable_output()->Assign(outputs.begin(), outputs.end());
 }
 
 Network Network::FromProto(const pb::Network &network_proto) {
-  Network network(network_proto.n(), network_proto.layer_size());
-  for (int i = 0; i < network_proto.layer_size(); i++) {
-    network.layers[i] = Layer::FromProto(network_proto.layer(i));
-  }
-  for (int i = 0; i < network_proto.output_size(); i++) {
-    network.outputs.push_back(network_proto.output(i));
+  Network network(network_proto.n(), 0);
+  network.layers.reserve(network_proto.layer_size());
+  for (const auto &layer_proto : network_proto.layer()) {
+    network.layers.push_back(Layer::FromProto(layer_proto));
   }
+  network.outputs.assign(network_proto.output().begin(),
+                         network_proto.output().end());
   return network;
 }
 
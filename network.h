@@ -16,6 +16,8 @@ struct Layer {
   static Layer FromProto(const pb::Layer &layer_proto);
   // Converts the layer to a protocol buffer representation.
   pb::Layer ToProto() const;
+  // Like above, but overwrites layer_proto, reusing its allocations.
+  void ToProto(pb::Layer *layer_proto) const;
 
   // Returns the number of channels in this layer.
   int n() const { return matching.size(); }
@@ -41,6 +43,9 @@ struct Network {
   static Network FromProto(const pb::Network &network_proto);
   // Converts the network to a protocol buffer representation.
   pb::Network ToProto() const;
+  // Like above, but overwrites network_proto, reusing its allocations, e.g. to
+  // serialize many networks through one message.
+  void ToProto(pb::Network *network_proto) const;
   // Returns a string representation of the network.
   // If one_line is true, formats all layers on a single line.
   std::string ToString(bool one_line = false) const;
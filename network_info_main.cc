@@ -27,17 +27,23 @@ int main(int argc, char *argv[]) {
 
   std::vector<Network> networks;
   if (!FLAGS_pb_path.empty()) {
-    networks = LoadFromProtoFile(FLAGS_pb_path, FLAGS_n);
+    networks =
+        LoadFromProtoFile(FLAGS_pb_path, FLAGS_n, /*fill_outputs=*/false);
   } else {
-    networks = LoadFromBracketFile(FLAGS_n, FLAGS_bracket_path);
+    networks = LoadFromBracketFile(FLAGS_n, FLAGS_bracket_path, false);
   }
-  for (int i = 0; i < networks.size(); i++) {
-    if (networks[i].layers.size() > FLAGS_prefix_depth) {
-      networks[i].layers.erase(networks[i].layers.begin() + FLAGS_prefix_depth,
-                               networks[i].layers.end());
-      networks[i].outputs.clear();
-      networks[i].outputs = NetworkOutputs(networks[i]);
+  // Truncate first, so that the outputs are only computed for the prefixes.
+  for (Network &network : networks) {
+    if (network.layers.size() > FLAGS_prefix_depth) {
+      network.layers.erase(network.layers.begin() + FLAGS_prefix_depth,
+                           network.layers.end());
+      network.outputs.clear();
     }
+  }
+  LazyOutputs lazy_outputs(&networks);
+  lazy_outputs.Prefetch(0, networks.size());
+  for (int i = 0; i < networks.size(); i++) {
+    lazy_outputs.Get(i);
     std::cout << "i=" << i << std::endl;
     std::cout << "Network: " << networks[i].ToString();
     std::cout << "Is symmetric: " << networks[i].IsSymmetric() << std::endl;
@@ -0,0 +1,176 @@
+/*
+Measure the load and save throughput of network collections.
+
+This creates random prefixes, saves and loads them with SaveToProtoFile and
+LoadFromProtoFile, and compares them with the plain approach of building a
+whole pb::NetworkCollection and copying the fields one at a time.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "network.h"
+#include "network.pb.h"
+#include "network_utils.h"
+
+DEFINE_int32(count, 1000000, "The number of prefixes.");
+DEFINE_int32(n, 16, "The number of channels.");
+DEFINE_int32(depth, 5, "The number of layers of each prefix.");
+DEFINE_int32(num_outputs, 0,
+             "The number of (fake) outputs stored with each prefix.");
+DEFINE_string(path, "/tmp/network_io_benchmark.pb",
+              "The file to write. Use .pb.gz or .pb.zst to include the "
+              "compression, and .shards to include the sharding.");
+DEFINE_bool(baseline, true,
+            "Also measure the whole-collection load and save for comparison.");
+
+namespace {
+
+std::vector<Network> RandomNetworks(std::mt19937 *gen) {
+  std::vector<Network> networks;
+  networks.reserve(FLAGS_count);
+  std::vector<int> channels(FLAGS_n);
+  std::iota(channels.begin(), channels.end(), 0);
+  std::uniform_int_distribution<OutputType> output_dist;
+  for (int k = 0; k < FLAGS_count; k++) {
+    Network network(FLAGS_n, FLAGS_depth);
+    for (auto &layer : network.layers) {
+      std::shuffle(channels.begin(), channels.end(), *gen);
+      for (int i = 0; i + 1 < FLAGS_n; i += 2) {
+        layer.matching[channels[i]] = channels[i + 1];
+        layer.matching[channels[i + 1]] = channels[i];
+      }
+    }
+    for (int i = 0; i < FLAGS_num_outputs; i++) {
+      network.outputs.push_back(output_dist(*gen));
+    }
+    networks.push_back(std::move(network));
+  }
+  return networks;
+}
+
+// The whole-collection save, with the fields copied one at a time.
+void BaselineSave(const std::vector<Network> &networks,
+                  const std::string &filename) {
+  pb::NetworkCollection network_collection_proto;
+  for (const auto &network : networks) {
+    pb::Network *network_proto = network_collection_proto.add_network();
+    network_proto->set_n(network.n);
+    for (const auto &layer : network.layers) {
+      pb::Layer *layer_proto = network_proto->add_layer();
+      for (int j : layer.matching) {
+        layer_proto->add_matching(j);
+      }
+    }
+    for (OutputType output : network.outputs) {
+      network_proto->add_output(output);
+    }
+  }
+  std::ofstream file(filename, std::ios::binary);
+  CHECK(network_collection_proto.SerializeToOstream(&file));
+}
+
+// The whole-collection load, with the fields copied one at a time.
+std::vector<Network> BaselineLoad(const std::string &filename) {
+  pb::NetworkCollection network_collection_proto;
+  std::ifstream file(filename, std::ios::binary);
+  CHECK(network_collection_proto.ParseFromIstream(&file));
+  std::vector<Network> networks;
+  for (const auto &network_proto : network_collection_proto.network()) {
+    Network network(network_proto.n(), network_proto.layer_size());
+    for (int i = 0; i < network_proto.layer_size(); i++) {
+      for (int j = 0; j < network_proto.layer(i).matching_size(); j++) {
+        network.layers[i].matching[j] = network_proto.layer(i).matching(j);
+      }
+    }
+    for (int i = 0; i < network_proto.output_size(); i++) {
+      network.outputs.push_back(network_proto.output(i));
+    }
+    networks.push_back(std::move(network));
+  }
+  return networks;
+}
+
+// Returns the size of a file, or the total size of the files in a directory.
+double FileBytes(const std::string &path) {
+  if (!std::filesystem::is_directory(path)) {
+    return std::filesystem::file_size(path);
+  }
+  double bytes = 0;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(path)) {
+    if (entry.is_regular_file()) {
+      bytes += entry.file_size();
+    }
+  }
+  return bytes;
+}
+
+double Seconds(const std::function<void()> &f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+void Report(const std::string &name, double seconds, double file_bytes) {
+  LOG(INFO) << std::format("{:<14} {:8.3f} s {:10.0f} networks/s {:8.1f} MB/s",
+                           name, seconds, FLAGS_count / seconds,
+                           file_bytes / seconds / 1e6);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  FLAGS_alsologtostderr = true;
+  FLAGS_log_dir = "/tmp";
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_EQ(argc, 1);
+  CHECK_GT(FLAGS_count, 0);
+
+  std::mt19937 gen(0);
+  std::vector<Network> networks = RandomNetworks(&gen);
+  LOG(INFO) << std::format("Created {} networks with n={} and depth={}",
+                           networks.size(), FLAGS_n, FLAGS_depth);
+
+  // Truncating a large file can take longer than writing it, so both saves
+  // start without an existing file.
+  std::filesystem::remove_all(FLAGS_path);
+  double save_seconds =
+      Seconds([&]() { SaveToProtoFile(networks, FLAGS_path); });
+  double file_bytes = FileBytes(FLAGS_path);
+  std::vector<Network> loaded;
+  double load_seconds = Seconds([&]() {
+    loaded = LoadFromProtoFile(FLAGS_path, FLAGS_n, /*fill_outputs=*/false);
+  });
+  CHECK(loaded == networks);
+  LOG(INFO) << std::format("{}: {} bytes", FLAGS_path, file_bytes);
+  Report("save", save_seconds, file_bytes);
+  Report("load", load_seconds, file_bytes);
+
+  if (FLAGS_baseline) {
+    std::string baseline_path = FLAGS_path + ".baseline.pb";
+    save_seconds = Seconds([&]() { BaselineSave(networks, baseline_path); });
+    file_bytes = std::filesystem::file_size(baseline_path);
+    loaded.clear();
+    load_seconds = Seconds([&]() { loaded = BaselineLoad(baseline_path); });
+    CHECK(loaded == networks);
+    Report("baseline save", save_seconds, file_bytes);
+    Report("baseline load", load_seconds, file_bytes);
+    std::filesystem::remove(baseline_path);
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+#include "network_score.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "canonical_form.h"
+#include "thread_pool.h"
+
+DEFINE_string(network_score, "outputs",
+              "How CleanUp ranks the networks to keep the best ones: "
+              "\"outputs\" (the number of outputs), \"window\" (the sum of "
+              "the window sizes of the outputs), \"window_sqr\" (the sum of "
+              "their squares) or \"clauses\" (the number of clauses of the "
+              "outputs in the CNF of sat_generate_cnf_main).");
+DEFINE_int32(network_score_suffix_depth, 1,
+             "The number of layers that the CNF adds to the networks, for "
+             "--network_score=clauses.");
+
+NetworkScore NetworkScore::Parse(const std::string &name, int suffix_depth) {
+  CHECK_GT(suffix_depth, 0);
+  NetworkScore score;
+  score.suffix_depth = suffix_depth;
+  if (name == "outputs") {
+    score.kind = kNumOutputs;
+  } else if (name == "window") {
+    score.kind = kSumWindowSize;
+  } else if (name == "window_sqr") {
+    score.kind = kSumSqrWindowSize;
+  } else if (name == "clauses") {
+    score.kind = kNumClauses;
+  } else {
+    LOG(FATAL) << "Unknown network score: " << name;
+  }
+  return score;
+}
+
+NetworkScore NetworkScore::FromFlags() {
+  return Parse(FLAGS_network_score, FLAGS_network_score_suffix_depth);
+}
+
+int64_t NetworkScore::operator()(int n,
+                                 std::span<const OutputType> outputs) const {
+  if (kind == kNumOutputs) {
+    return outputs.size();
+  }
+  int64_t sum_window_size = 0;
+  int64_t sum_sqr_window_size = 0;
+  for (OutputType x : outputs) {
+    int64_t window_size = WindowSize(n, x);
+    sum_window_size += window_size;
+    sum_sqr_window_size += window_size * window_size;
+  }
+  switch (kind) {
+  case kNumOutputs:
+    return outputs.size();
+  case kSumWindowSize:
+    return sum_window_size;
+  case kSumSqrWindowSize:
+    return sum_sqr_window_size;
+  case kNumClauses:
+    return suffix_depth * (3 * sum_sqr_window_size - sum_window_size) +
+           2 * sum_window_size;
+  }
+  LOG(FATAL) << "Unknown network score kind: " << kind;
+  return 0;
+}
+
+int64_t NetworkScore::OfNetwork(int n, std::span<const OutputType> outputs,
+                                bool symmetric) const {
+  if (kind == kNumOutputs) {
+    return outputs.size();
+  }
+  return (*this)(n, CanonicalFormUpToInverse(n, outputs, symmetric));
+}
+
+std::vector<Network> KeepBestNetworks(std::vector<Network> networks,
+                                      const NetworkScore &score,
+                                      int keep_best_count, bool symmetric) {
+  CHECK_GT(keep_best_count, 0);
+  if (keep_best_count >= networks.size()) {
+    return networks;
+  }
+  std::vector<int64_t> scores(networks.size());
+  ParallelFor(0, networks.size(), [&](int i) {
+    scores[i] = score.OfNetwork(networks[i].n, networks[i].outputs, symmetric);
+  });
+  std::vector<int64_t> sorted_scores = scores;
+  std::nth_element(sorted_scores.begin(),
+                   sorted_scores.begin() + keep_best_count - 1,
+                   sorted_scores.end());
+  int64_t threshold = sorted_scores[keep_best_count - 1];
+  std::vector<Network> best_networks;
+  for (int i = 0; i < networks.size(); i++) {
+    if (scores[i] <= threshold) {
+      best_networks.push_back(std::move(networks[i]));
+    }
+  }
+  LOG(INFO) << "Kept " << best_networks.size() << " networks with a score of "
+            << "at most " << threshold;
+  return best_networks;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "network.h"
+#include "output_type.h"
+
+// The score that ranks the networks kept by CleanUp, and its suffix depth.
+DECLARE_string(network_score);
+DECLARE_int32(network_score_suffix_depth);
+
+// Ranks the networks whose best ones CleanUp keeps: the lower, the better.
+// A network is scored on the canonical form of its outputs up to inversion
+// (see CanonicalFormUpToInverse), so that the score does not depend on which
+// network of an isomorphism class CleanUp kept, and the window sizes (see
+// WindowSize) are taken in the channel order of that form.
+struct NetworkScore {
+  enum Kind {
+    // The number of outputs.
+    kNumOutputs,
+    // The sum of the window sizes of the outputs.
+    kSumWindowSize,
+    // The sum of the squares of the window sizes of the outputs.
+    kSumSqrWindowSize,
+    // The number of clauses that sat_generate_cnf_main adds for the outputs,
+    // with a suffix of suffix_depth layers: suffix_depth * (3 * w * w - w) +
+    // 2 * w for an output of window size w.
+    kNumClauses,
+  };
+
+  // Parses "outputs", "window", "window_sqr" or "clauses".
+  static NetworkScore Parse(const std::string &name, int suffix_depth = 1);
+  // The score given by --network_score and --network_score_suffix_depth.
+  static NetworkScore FromFlags();
+
+  // Returns the score of a set of outputs, in its channel order.
+  int64_t operator()(int n, std::span<const OutputType> outputs) const;
+  // Returns the score of a network with the given outputs: the score of their
+  // canonical form.
+  int64_t OfNetwork(int n, std::span<const OutputType> outputs,
+                    bool symmetric) const;
+
+  Kind kind = kNumOutputs;
+  int suffix_depth = 1;
+};
+
+// Returns the networks whose score is at most the score of the
+// keep_best_count-th best network, in their order.
+std::vector<Network> KeepBestNetworks(std::vector<Network> networks,
+                                      const NetworkScore &score,
+                                      int keep_best_count, bool symmetric);
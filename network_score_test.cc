@@ -0,0 +1,101 @@
+#include "network_score.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "clean_up.h"
+#include "math_utils.h"
+#include "network.h"
+#include "network_utils.h"
+#include "test_networks.h"
+
+namespace {
+
+TEST(NetworkScoreTest, Kinds) {
+  // The window sizes are 2, 3 and 0.
+  std::vector<OutputType> outputs = {0b010, 0b001, 0b111};
+  EXPECT_EQ(NetworkScore::Parse("outputs")(3, outputs), 3);
+  EXPECT_EQ(NetworkScore::Parse("window")(3, outputs), 5);
+  EXPECT_EQ(NetworkScore::Parse("window_sqr")(3, outputs), 13);
+  // 2 * (3 * 13 - 5) + 2 * 5.
+  EXPECT_EQ(NetworkScore::Parse("clauses", 2)(3, outputs), 78);
+  EXPECT_EQ(NetworkScore().kind, NetworkScore::kNumOutputs);
+}
+
+TEST(NetworkScoreTest, OfNetwork) {
+  // The canonical form is {0000, 0110, 1000, 1111}, of window sizes 0, 3, 0
+  // and 0.
+  std::vector<OutputType> outputs = {0b0000, 0b0001, 0b0110, 0b1111};
+  NetworkScore score = NetworkScore::Parse("window");
+  EXPECT_EQ(score(4, outputs), 7);
+  EXPECT_EQ(score.OfNetwork(4, outputs, false), 3);
+  EXPECT_EQ(NetworkScore().OfNetwork(4, outputs, false), 4);
+}
+
+TEST(NetworkScoreTest, KeepBestNetworks) {
+  std::vector<Network> networks;
+  for (const std::vector<OutputType> &outputs :
+       std::vector<std::vector<OutputType>>{
+           {0b0000, 0b0001, 0b0011, 0b0111, 0b1111},
+           {0b0000, 0b0001, 0b0110, 0b1111},
+           {0b0000, 0b0101, 0b0110, 0b1001, 0b1111},
+           {0b0000, 0b0001, 0b0010, 0b0011, 0b0111, 0b1111},
+           {0b0000, 0b0001, 0b0100, 0b0101, 0b1111}}) {
+    Network network(4, 1);
+    network.outputs = outputs;
+    networks.push_back(network);
+  }
+  NetworkScore score = NetworkScore::Parse("window");
+  // The scores of the canonical forms are 0, 3, 6, 2 and 2: the third best is
+  // 2.
+  std::vector<Network> best = KeepBestNetworks(networks, score, 3, false);
+  ASSERT_EQ(best.size(), 3);
+  EXPECT_EQ(best[0].outputs, networks[0].outputs);
+  EXPECT_EQ(best[1].outputs, networks[3].outputs);
+  EXPECT_EQ(best[2].outputs, networks[4].outputs);
+  // The ties are kept.
+  EXPECT_EQ(KeepBestNetworks(networks, score, 1, false).size(), 1);
+  EXPECT_EQ(KeepBestNetworks(networks, score, 2, false).size(), 3);
+  EXPECT_EQ(KeepBestNetworks(networks, score, 10, false).size(), 5);
+}
+
+// The isomorphic networks get the same scores.
+TEST(NetworkScoreTest, InvariantUnderPermutations) {
+  std::mt19937 gen(0);
+  int n = 7;
+  for (int i = 0; i < 50; i++) {
+    Network network = RandomNetwork(n, 3, &gen);
+    std::vector<OutputType> permuted =
+        PermuteChannels(network.outputs, RandomPermutation(n, &gen));
+    std::sort(permuted.begin(), permuted.end());
+    for (const char *name : {"window", "window_sqr", "clauses"}) {
+      NetworkScore score = NetworkScore::Parse(name, 2);
+      EXPECT_EQ(score.OfNetwork(n, network.outputs, false),
+                score.OfNetwork(n, permuted, false))
+          << name;
+    }
+  }
+}
+
+// CleanUp keeps the non-redundant networks with the best scores.
+TEST(NetworkScoreTest, CleanUp) {
+  std::mt19937 gen(0);
+  int n = 7;
+  std::vector<Network> networks;
+  for (int i = 0; i < 300; i++) {
+    networks.push_back(RandomNetwork(n, 3, &gen));
+  }
+  std::vector<Network> non_redundant =
+      CleanUp(networks, false, std::numeric_limits<int>::max(), &gen);
+  for (const char *name : {"window", "window_sqr", "clauses"}) {
+    NetworkScore score = NetworkScore::Parse(name, 2);
+    std::vector<Network> best = CleanUp(networks, false, 10, &gen, score);
+    EXPECT_EQ(best, KeepBestNetworks(non_redundant, score, 10, false)) << name;
+  }
+}
+
+} // namespace
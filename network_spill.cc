@@ -0,0 +1,204 @@
+#include "network_spill.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <queue>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "canonical_form.h"
+#include "clean_up.h"
+#include "network_utils.h"
+#include "output_type.h"
+#include "thread_pool.h"
+
+DEFINE_string(spill_dir, "",
+              "If not empty, ExtendNetwork spills the extended networks to "
+              "sorted runs in a directory created under it, and removes the "
+              "redundant ones by streaming over the runs, so that only the "
+              "non-redundant networks stay in memory.");
+DEFINE_int64(spill_run_outputs, int64_t(1) << 28,
+             "The number of outputs of a run spilled to --spill_dir, and of a "
+             "chunk of the merged runs checked against the non-redundant "
+             "networks.");
+
+namespace {
+
+std::vector<OutputType> Form(const Network &network, bool symmetric) {
+  return CanonicalFormUpToInverse(network.n, network.outputs, symmetric);
+}
+
+} // namespace
+
+NetworkSpill::NetworkSpill(const std::string &dirname, bool symmetric,
+                           int64_t max_run_outputs)
+    : symmetric_(symmetric), max_run_outputs_(max_run_outputs) {
+  CHECK_GT(max_run_outputs, 0);
+  // A directory of its own, so that several spills can share dirname.
+  static std::atomic<int> next_id(0);
+  dirname_ = (std::filesystem::path(dirname) /
+              std::format("spill-{}-{}", getpid(), next_id.fetch_add(1)))
+                 .string();
+  std::filesystem::create_directories(dirname_);
+}
+
+NetworkSpill::~NetworkSpill() { std::filesystem::remove_all(dirname_); }
+
+void NetworkSpill::Add(std::vector<Network> networks) {
+  for (Network &network : networks) {
+    CHECK(!network.outputs.empty());
+    buffer_outputs_ += network.outputs.size();
+    buffer_.push_back(std::move(network));
+    num_networks_++;
+    if (buffer_outputs_ >= max_run_outputs_) {
+      Spill();
+    }
+  }
+}
+
+void NetworkSpill::Spill() {
+  if (buffer_.empty()) {
+    return;
+  }
+  std::vector<uint64_t> fingerprints(buffer_.size());
+  ParallelFor(0, buffer_.size(), [&](int i) {
+    fingerprints[i] = HashOutputs(Form(buffer_[i], symmetric_));
+  });
+  auto key = [&](int i) {
+    return std::make_pair(buffer_[i].outputs.size(), fingerprints[i]);
+  };
+  std::vector<int> order(buffer_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int i, int j) { return key(i) < key(j); });
+
+  // The isomorphic networks have the same key: keep the first one of each
+  // class among the networks of a key (almost always a single class).
+  Run run;
+  run.filename = (std::filesystem::path(dirname_) /
+                  std::format("run-{:05}.pb", runs_.size()))
+                     .string();
+  std::vector<Network> networks;
+  for (int begin = 0, end = 0; begin < order.size(); begin = end) {
+    while (end < order.size() && key(order[end]) == key(order[begin])) {
+      end++;
+    }
+    std::vector<std::vector<OutputType>> forms;
+    for (int k = begin; k < end; k++) {
+      Network &network = buffer_[order[k]];
+      if (end - begin > 1) {
+        std::vector<OutputType> form = Form(network, symmetric_);
+        if (std::find(forms.begin(), forms.end(), form) != forms.end()) {
+          continue;
+        }
+        forms.push_back(std::move(form));
+      }
+      run.sizes.push_back(network.outputs.size());
+      run.fingerprints.push_back(fingerprints[order[k]]);
+      networks.push_back(std::move(network));
+    }
+  }
+  SaveToProtoFile(networks, run.filename);
+  LOG(INFO) << std::format("Spilled {} networks to {} ({} isomorphic)",
+                           networks.size(), run.filename,
+                           buffer_.size() - networks.size());
+  runs_.push_back(std::move(run));
+  std::vector<Network>().swap(buffer_);
+  buffer_outputs_ = 0;
+}
+
+std::vector<Network> NetworkSpill::CleanUp(int keep_best_count,
+                                           std::mt19937 *gen,
+                                           const NetworkScore &score) {
+  CHECK_GT(keep_best_count, 0);
+  Spill();
+
+  // Merge the runs by key, and then by run, as the networks were added.
+  std::vector<std::unique_ptr<NetworkProtoReader>> readers;
+  std::vector<size_t> positions(runs_.size(), 0);
+  using Entry = std::tuple<int, uint64_t, int>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+  for (int r = 0; r < runs_.size(); r++) {
+    readers.push_back(std::make_unique<NetworkProtoReader>(runs_[r].filename));
+    if (!runs_[r].sizes.empty()) {
+      heap.emplace(runs_[r].sizes[0], runs_[r].fingerprints[0], r);
+    }
+  }
+
+  // The non-redundant networks so far.
+  IncrementalCleanUp frontier(symmetric_, keep_best_count, score);
+  // The outputs of the first network with the current key, and the forms of
+  // the networks kept with it, computed if another network has the key.
+  std::pair<int, uint64_t> last_key = {-1, 0};
+  std::vector<OutputType> last_key_outputs;
+  std::vector<std::vector<OutputType>> last_key_forms;
+  int64_t num_isomorphic = 0;
+
+  std::vector<Network> chunk;
+  int64_t chunk_outputs = 0;
+  auto check_chunk = [&]() {
+    frontier.Add(std::move(chunk), gen);
+    chunk.clear();
+    chunk_outputs = 0;
+  };
+
+  while (!heap.empty()) {
+    auto [size, fingerprint, r] = heap.top();
+    heap.pop();
+    if (size > frontier.max_size()) {
+      break;
+    }
+    Network network(0, 0);
+    CHECK(readers[r]->Next(&network));
+    CHECK_EQ(network.outputs.size(), size);
+    if (++positions[r] < runs_[r].sizes.size()) {
+      heap.emplace(runs_[r].sizes[positions[r]],
+                   runs_[r].fingerprints[positions[r]], r);
+    }
+    // The isomorphic networks of different runs have the same key, so they
+    // come one after another.
+    std::pair<int, uint64_t> key = {size, fingerprint};
+    if (key != last_key) {
+      last_key = key;
+      last_key_outputs = network.outputs;
+      last_key_forms.clear();
+    } else {
+      if (last_key_forms.empty()) {
+        last_key_forms.push_back(CanonicalFormUpToInverse(
+            network.n, last_key_outputs, symmetric_));
+      }
+      std::vector<OutputType> form = Form(network, symmetric_);
+      if (std::find(last_key_forms.begin(), last_key_forms.end(), form) !=
+          last_key_forms.end()) {
+        num_isomorphic++;
+        continue;
+      }
+      last_key_forms.push_back(std::move(form));
+    }
+    chunk_outputs += network.outputs.size();
+    chunk.push_back(std::move(network));
+    if (chunk_outputs >= max_run_outputs_) {
+      check_chunk();
+    }
+  }
+  check_chunk();
+  readers.clear();
+  for (const Run &run : runs_) {
+    std::filesystem::remove(run.filename);
+  }
+  runs_.clear();
+  LOG(INFO) << std::format("Removed {} networks with isomorphic outputs across "
+                           "runs",
+                           num_isomorphic);
+
+  return frontier.Release();
+}
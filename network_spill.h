@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "network.h"
+#include "network_score.h"
+
+// Where ExtendNetwork spills the extended networks, and the size of the runs.
+DECLARE_string(spill_dir);
+DECLARE_int64(spill_run_outputs);
+
+// Removes the isomorphic and redundant networks of a collection that does not
+// fit in memory, with the same result as RemoveIsomorphicNetworks and CleanUp.
+//
+// The networks are added in batches and spilled to runs on disk, each sorted by
+// the number of outputs and by a fingerprint, the hash of the canonical form of
+// the outputs up to inversion, after removing its isomorphic networks. CleanUp
+// merges the runs, so that the isomorphic networks of different runs come
+// together, and streams over the networks by increasing number of outputs: each
+// chunk of them is checked against the non-redundant networks found so far (the
+// frontier), which is all that stays in memory besides the chunk.
+class NetworkSpill {
+public:
+  // The runs are created in dirname, which is created if needed, and have
+  // about max_run_outputs outputs.
+  NetworkSpill(const std::string &dirname, bool symmetric,
+               int64_t max_run_outputs);
+  // Removes the runs.
+  ~NetworkSpill();
+  NetworkSpill(const NetworkSpill &) = delete;
+  NetworkSpill &operator=(const NetworkSpill &) = delete;
+
+  // Adds networks with their outputs. A run is spilled once the added networks
+  // have max_run_outputs outputs.
+  void Add(std::vector<Network> networks);
+  // Returns the non-redundant networks, or only the best ones as CleanUp
+  // does. The runs are consumed.
+  std::vector<Network> CleanUp(int keep_best_count, std::mt19937 *gen,
+                               const NetworkScore &score = NetworkScore());
+
+  int64_t num_networks() const { return num_networks_; }
+
+private:
+  struct Run {
+    std::string filename;
+    // The sort keys of the networks of the run, in order.
+    std::vector<int> sizes;
+    std::vector<uint64_t> fingerprints;
+  };
+
+  // Sorts the buffered networks, removes the isomorphic ones and writes them.
+  void Spill();
+
+  std::string dirname_;
+  bool symmetric_;
+  int64_t max_run_outputs_;
+  std::vector<Network> buffer_;
+  int64_t buffer_outputs_ = 0;
+  std::vector<Run> runs_;
+  int64_t num_networks_ = 0;
+};
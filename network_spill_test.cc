@@ -0,0 +1,83 @@
+#include "network_spill.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "gtest/gtest.h"
+
+#include "clean_up.h"
+#include "extend_network.h"
+#include "network.h"
+#include "network_utils.h"
+#include "test_networks.h"
+
+namespace {
+
+constexpr char kSpillDir[] = "/tmp/test_network_spill";
+
+TEST(NetworkSpillTest, SameAsCleanUp) {
+  std::filesystem::remove_all(kSpillDir);
+  std::mt19937 gen(0);
+  int n = 7;
+  std::vector<Network> networks;
+  for (int i = 0; i < 300; i++) {
+    networks.push_back(RandomNetwork(n, 3, &gen));
+  }
+  for (int keep_best_count : {std::numeric_limits<int>::max(), 5}) {
+    std::vector<Network> expected =
+        CleanUp(RemoveIsomorphicNetworks(networks, false), false,
+                keep_best_count, &gen);
+    // Runs of about 10 networks, and a single run.
+    for (int64_t max_run_outputs : {1000, 1 << 20}) {
+      NetworkSpill spill(kSpillDir, false, max_run_outputs);
+      for (int begin = 0; begin < networks.size(); begin += 50) {
+        spill.Add(std::vector<Network>(networks.begin() + begin,
+                                       networks.begin() + begin + 50));
+      }
+      EXPECT_EQ(spill.num_networks(), networks.size());
+      std::vector<Network> result = spill.CleanUp(keep_best_count, &gen);
+      EXPECT_TRUE(std::is_sorted(result.begin(), result.end(),
+                                 [](const Network &a, const Network &b) {
+                                   return a.outputs.size() < b.outputs.size();
+                                 }));
+      for (const Network &network : result) {
+        EXPECT_EQ(network.outputs, NetworkOutputs(network));
+      }
+      EXPECT_EQ(Forms(result, false), Forms(expected, false))
+          << "keep_best_count=" << keep_best_count
+          << " max_run_outputs=" << max_run_outputs;
+    }
+  }
+  EXPECT_TRUE(std::filesystem::is_empty(kSpillDir));
+}
+
+TEST(NetworkSpillTest, ExtendNetwork) {
+  for (bool symmetric : {false, true}) {
+    int n = 8;
+    std::vector<Network> networks = CreateFirstLayer(n, symmetric);
+    for (Network &network : networks) {
+      network.AddEmptyLayer();
+    }
+    std::mt19937 gen(0);
+    networks = ExtendNetwork(n, networks, symmetric, false,
+                             std::numeric_limits<int>::max(), &gen);
+    for (Network &network : networks) {
+      network.AddEmptyLayer();
+    }
+    std::vector<Network> expected = ExtendNetwork(
+        n, networks, symmetric, false, std::numeric_limits<int>::max(), &gen);
+    gflags::FlagSaver flag_saver;
+    FLAGS_spill_dir = kSpillDir;
+    FLAGS_spill_run_outputs = 5000;
+    std::vector<Network> result = ExtendNetwork(
+        n, networks, symmetric, false, std::numeric_limits<int>::max(), &gen);
+    EXPECT_EQ(Forms(result, symmetric), Forms(expected, symmetric))
+        << "symmetric=" << symmetric;
+  }
+}
+
+} // namespace
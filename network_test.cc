@@ -105,6 +105,23 @@ TEST(LayerTest, RoundTripProto) {
   EXPECT_TRUE(original == recovered);
 }
 
+TEST(NetworkTest, ToProtoReusesMessage) {
+  Network big(6, 3);
+  big.layers[0].matching[0] = 5;
+  big.layers[0].matching[5] = 0;
+  big.outputs = {1, 2, 3, 4};
+  Network small(4, 1);
+  small.layers[0].matching[1] = 2;
+  small.layers[0].matching[2] = 1;
+
+  pb::Network proto;
+  big.ToProto(&proto);
+  EXPECT_EQ(proto.SerializeAsString(), big.ToProto().SerializeAsString());
+  small.ToProto(&proto);
+  EXPECT_EQ(proto.SerializeAsString(), small.ToProto().SerializeAsString());
+  EXPECT_EQ(Network::FromProto(proto), small);
+}
+
 // Network Tests
 
 TEST(NetworkTest, Construction) {
@@ -1,26 +1,36 @@
 #include "network_utils.h"
 
 #include <algorithm>
-#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <format>
 #include <fstream>
+#include <iterator>
 #include <limits>
+#include <span>
 #include <sstream>
 #include <stddef.h>
-#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
 #include "glog/logging.h"
-#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/arena.h"
+#include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/text_format.h"
 
+#include "canonical_form.h"
+#include "compressed_file.h"
+#include "dominance_cache.h"
 #include "isomorphism.h"
 #include "network.h"
 #include "network.pb.h"
 #include "output_bitset.h"
 #include "output_type.h"
+#include "outputs_collection.h"
+#include "thread_pool.h"
 
 std::vector<OutputType> NetworkOutputs(const Network &network) {
   if (!network.outputs.empty()) {
@@ -39,6 +49,14 @@ std::vector<OutputType> NetworkOutputs(const Network &network) {
   return output_bitset.ToSparse();
 }
 
+int64_t NetworkOutputsBytes(int n, int depth) {
+  // The bitset of all the inputs, and the outputs, of which there are at most
+  // 3^(n/2) 2^(n%2) after the first layer.
+  double num_outputs =
+      depth == 0 ? std::ldexp(1.0, n) : std::pow(3.0, n / 2) * (1 << (n % 2));
+  return std::ldexp(1.0, n) / 8 + num_outputs * sizeof(OutputType);
+}
+
 std::vector<std::vector<OutputType>>
 NetworkOutputs(const std::vector<Network> &networks) {
   LOG(INFO) << "Computing outputs for " << networks.size() << " networks";
@@ -50,50 +68,61 @@ NetworkOutputs(const std::vector<Network> &networks) {
   return outputs;
 }
 
+LazyOutputs::LazyOutputs(std::vector<Network> *networks)
+    : networks_(networks), once_flags_(networks->size()) {}
+
+const std::vector<OutputType> &LazyOutputs::Get(int i) {
+  Network &network = networks_->at(i);
+  std::call_once(once_flags_[i], [&]() {
+    if (network.outputs.empty()) {
+      network.outputs = NetworkOutputs(network);
+    }
+  });
+  return network.outputs;
+}
+
+void LazyOutputs::Prefetch(int begin, int end) {
+  CHECK_LE(0, begin);
+  CHECK_LE(end, networks_->size());
+  for (int i = begin; i < end; i++) {
+    prefetch_group_.Run([this, i]() { Get(i); });
+  }
+}
+
 namespace {
 void FillOutputsInParallel(std::vector<Network> &networks,
                            int fill_outputs_if_size_is_smaller_than) {
   if (fill_outputs_if_size_is_smaller_than <= 0) {
     return;
   }
-  int num_threads = std::thread::hardware_concurrency();
-  if (num_threads == 0) {
-    num_threads = 4;
-  }
+  ThreadPool &pool = ThreadPool::Default();
   LOG(INFO) << "Filling " << networks.size() << " outputs in parallel with "
-            << num_threads << " threads";
-  std::vector<std::thread> threads;
-  std::atomic<int> next_network_idx(0);
-  for (int i = 0; i < num_threads; i++) {
-    threads.emplace_back([&]() {
-      while (true) {
-        int network_idx = next_network_idx.fetch_add(1);
-        if (network_idx >= networks.size()) {
-          break;
-        }
-        std::string message = std::format("Filling output for network {} / {}",
-                                          network_idx, networks.size());
-        if (networks.size() < 100) {
-          LOG(INFO) << message;
-        } else if (networks.size() < 1000) {
-          LOG_EVERY_N(INFO, 10) << message;
-        } else if (networks.size() < 10000) {
-          LOG_EVERY_N(INFO, 100) << message;
-        } else if (networks.size() < 100000) {
-          LOG_EVERY_N(INFO, 1000) << message;
-        } else {
-          LOG_EVERY_N(INFO, 10000) << message;
-        }
-        std::vector<OutputType> outputs = NetworkOutputs(networks[network_idx]);
-        if (outputs.size() < fill_outputs_if_size_is_smaller_than) {
-          networks[network_idx].outputs = std::move(outputs);
-        }
-      }
-    });
-  }
-  for (auto &thread : threads) {
-    thread.join();
-  }
+            << pool.num_threads() << " threads";
+  ParallelFor(0, networks.size(), [&](int network_idx) {
+    std::string message = std::format("Filling output for network {} / {}",
+                                      network_idx, networks.size());
+    if (networks.size() < 100) {
+      LOG(INFO) << message;
+    } else if (networks.size() < 1000) {
+      LOG_EVERY_N(INFO, 10) << message;
+    } else if (networks.size() < 10000) {
+      LOG_EVERY_N(INFO, 100) << message;
+    } else if (networks.size() < 100000) {
+      LOG_EVERY_N(INFO, 1000) << message;
+    } else {
+      LOG_EVERY_N(INFO, 10000) << message;
+    }
+    const Network &network = networks[network_idx];
+    // Only the computation is covered: the outputs that are kept are loaded
+    // with the networks.
+    MemoryBudget::Reservation reservation = MemoryBudget::Default().Reserve(
+        NetworkOutputsBytes(network.n, network.layers.size()));
+    std::vector<OutputType> outputs = NetworkOutputs(network);
+    if (outputs.size() < fill_outputs_if_size_is_smaller_than) {
+      networks[network_idx].outputs = std::move(outputs);
+    }
+  });
+  MemoryBudget::Default().LogAdmissionDelay("Filling outputs");
 }
 } // namespace
 
@@ -222,36 +251,194 @@ void SaveToBracketFile(const std::vector<Network> &networks,
   file.close();
 }
 
-std::vector<Network> LoadFromProtoFile(const std::string &filename, int n) {
-  pb::NetworkCollection network_collection_proto;
-  if (filename.ends_with(".txt")) {
-    // text format
-    std::ifstream file(filename);
-    CHECK(file.is_open());
-    google::protobuf::io::IstreamInputStream zero_copy_stream(&file);
-    CHECK(google::protobuf::TextFormat::Parse(&zero_copy_stream,
-                                              &network_collection_proto));
-  } else {
-    // binary format
-    std::ifstream file(filename, std::ios::binary);
-    CHECK(file.is_open());
-    CHECK(network_collection_proto.ParseFromIstream(&file));
+namespace {
+// The tag of NetworkCollection.network: field 1, length-delimited.
+constexpr uint32_t kNetworkTag =
+    (pb::NetworkCollection::kNetworkFieldNumber << 3) | 2;
+// A CodedInputStream refuses to read more than 2 GiB, so a new one is started
+// after this many bytes.
+constexpr int kBytesPerCodedStream = 1 << 30;
+} // namespace
+
+NetworkProtoReader::NetworkProtoReader(const std::string &filename)
+    : input_stream_(OpenInputFile(filename)),
+      network_proto_(google::protobuf::Arena::Create<pb::Network>(&arena_)) {
+  CHECK(!StripCompressionExtension(filename).ends_with(".txt"))
+      << "Only binary files can be read one network at a time: " << filename;
+}
+
+NetworkProtoReader::~NetworkProtoReader() = default;
+
+const pb::Network *NetworkProtoReader::NextProto() {
+  if (done_) {
+    return nullptr;
+  }
+  if (coded_stream_ == nullptr ||
+      coded_stream_->CurrentPosition() >= kBytesPerCodedStream) {
+    coded_stream_.reset();
+    coded_stream_ = std::make_unique<google::protobuf::io::CodedInputStream>(
+        input_stream_.get());
+  }
+  uint32_t tag = coded_stream_->ReadTag();
+  if (tag == 0) {
+    CHECK(coded_stream_->ConsumedEntireMessage()) << "Corrupted proto file";
+    done_ = true;
+    return nullptr;
+  }
+  CHECK_EQ(tag, kNetworkTag) << "Unexpected field in NetworkCollection";
+  uint32_t length = 0;
+  CHECK(coded_stream_->ReadVarint32(&length));
+  auto limit = coded_stream_->PushLimit(length);
+  network_proto_->Clear();
+  CHECK(network_proto_->MergeFromCodedStream(coded_stream_.get()));
+  CHECK_EQ(coded_stream_->BytesUntilLimit(), 0);
+  coded_stream_->PopLimit(limit);
+  return network_proto_;
+}
+
+bool NetworkProtoReader::Next(Network *network) {
+  const pb::Network *network_proto = NextProto();
+  if (network_proto == nullptr) {
+    return false;
   }
+  *network = Network::FromProto(*network_proto);
+  return true;
+}
+
+namespace {
+
+// Loads a single proto file without filling the outputs.
+std::vector<Network> LoadNetworksFromFile(const std::string &filename, int n) {
   std::vector<Network> networks;
-  bool has_outputs = true;
-  for (const auto &network_proto : network_collection_proto.network()) {
+  auto add_network = [&](const pb::Network &network_proto) {
     if (n == 0) {
       n = network_proto.n();
     } else {
       CHECK_EQ(network_proto.n(), n);
     }
-    Network network = Network::FromProto(network_proto);
-    if (network.outputs.empty()) {
-      has_outputs = false;
+    networks.push_back(Network::FromProto(network_proto));
+  };
+  if (StripCompressionExtension(filename).ends_with(".txt")) {
+    // text format
+    auto input_stream = OpenInputFile(filename);
+    google::protobuf::Arena arena;
+    auto *network_collection_proto =
+        google::protobuf::Arena::Create<pb::NetworkCollection>(&arena);
+    CHECK(google::protobuf::TextFormat::Parse(input_stream.get(),
+                                              network_collection_proto));
+    for (const auto &network_proto : network_collection_proto->network()) {
+      add_network(network_proto);
+    }
+  } else {
+    // binary format
+    NetworkProtoReader reader(filename);
+    while (const pb::Network *network_proto = reader.NextProto()) {
+      add_network(*network_proto);
+    }
+  }
+  return networks;
+}
+
+// Saves networks to a single proto file.
+void SaveNetworksToFile(std::span<const Network> networks,
+                        const std::string &filename) {
+  std::string uncompressed_filename = StripCompressionExtension(filename);
+  if (uncompressed_filename.ends_with(".txt")) {
+    // text format
+    pb::NetworkCollection network_collection_proto;
+    for (const auto &network : networks) {
+      network.ToProto(network_collection_proto.add_network());
+    }
+    auto output_stream = OpenOutputFile(filename);
+    CHECK(google::protobuf::TextFormat::Print(network_collection_proto,
+                                              output_stream.get()));
+  } else if (uncompressed_filename.ends_with(".pb")) {
+    // binary format, written one network at a time through a reused message.
+    // The bytes are the same as those of the serialized NetworkCollection.
+    auto output_stream = OpenOutputFile(filename);
+    google::protobuf::io::CodedOutputStream coded_stream(output_stream.get());
+    pb::Network network_proto;
+    for (const auto &network : networks) {
+      network.ToProto(&network_proto);
+      coded_stream.WriteTag(kNetworkTag);
+      coded_stream.WriteVarint32(network_proto.ByteSizeLong());
+      network_proto.SerializeWithCachedSizes(&coded_stream);
+    }
+    CHECK(!coded_stream.HadError())
+        << std::format("Failed to write file: {}", filename);
+  } else {
+    LOG(FATAL) << "Unsupported file extension: " << filename;
+  }
+}
+
+constexpr char kShardsSuffix[] = ".shards";
+constexpr char kManifestFilename[] = "manifest.txt";
+constexpr char kShardPrefix[] = "shard-";
+// Collections are only split if each shard gets at least this many networks.
+constexpr int kMinNetworksPerShard = 4096;
+
+bool IsSharded(const std::string &filename) {
+  return filename.ends_with(kShardsSuffix);
+}
+
+std::string ShardPath(const std::string &dirname, const std::string &filename) {
+  return (std::filesystem::path(dirname) / filename).string();
+}
+
+// Returns the file extension of the shards, e.g. ".pb.zst" for
+// "n28d6.pb.zst.shards".
+std::string ShardExtension(const std::string &dirname) {
+  std::string name =
+      dirname.substr(0, dirname.size() - std::strlen(kShardsSuffix));
+  std::string uncompressed_name = StripCompressionExtension(name);
+  std::string compression_extension = name.substr(uncompressed_name.size());
+  for (const std::string extension : {".pb", ".txt"}) {
+    if (uncompressed_name.ends_with(extension)) {
+      return extension + compression_extension;
     }
-    networks.push_back(std::move(network));
   }
-  if (!has_outputs) {
+  LOG(FATAL) << "Unsupported file extension: " << dirname;
+  return "";
+}
+
+std::vector<Network> LoadShards(const std::string &dirname, int n) {
+  pb::ShardManifest manifest;
+  {
+    auto input_stream = OpenInputFile(ShardPath(dirname, kManifestFilename));
+    CHECK(google::protobuf::TextFormat::Parse(input_stream.get(), &manifest))
+        << std::format("Failed to read the manifest of {}", dirname);
+  }
+  std::vector<std::vector<Network>> shards(manifest.shard_size());
+  ParallelFor(0, manifest.shard_size(), [&](int i) {
+    const pb::ShardManifest::Shard &shard = manifest.shard(i);
+    shards[i] = LoadNetworksFromFile(ShardPath(dirname, shard.filename()), n);
+    CHECK_EQ(shards[i].size(), shard.num_networks())
+        << std::format("Wrong number of networks in {}", shard.filename());
+  });
+  std::vector<Network> networks;
+  networks.reserve(manifest.num_networks());
+  for (auto &shard : shards) {
+    std::move(shard.begin(), shard.end(), std::back_inserter(networks));
+  }
+  CHECK_EQ(networks.size(), manifest.num_networks());
+  for (const auto &network : networks) {
+    CHECK_EQ(network.n, networks.front().n);
+  }
+  LOG(INFO) << std::format("Loaded {} networks from {} shards in {}",
+                           networks.size(), shards.size(), dirname);
+  return networks;
+}
+} // namespace
+
+std::vector<Network> LoadFromProtoFile(const std::string &filename, int n,
+                                       bool fill_outputs) {
+  std::vector<Network> networks = IsSharded(filename)
+                                      ? LoadShards(filename, n)
+                                      : LoadNetworksFromFile(filename, n);
+  bool has_outputs = std::all_of(
+      networks.begin(), networks.end(),
+      [](const Network &network) { return !network.outputs.empty(); });
+  if (!has_outputs && fill_outputs) {
     LOG(INFO) << "outputs field is missing. Creating mask library and filling "
                  "outputs in parallel...";
     FillOutputsInParallel(networks, std::numeric_limits<int>::max());
@@ -261,55 +448,178 @@ std::vector<Network> LoadFromProtoFile(const std::string &filename, int n) {
 
 void SaveToProtoFile(const std::vector<Network> &networks,
                      const std::string &filename) {
-  pb::NetworkCollection network_collection_proto;
-  for (const auto &network : networks) {
-    *network_collection_proto.add_network() = network.ToProto();
-  }
-  if (filename.ends_with(".txt")) {
-    // text format
-    std::ofstream file(filename);
-    CHECK(file.is_open());
-    google::protobuf::io::OstreamOutputStream output_stream(&file);
-    CHECK(google::protobuf::TextFormat::Print(network_collection_proto,
-                                              &output_stream));
-  } else if (filename.ends_with(".pb")) {
-    // binary format
-    std::ofstream file(filename, std::ios::binary);
-    CHECK(file.is_open());
-    CHECK(network_collection_proto.SerializeToOstream(&file));
+  if (IsSharded(filename)) {
+    int num_shards =
+        std::clamp<int>(networks.size() / kMinNetworksPerShard, 1,
+                        ThreadPool::Default().num_threads());
+    SaveToShardedProtoFile(networks, filename, num_shards);
   } else {
-    LOG(FATAL) << "Unsupported file extension: " << filename;
+    SaveNetworksToFile(networks, filename);
   }
 }
 
+void SaveToShardedProtoFile(const std::vector<Network> &networks,
+                            const std::string &dirname, int num_shards) {
+  CHECK(IsSharded(dirname))
+      << std::format("{} does not end with {}", dirname, kShardsSuffix);
+  CHECK_GT(num_shards, 0);
+  std::string extension = ShardExtension(dirname);
+  // Remove the manifest first, so that an interrupted save does not leave a
+  // manifest describing a mix of old and new shards.
+  std::filesystem::create_directories(dirname);
+  std::filesystem::remove(ShardPath(dirname, kManifestFilename));
+  for (const auto &entry : std::filesystem::directory_iterator(dirname)) {
+    if (entry.path().filename().string().starts_with(kShardPrefix)) {
+      std::filesystem::remove(entry.path());
+    }
+  }
+
+  // Shard i holds networks [begin(i), begin(i + 1)), so that the global order
+  // is the shard order.
+  auto begin = [&](int i) {
+    return static_cast<int64_t>(networks.size()) * i / num_shards;
+  };
+  pb::ShardManifest manifest;
+  manifest.set_num_networks(networks.size());
+  for (int i = 0; i < num_shards; i++) {
+    pb::ShardManifest::Shard *shard = manifest.add_shard();
+    shard->set_filename(std::format("{}{:05}{}", kShardPrefix, i, extension));
+    shard->set_num_networks(begin(i + 1) - begin(i));
+  }
+  ParallelFor(0, num_shards, [&](int i) {
+    SaveNetworksToFile(
+        std::span<const Network>(networks).subspan(begin(i),
+                                                   begin(i + 1) - begin(i)),
+        ShardPath(dirname, manifest.shard(i).filename()));
+  });
+  auto output_stream = OpenOutputFile(ShardPath(dirname, kManifestFilename));
+  CHECK(google::protobuf::TextFormat::Print(manifest, output_stream.get()));
+}
+
 std::vector<Network> RemoveRedundantNetworks(std::vector<Network> networks,
                                              bool symmetric, bool fast,
                                              std::mt19937 *gen) {
   if (networks.size() <= 1) {
     return networks;
   }
-  std::sort(networks.begin(), networks.end(),
-            [](const Network &a, const Network &b) {
-              return a.outputs.size() < b.outputs.size();
-            });
+  // A stable sort, so that the networks of the same size keep their order, and
+  // the result does not depend on the sort implementation.
+  std::stable_sort(networks.begin(), networks.end(),
+                   [](const Network &a, const Network &b) {
+                     return a.outputs.size() < b.outputs.size();
+                   });
   int n = networks.front().n;
-  std::vector<std::vector<OutputType>> outputs = NetworkOutputs(networks);
-  std::vector<bool> is_redundant =
-      FindRedundantOutputs(n, outputs, fast, symmetric, gen);
+  // The outputs are moved to one flat collection and given back to the
+  // networks that are kept, so that there is about one copy of them at a time
+  // (the pages of the reserved collection are only touched as it is filled).
+  size_t num_outputs = 0;
+  for (const Network &network : networks) {
+    num_outputs += network.outputs.size();
+  }
+  OutputsCollection outputs;
+  outputs.Reserve(networks.size(), num_outputs);
+  for (Network &network : networks) {
+    if (network.outputs.empty()) {
+      outputs.Add(NetworkOutputs(network));
+    } else {
+      outputs.Add(network.outputs);
+      std::vector<OutputType>().swap(network.outputs);
+    }
+  }
+  std::vector<bool> is_redundant = FindRedundantOutputs(
+      n, &outputs, fast, symmetric, gen, &DominanceCache::Default());
   CHECK_EQ(is_redundant.size(), networks.size());
   std::vector<Network> non_redundant_networks;
   for (int i = 0; i < networks.size(); i++) {
     if (!is_redundant[i]) {
+      networks[i].outputs.assign(outputs[i].begin(), outputs[i].end());
       non_redundant_networks.push_back(std::move(networks[i]));
     }
   }
-  std::sort(non_redundant_networks.begin(), non_redundant_networks.end(),
-            [](const Network &a, const Network &b) {
-              return a.outputs.size() < b.outputs.size();
-            });
   return non_redundant_networks;
 }
 
+std::vector<Network> RemoveIsomorphicNetworks(std::vector<Network> networks,
+                                              bool symmetric) {
+  if (networks.size() <= 1) {
+    return networks;
+  }
+  int n = networks.front().n;
+  // The forms are recomputed when needed rather than kept, since they would
+  // be a second copy of all the outputs.
+  auto form = [&](const Network &network) {
+    if (network.outputs.empty()) {
+      return CanonicalFormUpToInverse(n, NetworkOutputs(network), symmetric);
+    }
+    return CanonicalFormUpToInverse(n, network.outputs, symmetric);
+  };
+  std::vector<uint64_t> hashes(networks.size());
+  ParallelFor(0, networks.size(),
+              [&](int i) { hashes[i] = HashOutputs(form(networks[i])); });
+  // The later networks of a hash are almost always isomorphic to its first
+  // one. They are checked in parallel by first network, so that the form of
+  // each first network is computed once.
+  std::unordered_map<uint64_t, int> first_by_hash;
+  std::vector<std::pair<int, int>> ties; // (first, later)
+  for (int i = 0; i < networks.size(); i++) {
+    auto [it, inserted] = first_by_hash.emplace(hashes[i], i);
+    if (!inserted) {
+      ties.emplace_back(it->second, i);
+    }
+  }
+  first_by_hash.clear();
+  std::sort(ties.begin(), ties.end());
+  std::vector<int> group_begins;
+  for (int k = 0; k < ties.size(); k++) {
+    if (k == 0 || ties[k].first != ties[k - 1].first) {
+      group_begins.push_back(k);
+    }
+  }
+  group_begins.push_back(ties.size());
+  enum Tie : uint8_t { kFirst, kIsomorphic, kCollision };
+  std::vector<Tie> tie(networks.size(), kFirst);
+  ParallelFor(0, group_begins.size() - 1, [&](int g) {
+    const Network &first = networks[ties[group_begins[g]].first];
+    std::vector<OutputType> first_form;
+    for (int k = group_begins[g]; k < group_begins[g + 1]; k++) {
+      const Network &network = networks[ties[k].second];
+      bool is_isomorphic =
+          !network.outputs.empty() && network.outputs == first.outputs;
+      if (!is_isomorphic) {
+        if (first_form.empty()) {
+          first_form = form(first);
+        }
+        is_isomorphic = form(network) == first_form;
+      }
+      tie[ties[k].second] = is_isomorphic ? kIsomorphic : kCollision;
+    }
+  });
+  std::vector<std::pair<int, int>>().swap(ties);
+  // The networks of a collision of the hashes are compared to the other
+  // networks of their hash that were kept.
+  std::unordered_multimap<uint64_t, int> collisions;
+  std::vector<Network> unique_networks;
+  for (int i = 0; i < networks.size(); i++) {
+    if (tie[i] == kIsomorphic) {
+      continue;
+    }
+    if (tie[i] == kCollision) {
+      std::vector<OutputType> form_i = form(networks[i]);
+      auto [begin, end] = collisions.equal_range(hashes[i]);
+      if (std::any_of(begin, end, [&](const auto &entry) {
+            return form(unique_networks[entry.second]) == form_i;
+          })) {
+        continue;
+      }
+      collisions.emplace(hashes[i], unique_networks.size());
+    }
+    unique_networks.push_back(std::move(networks[i]));
+  }
+  LOG(INFO) << "Removed " << networks.size() - unique_networks.size()
+            << " networks with isomorphic outputs";
+  return unique_networks;
+}
+
 std::vector<Network> CreateFirstLayer(int n, bool symmetric) {
   if (symmetric) {
     CHECK_EQ(n % 2, 0);
@@ -1,17 +1,54 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <string>
 #include <vector>
 
+#include "google/protobuf/arena.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+
 #include "network.h"
+#include "network.pb.h"
 #include "output_type.h"
+#include "thread_pool.h"
 
 std::vector<OutputType> NetworkOutputs(const Network &network);
 
 std::vector<std::vector<OutputType>>
 NetworkOutputs(const std::vector<Network> &networks);
 
+// An estimate of the memory that NetworkOutputs uses for a network with n
+// channels and depth layers, for the memory budget.
+int64_t NetworkOutputsBytes(int n, int depth);
+
+// Fills the missing outputs of a collection of networks on demand.
+// The outputs of each network are computed at most once: either on the first
+// Get(), or in the background on the thread pool after Prefetch().
+class LazyOutputs {
+public:
+  // networks must outlive this object and must not be resized while it exists.
+  explicit LazyOutputs(std::vector<Network> *networks);
+  // Waits for the pending prefetches.
+  ~LazyOutputs() = default;
+
+  // Returns the outputs of (*networks)[i], computing them if necessary.
+  // It is thread-safe and blocks if another thread is computing them.
+  const std::vector<OutputType> &Get(int i);
+  // Starts computing the outputs of (*networks)[begin, end) in the background.
+  void Prefetch(int begin, int end);
+
+private:
+  std::vector<Network> *networks_ = nullptr;
+  std::vector<std::once_flag> once_flags_;
+  // Declared last so that it waits for the prefetches before the other
+  // members are destroyed.
+  TaskGroup prefetch_group_;
+};
+
 // A network in bracket format is like this:
 // [(0,2),(1,3)],[(0,1),(2,3)],[(1,2)]
 // A bracket file is a file that contains multiple networks in bracket format,
@@ -22,12 +59,61 @@ std::vector<Network> LoadFromBracketFile(int n, const std::string &filename,
 void SaveToBracketFile(const std::vector<Network> &networks,
                        const std::string &filename);
 
-std::vector<Network> LoadFromProtoFile(const std::string &filename, int n = 0);
+// A proto file is a NetworkCollection in binary (.pb) or text (.txt) format,
+// optionally compressed by gzip (.gz) or zstd (.zst), e.g. "n28d6.pb.zst".
+// A name ending with .shards, e.g. "n28d6.pb.zst.shards", is a directory of
+// shards in that format and a manifest (pb::ShardManifest). The shards are
+// saved and loaded in parallel and keep the order of the networks.
+//
+// If fill_outputs is false, the networks without outputs in the file are
+// returned with empty outputs, which can be filled on demand by LazyOutputs.
+std::vector<Network> LoadFromProtoFile(const std::string &filename, int n = 0,
+                                       bool fill_outputs = true);
 void SaveToProtoFile(const std::vector<Network> &networks,
                      const std::string &filename);
 
+// Reads the networks of a binary proto file (not a .shards directory) one at a
+// time, so that the whole collection is never held in memory. All networks are
+// parsed into the same arena-allocated message: Clear() keeps the allocated
+// layers and repeated fields, so a parse allocates nothing once the message
+// has grown to the largest network (allocating a message per network is ~10x
+// slower).
+class NetworkProtoReader {
+public:
+  explicit NetworkProtoReader(const std::string &filename);
+  ~NetworkProtoReader();
+
+  // Returns the next network, valid until the next call, or null at the end of
+  // the file.
+  const pb::Network *NextProto();
+  // The same, converted. Returns false at the end of the file.
+  bool Next(Network *network);
+
+private:
+  std::unique_ptr<google::protobuf::io::ZeroCopyInputStream> input_stream_;
+  // A CodedInputStream refuses to read more than 2 GiB, so it is replaced
+  // periodically.
+  std::unique_ptr<google::protobuf::io::CodedInputStream> coded_stream_;
+  google::protobuf::Arena arena_;
+  pb::Network *network_proto_ = nullptr;
+  bool done_ = false;
+};
+
+// Saves to a .shards directory with the given number of shards, replacing the
+// existing shards. SaveToProtoFile picks the number of shards by the number of
+// networks and threads.
+void SaveToShardedProtoFile(const std::vector<Network> &networks,
+                            const std::string &dirname, int num_shards);
+
 std::vector<Network> RemoveRedundantNetworks(std::vector<Network> networks,
                                              bool symmetric, bool fast,
                                              std::mt19937 *gen);
 
+// Keeps the first network of each class of networks whose outputs are
+// isomorphic (up to inversion), comparing the canonical forms of the outputs.
+// The removed networks are a subset of the ones RemoveRedundantNetworks would
+// remove, and it is much cheaper, so it runs first on large collections.
+std::vector<Network> RemoveIsomorphicNetworks(std::vector<Network> networks,
+                                              bool symmetric);
+
 std::vector<Network> CreateFirstLayer(int n, bool symmetric);
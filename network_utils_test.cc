@@ -1,6 +1,9 @@
 #include "network_utils.h"
 
+#include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <sstream>
 
 #include "gtest/gtest.h"
 
@@ -193,6 +196,77 @@ TEST(ProtoFileIOTest, SaveAndLoadBinaryFormat) {
   EXPECT_EQ(loaded_networks[0].layers[1].matching[1], 3);
 }
 
+TEST(ProtoFileIOTest, SaveAndLoadCompressedFormats) {
+  std::vector<Network> original_networks = CreateFirstLayer(8, true);
+  for (const std::string filename :
+       {"/tmp/test_network.pb.gz", "/tmp/test_network.pb.zst",
+        "/tmp/test_network.txt.gz"}) {
+    SaveToProtoFile(original_networks, filename);
+    std::vector<Network> loaded_networks = LoadFromProtoFile(filename);
+    ASSERT_EQ(loaded_networks.size(), original_networks.size()) << filename;
+    for (int i = 0; i < loaded_networks.size(); i++) {
+      EXPECT_EQ(loaded_networks[i].ToProto().SerializeAsString(),
+                original_networks[i].ToProto().SerializeAsString())
+          << filename << " i=" << i;
+    }
+  }
+}
+
+TEST(ProtoFileIOTest, BinaryFormatIsNetworkCollection) {
+  std::string filename = "/tmp/test_network_collection.pb";
+  std::vector<Network> original_networks = CreateFirstLayer(8, true);
+  original_networks[1].outputs.clear();
+  SaveToProtoFile(original_networks, filename);
+
+  pb::NetworkCollection network_collection_proto;
+  for (const auto &network : original_networks) {
+    *network_collection_proto.add_network() = network.ToProto();
+  }
+  std::ifstream file(filename, std::ios::binary);
+  std::stringstream ss;
+  ss << file.rdbuf();
+  EXPECT_EQ(ss.str(), network_collection_proto.SerializeAsString());
+
+  std::vector<Network> loaded_networks =
+      LoadFromProtoFile(filename, 8, /*fill_outputs=*/false);
+  EXPECT_EQ(loaded_networks, original_networks);
+}
+
+TEST(ProtoFileIOTest, ShardedFormat) {
+  std::vector<Network> original_networks;
+  for (int i = 0; i < 10; i++) {
+    Network network(4, 1);
+    network.layers[0].matching[i % 3] = 3;
+    network.layers[0].matching[3] = i % 3;
+    network.outputs = {static_cast<OutputType>(i)};
+    original_networks.push_back(std::move(network));
+  }
+  for (const std::string dirname :
+       {"/tmp/test_network.pb.shards", "/tmp/test_network.pb.zst.shards",
+        "/tmp/test_network.txt.shards"}) {
+    std::filesystem::remove_all(dirname);
+    SaveToShardedProtoFile(original_networks, dirname, 3);
+    EXPECT_TRUE(std::filesystem::exists(dirname + "/manifest.txt"));
+    EXPECT_EQ(LoadFromProtoFile(dirname), original_networks) << dirname;
+
+    // Resaving with fewer shards removes the stale ones.
+    SaveToShardedProtoFile(original_networks, dirname, 2);
+    int num_files = std::distance(std::filesystem::directory_iterator(dirname),
+                                  std::filesystem::directory_iterator());
+    EXPECT_EQ(num_files, 3) << dirname;
+    EXPECT_EQ(LoadFromProtoFile(dirname), original_networks) << dirname;
+  }
+
+  // More shards than networks.
+  std::string dirname = "/tmp/test_network_small.pb.shards";
+  std::vector<Network> small(original_networks.begin(),
+                             original_networks.begin() + 2);
+  SaveToShardedProtoFile(small, dirname, 4);
+  EXPECT_EQ(LoadFromProtoFile(dirname), small);
+  SaveToProtoFile(original_networks, dirname);
+  EXPECT_EQ(LoadFromProtoFile(dirname), original_networks);
+}
+
 TEST(ProtoFileIOTest, LoadWithNFilter) {
   std::string filename = "/tmp/test_network_filter.txt";
 
@@ -211,6 +285,73 @@ TEST(ProtoFileIOTest, LoadWithNFilter) {
   EXPECT_EQ(loaded_networks[0].n, 3);
 }
 
+TEST(ProtoFileIOTest, LoadWithoutFillingOutputs) {
+  std::string filename = "/tmp/test_network_no_outputs.pb";
+  std::vector<Network> original_networks = CreateFirstLayer(6, true);
+  std::vector<std::vector<OutputType>> expected_outputs =
+      NetworkOutputs(original_networks);
+  for (Network &network : original_networks) {
+    network.outputs.clear();
+  }
+  SaveToProtoFile(original_networks, filename);
+
+  std::vector<Network> loaded_networks = LoadFromProtoFile(filename, 6, false);
+  ASSERT_EQ(loaded_networks.size(), original_networks.size());
+  for (const Network &network : loaded_networks) {
+    EXPECT_TRUE(network.outputs.empty());
+  }
+
+  loaded_networks = LoadFromProtoFile(filename, 6);
+  ASSERT_EQ(loaded_networks.size(), original_networks.size());
+  for (int i = 0; i < loaded_networks.size(); i++) {
+    EXPECT_EQ(loaded_networks[i].outputs, expected_outputs[i]);
+  }
+}
+
+TEST(ProtoFileIOTest, ReadOneNetworkAtATime) {
+  std::vector<Network> original_networks = CreateFirstLayer(8, true);
+  for (const std::string filename :
+       {"/tmp/test_network_reader.pb", "/tmp/test_network_reader.pb.zst"}) {
+    SaveToProtoFile(original_networks, filename);
+    NetworkProtoReader reader(filename);
+    Network network(0, 0);
+    for (const Network &original_network : original_networks) {
+      ASSERT_TRUE(reader.Next(&network)) << filename;
+      EXPECT_EQ(network, original_network) << filename;
+    }
+    EXPECT_FALSE(reader.Next(&network)) << filename;
+    EXPECT_FALSE(reader.Next(&network)) << filename;
+  }
+}
+
+TEST(LazyOutputsTest, GetAndPrefetch) {
+  std::vector<Network> networks = CreateFirstLayer(8, true);
+  std::vector<std::vector<OutputType>> expected_outputs =
+      NetworkOutputs(networks);
+  for (Network &network : networks) {
+    network.outputs.clear();
+  }
+  {
+    LazyOutputs lazy_outputs(&networks);
+    EXPECT_EQ(lazy_outputs.Get(1), expected_outputs[1]);
+    EXPECT_TRUE(networks[0].outputs.empty());
+    lazy_outputs.Prefetch(0, networks.size());
+    for (int i = networks.size() - 1; i >= 0; i--) {
+      EXPECT_EQ(lazy_outputs.Get(i), expected_outputs[i]) << "i=" << i;
+    }
+  }
+  for (int i = 0; i < networks.size(); i++) {
+    EXPECT_EQ(networks[i].outputs, expected_outputs[i]) << "i=" << i;
+  }
+}
+
+TEST(LazyOutputsTest, KeepsExistingOutputs) {
+  std::vector<Network> networks = CreateFirstLayer(4, false);
+  networks[0].outputs = {0, 1, 2}; // fake outputs
+  LazyOutputs lazy_outputs(&networks);
+  EXPECT_EQ(lazy_outputs.Get(0), (std::vector<OutputType>{0, 1, 2}));
+}
+
 TEST(CreateFirstLayerTest, Symmetric2) {
   std::vector<Network> networks = CreateFirstLayer(2, true);
   ASSERT_EQ(networks.size(), 1);
@@ -267,3 +408,37 @@ TEST(CreateFirstLayerTest, NonSymmetric4) {
   EXPECT_EQ(layer.matching[2], 3);
   EXPECT_EQ(layer.matching[3], 2);
 }
+
+TEST(RemoveIsomorphicNetworksTest, KeepsTheFirstOfEachClass) {
+  auto make_network = [](const std::vector<Comparator> &comparators) {
+    Network network(4, 1);
+    for (const Comparator &comparator : comparators) {
+      network.AddComparator(comparator);
+    }
+    network.outputs = NetworkOutputs(network);
+    return network;
+  };
+  std::vector<Network> networks = {
+      make_network({Comparator(0, 1)}),
+      make_network({Comparator(2, 3)}),
+      make_network({Comparator(0, 1), Comparator(2, 3)}),
+      make_network({Comparator(0, 2), Comparator(1, 3)}),
+      make_network({Comparator(1, 2)}),
+  };
+  std::vector<Network> unique_networks =
+      RemoveIsomorphicNetworks(networks, false);
+  ASSERT_EQ(unique_networks.size(), 2);
+  EXPECT_EQ(unique_networks[0], networks[0]);
+  EXPECT_EQ(unique_networks[1], networks[2]);
+
+  // With the reflection, (0, 1) and (1, 2) are not isomorphic.
+  unique_networks = RemoveIsomorphicNetworks(networks, true);
+  ASSERT_EQ(unique_networks.size(), 3);
+  EXPECT_EQ(unique_networks[2], networks[4]);
+
+  // The outputs are computed when they are not stored.
+  for (Network &network : networks) {
+    network.outputs.clear();
+  }
+  EXPECT_EQ(RemoveIsomorphicNetworks(networks, false).size(), 2);
+}
@@ -35,17 +35,23 @@ int main(int argc, char *argv[]) {
   CHECK(!FLAGS_output_path.empty());
 
   std::mt19937 gen;
-  std::vector<Network> networks = LoadFromProtoFile(FLAGS_input_path, FLAGS_n);
+  std::vector<Network> networks =
+      LoadFromProtoFile(FLAGS_input_path, FLAGS_n, /*fill_outputs=*/false);
 
   if (networks.size() > FLAGS_limit) {
     LOG(INFO) << "Limiting networks to " << FLAGS_limit;
     networks.erase(networks.begin() + FLAGS_limit, networks.end());
   }
+  // Compute the missing outputs on the thread pool while the networks are
+  // optimized one by one.
+  LazyOutputs lazy_outputs(&networks);
+  lazy_outputs.Prefetch(0, networks.size());
 
   std::vector<std::vector<int>> permutations;
   for (int network_idx = 0; network_idx < networks.size(); network_idx++) {
     std::cout << "Processing network " << network_idx << "/" << networks.size()
               << '\r' << std::flush;
+    lazy_outputs.Get(network_idx);
     Network &network = networks[network_idx];
     if (FLAGS_symmetric) {
       CHECK(IsSymmetric(FLAGS_n, network.outputs));
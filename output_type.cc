@@ -4,6 +4,8 @@
 
 #include <algorithm>
 
+#include "sorted_set.h"
+
 std::string ToBinaryString(int n, OutputType x) {
   std::string s;
   s.reserve(n);
@@ -20,26 +22,7 @@ void WindowSizeStats(int n, const std::vector<OutputType> &outputs,
   int sum_sqr_window_size = 0;
   int max_window_size = 0;
   for (OutputType x : outputs) {
-    // Count leading zeros (already sorted low values)
-    int num_leading_0s = 0;
-    for (int i = 0; i < n; i++) {
-      if (!(x & (OutputType(1) << i))) {
-        num_leading_0s++;
-      } else {
-        break;
-      }
-    }
-    // Count trailing ones (already sorted high values)
-    int num_trailing_1s = 0;
-    for (int i = n - 1; i >= 0; i--) {
-      if (x & (OutputType(1) << i)) {
-        num_trailing_1s++;
-      } else {
-        break;
-      }
-    }
-    // Window size is the middle unsorted region
-    int window_size = n - num_leading_0s - num_trailing_1s;
+    int window_size = WindowSize(n, x);
     sum_window_size += window_size;
     sum_sqr_window_size += window_size * window_size;
     if (window_size > max_window_size) {
@@ -83,11 +66,11 @@ OutputType ReflectAndInvert(int n, OutputType x) {
 }
 
 // Check if a set is symmetric under the permutation (0,n-1), (1,n-2), ...
-bool IsSymmetric(int n, const std::vector<OutputType> &set) {
+bool IsSymmetric(int n, std::span<const OutputType> set) {
   CHECK(std::is_sorted(set.begin(), set.end()));
   for (OutputType x : set) {
     OutputType rev_inv = ReflectAndInvert(n, x);
-    if (!std::binary_search(set.begin(), set.end(), rev_inv)) {
+    if (!SortedContains(set, rev_inv)) {
       return false;
     }
   }
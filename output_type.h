@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
 #include <cstdint>
+#include <limits>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -12,6 +16,15 @@ using OutputType = uint32_t;
 // Converts an OutputType to a binary string representation of length n.
 std::string ToBinaryString(int n, OutputType x);
 
+// Returns the window size of an output: the number of channels between the
+// leading zeros and trailing ones.
+inline int WindowSize(int n, OutputType x) {
+  constexpr int kBits = std::numeric_limits<OutputType>::digits;
+  int num_leading_0s = std::min(std::countr_zero(x), n);
+  int num_trailing_1s = std::countl_one(OutputType(x << (kBits - n)));
+  return n - num_leading_0s - num_trailing_1s;
+}
+
 // Computes window size statistics for a set of outputs.
 // The window size for an output is the number of channels between the
 // leading zeros and trailing ones.
@@ -31,7 +44,7 @@ OutputType ReflectAndInvert(int n, OutputType x);
 // Checks if a set of outputs is symmetric under channel reflection and
 // inversion. A set is symmetric if for every output x, ReflectAndInvert(n, x)
 // is also in the set.
-bool IsSymmetric(int n, const std::vector<OutputType> &set);
+bool IsSymmetric(int n, std::span<const OutputType> set);
 
 // Checks if there exists an output where channel i has value 1 and channel j
 // has value 0 for i < j.
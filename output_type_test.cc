@@ -78,6 +78,16 @@ TEST(WindowSizeStats, Basic) {
   EXPECT_EQ(max_window_size, 3);
 }
 
+TEST(WindowSize, Basic) {
+  EXPECT_EQ(WindowSize(3, 0b000), 0);
+  EXPECT_EQ(WindowSize(3, 0b110), 0);
+  EXPECT_EQ(WindowSize(3, 0b111), 0);
+  EXPECT_EQ(WindowSize(3, 0b010), 2);
+  EXPECT_EQ(WindowSize(3, 0b001), 3);
+  EXPECT_EQ(WindowSize(6, 0b110010), 3);
+  EXPECT_EQ(WindowSize(32, 0xffff0001), 16);
+}
+
 TEST(WindowSizeStats, NullPointers) {
   // Test that null pointers don't cause crashes
   std::vector<OutputType> outputs = {0b010, 0b101};
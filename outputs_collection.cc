@@ -0,0 +1,55 @@
+#include "outputs_collection.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "glog/logging.h"
+
+OutputsCollection::OutputsCollection(
+    const std::vector<std::vector<OutputType>> &sets) {
+  size_t num_outputs = 0;
+  for (const auto &set : sets) {
+    num_outputs += set.size();
+  }
+  Reserve(sets.size(), num_outputs);
+  for (const auto &set : sets) {
+    Add(set);
+  }
+}
+
+void OutputsCollection::Reserve(size_t num_sets, size_t num_outputs) {
+  offsets_.reserve(num_sets + 1);
+  outputs_.reserve(num_outputs);
+}
+
+void OutputsCollection::Add(std::span<const OutputType> set) {
+  outputs_.insert(outputs_.end(), set.begin(), set.end());
+  offsets_.push_back(outputs_.size());
+}
+
+void OutputsCollection::Remove(const std::vector<bool> &removed) {
+  CHECK_EQ(removed.size(), size());
+  size_t num_sets = 0;
+  int64_t end = 0;
+  for (size_t i = 0; i < size(); i++) {
+    if (removed[i]) {
+      continue;
+    }
+    std::span<const OutputType> set = (*this)[i];
+    // The sets only move down, so the copy never overwrites a later set.
+    std::copy(set.begin(), set.end(), outputs_.begin() + end);
+    end += set.size();
+    offsets_[++num_sets] = end;
+  }
+  outputs_.resize(end);
+  offsets_.resize(num_sets + 1);
+}
+
+std::vector<std::vector<OutputType>> OutputsCollection::ToVectors() const {
+  std::vector<std::vector<OutputType>> sets;
+  sets.reserve(size());
+  for (size_t i = 0; i < size(); i++) {
+    sets.emplace_back((*this)[i].begin(), (*this)[i].end());
+  }
+  return sets;
+}
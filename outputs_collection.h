@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "output_type.h"
+
+// A collection of sets of outputs stored back to back in one array, and
+// addressed by index. Unlike a vector of vectors, it takes one allocation for
+// all the sets, and the sets can be permuted and sorted in place.
+class OutputsCollection {
+public:
+  OutputsCollection() = default;
+  explicit OutputsCollection(const std::vector<std::vector<OutputType>> &sets);
+
+  // Reserves room for num_sets sets of num_outputs outputs in total.
+  void Reserve(size_t num_sets, size_t num_outputs);
+  // Appends a copy of set.
+  void Add(std::span<const OutputType> set);
+  // Removes the sets i with removed[i], moving the others down in place.
+  void Remove(const std::vector<bool> &removed);
+
+  size_t size() const { return offsets_.size() - 1; }
+  bool empty() const { return size() == 0; }
+  // The total number of outputs of the sets.
+  size_t num_outputs() const { return outputs_.size(); }
+
+  std::span<const OutputType> operator[](size_t i) const {
+    return {outputs_.data() + offsets_[i], outputs_.data() + offsets_[i + 1]};
+  }
+  // The set i, which can be modified in place but not resized.
+  std::span<OutputType> Mutable(size_t i) {
+    return {outputs_.data() + offsets_[i], outputs_.data() + offsets_[i + 1]};
+  }
+
+  std::vector<std::vector<OutputType>> ToVectors() const;
+
+private:
+  std::vector<OutputType> outputs_;
+  // The set i is outputs_[offsets_[i], offsets_[i + 1]).
+  std::vector<int64_t> offsets_ = {0};
+};
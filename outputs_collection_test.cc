@@ -0,0 +1,50 @@
+#include "outputs_collection.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "output_type.h"
+
+namespace {
+
+TEST(OutputsCollectionTest, AddAndGet) {
+  std::vector<std::vector<OutputType>> sets = {{1, 2, 3}, {}, {5}, {0, 7}};
+  OutputsCollection collection(sets);
+  ASSERT_EQ(collection.size(), 4);
+  EXPECT_EQ(collection.num_outputs(), 6);
+  for (int i = 0; i < sets.size(); i++) {
+    EXPECT_TRUE(std::ranges::equal(collection[i], sets[i])) << i;
+  }
+  EXPECT_EQ(collection.ToVectors(), sets);
+
+  collection.Add(std::vector<OutputType>{4, 6});
+  ASSERT_EQ(collection.size(), 5);
+  EXPECT_TRUE(
+      std::ranges::equal(collection[4], std::vector<OutputType>{4, 6}));
+  EXPECT_TRUE(OutputsCollection().empty());
+}
+
+TEST(OutputsCollectionTest, Mutable) {
+  OutputsCollection collection({{1, 2, 3}, {4, 5}});
+  std::span<OutputType> set = collection.Mutable(0);
+  std::reverse(set.begin(), set.end());
+  EXPECT_TRUE(
+      std::ranges::equal(collection[0], std::vector<OutputType>{3, 2, 1}));
+  EXPECT_TRUE(
+      std::ranges::equal(collection[1], std::vector<OutputType>{4, 5}));
+}
+
+TEST(OutputsCollectionTest, Remove) {
+  OutputsCollection collection({{1, 2, 3}, {}, {5}, {0, 7}, {6}});
+  collection.Remove({true, false, false, true, false});
+  EXPECT_EQ(collection.ToVectors(),
+            (std::vector<std::vector<OutputType>>{{}, {5}, {6}}));
+  collection.Add(std::vector<OutputType>{8, 9});
+  EXPECT_EQ(collection.num_outputs(), 4);
+  collection.Remove(std::vector<bool>(4, true));
+  EXPECT_TRUE(collection.empty());
+}
+
+} // namespace
@@ -0,0 +1,135 @@
+import argparse
+import os
+import shutil
+import subprocess
+import time
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Times the README pipeline with uncompressed and compressed "
+        "network collections."
+    )
+    parser.add_argument("--bin_dir", type=str, default="bazel-bin")
+    parser.add_argument("--output_dir", type=str, default="generated/benchmark")
+    parser.add_argument(
+        "--formats",
+        type=str,
+        default="pb,pb.gz,pb.zst",
+        help="Comma-separated file extensions of the network collections",
+    )
+    parser.add_argument(
+        "--limit", type=int, default=8, help="The number of CNF files to generate"
+    )
+    parser.add_argument(
+        "--repeat", type=int, default=1, help="Run the pipeline this many times"
+    )
+    return parser.parse_args()
+
+
+def pipeline_steps(args, ext):
+    """Returns the README steps up to the CNF generation and the CNF directory.
+
+    The steps are (name, command) pairs.
+    """
+
+    def path(name):
+        return os.path.join(args.output_dir, f"{name}.{ext}")
+
+    def binary(name):
+        return os.path.join(args.bin_dir, name)
+
+    cnf_dir = os.path.join(args.output_dir, f"cnf_{ext.replace('.', '_')}")
+    return [
+        (
+            "add_layers n12",
+            [binary("add_layers_main"), "--n", "12", "--symmetric"]
+            + ["--input_depth", "1", "--output_depth", "5"]
+            + ["--output_path", path("n12d5"), "--keep_best_count", ",,,4"],
+        ),
+        (
+            "add_layers n16",
+            [binary("add_layers_main"), "--n", "16", "--symmetric"]
+            + ["--input_depth", "1", "--output_depth", "5"]
+            + ["--output_path", path("n16d5"), "--keep_best_count", "1,1,1,1"],
+        ),
+        (
+            "stack",
+            [binary("stack_main"), "--symmetric"]
+            + ["--n_a", "12", "--input_path_a", path("n12d5")]
+            + ["--n_b", "16", "--input_path_b", path("n16d5")]
+            + ["--output_path", path("n28d5")],
+        ),
+        (
+            "add_comparators",
+            [binary("add_comparators_main"), "--symmetric"]
+            + ["--input_path", path("n28d5"), "--output_path", path("n28d6")]
+            + ["--keep_best_count", "64"],
+        ),
+        (
+            "optimize_window_size",
+            [binary("optimize_window_size_main"), "--n", "28", "--symmetric"]
+            + ["--input_path", path("n28d6"), "--output_path", path("n28d6.opt")],
+        ),
+        (
+            "sat_generate_cnf",
+            [binary("sat_generate_cnf_main"), "--n", "28", "--symmetric"]
+            + ["--depth", "13", "--input_path", path("n28d6.opt")]
+            + ["--output_dir", cnf_dir, "--limit", str(args.limit)],
+        ),
+    ], cnf_dir
+
+
+def run_pipeline(args, ext):
+    """Runs the pipeline once. Returns the wall time of each step in seconds."""
+    steps, cnf_dir = pipeline_steps(args, ext)
+    # sat_generate_cnf_main asks before overwriting an existing directory.
+    shutil.rmtree(cnf_dir, ignore_errors=True)
+    times = {}
+    for name, command in steps:
+        time0 = time.time()
+        subprocess.run(command, check=True, capture_output=True)
+        times[name] = time.time() - time0
+    return times
+
+
+def collection_bytes(args, ext):
+    total = 0
+    for name in ["n12d5", "n16d5", "n28d5", "n28d6", "n28d6.opt"]:
+        total += os.path.getsize(os.path.join(args.output_dir, f"{name}.{ext}"))
+    return total
+
+
+def main():
+    args = parse_args()
+    os.makedirs(args.output_dir, exist_ok=True)
+    formats = args.formats.split(",")
+    results = {}
+    for ext in formats:
+        best = None
+        for _ in range(args.repeat):
+            times = run_pipeline(args, ext)
+            print(f"{ext}: {sum(times.values()):.2f}s")
+            if best is None or sum(times.values()) < sum(best.values()):
+                best = times
+        results[ext] = best
+
+    step_names = list(results[formats[0]].keys())
+    width = max(len(name) for name in step_names + ["collection bytes"])
+    print()
+    print(" " * width + "".join(f"{ext:>14}" for ext in formats))
+    for name in step_names + ["total"]:
+        row = f"{name:<{width}}"
+        for ext in formats:
+            times = results[ext]
+            seconds = sum(times.values()) if name == "total" else times[name]
+            row += f"{seconds:>13.2f}s"
+        print(row)
+    row = f"{'collection bytes':<{width}}"
+    for ext in formats:
+        row += f"{collection_bytes(args, ext):>14}"
+    print(row)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,272 @@
+#include "prefix_database.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <numeric>
+#include <random>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+#include "canonical_form.h"
+#include "compressed_file.h"
+#include "dominance_cache.h"
+#include "isomorphism.h"
+#include "network.pb.h"
+#include "network_utils.h"
+#include "output_type.h"
+#include "outputs_collection.h"
+#include "thread_pool.h"
+
+DEFINE_string(prefix_db, "",
+              "If not empty, add_layers_main keeps the non-redundant prefixes "
+              "of each depth in a database in this directory, and seeds the "
+              "later runs with them.");
+
+namespace {
+
+constexpr char kEntryFilename[] = "entry.pb";
+constexpr char kDominanceCacheFilename[] = "dominance_cache.pb";
+
+std::string Join(const std::string &dirname, const std::string &filename) {
+  return (std::filesystem::path(dirname) / filename).string();
+}
+
+// Reads the entry of a directory. Returns false if there is none.
+bool ReadEntry(const std::string &entry_dirname,
+               pb::PrefixDatabaseEntry *entry) {
+  std::string filename = Join(entry_dirname, kEntryFilename);
+  if (!std::filesystem::exists(filename)) {
+    return false;
+  }
+  auto input_stream = OpenInputFile(filename);
+  CHECK(entry->ParseFromZeroCopyStream(input_stream.get()))
+      << "Corrupted prefix database entry " << filename;
+  return true;
+}
+
+// The fingerprints of the outputs of the networks.
+std::vector<uint64_t> Fingerprints(const std::vector<Network> &networks,
+                                   bool symmetric) {
+  std::vector<uint64_t> fingerprints(networks.size());
+  ParallelFor(0, networks.size(), [&](int i) {
+    const Network &network = networks[i];
+    CHECK(!network.outputs.empty());
+    fingerprints[i] = HashOutputs(
+        CanonicalFormUpToInverse(network.n, network.outputs, symmetric));
+  });
+  return fingerprints;
+}
+
+} // namespace
+
+PrefixDatabase::PrefixDatabase(const std::string &dirname,
+                               const std::string &root)
+    : dirname_(dirname), root_(root) {
+  CHECK(!dirname_.empty());
+  std::filesystem::create_directories(dirname_);
+  std::string cache_filename = Join(dirname_, kDominanceCacheFilename);
+  if (std::filesystem::exists(cache_filename)) {
+    DominanceCache::Default().Load(cache_filename);
+  }
+}
+
+std::string PrefixDatabase::Root(const std::vector<Network> &inputs,
+                                 bool symmetric) {
+  CHECK(!inputs.empty());
+  int n = inputs.front().n;
+  int depth = inputs.front().layers.size();
+  std::vector<uint64_t> fingerprints = Fingerprints(inputs, symmetric);
+  std::sort(fingerprints.begin(), fingerprints.end());
+  fingerprints.erase(std::unique(fingerprints.begin(), fingerprints.end()),
+                     fingerprints.end());
+  if (depth == 1) {
+    // Only the first layer itself, up to isomorphism, is trusted to be
+    // complete.
+    std::vector<Network> first_layer = CreateFirstLayer(n, symmetric);
+    std::vector<uint64_t> first_layer_fingerprints =
+        Fingerprints(first_layer, symmetric);
+    std::sort(first_layer_fingerprints.begin(),
+              first_layer_fingerprints.end());
+    if (fingerprints == first_layer_fingerprints) {
+      return "";
+    }
+  }
+  // The fingerprints are hashed by halves, as a set of outputs.
+  std::vector<OutputType> halves;
+  for (uint64_t fingerprint : fingerprints) {
+    halves.push_back(fingerprint);
+    halves.push_back(fingerprint >> 32);
+  }
+  return std::format("in-d{}-{:016x}", depth, HashOutputs(halves));
+}
+
+std::string PrefixDatabase::EntryDirname(int n, int depth,
+                                         bool symmetric) const {
+  return Join(dirname_, std::format("n{}-d{}{}{}", n, depth,
+                                    symmetric ? "-sym" : "",
+                                    root_.empty() ? "" : "-" + root_));
+}
+
+PrefixDatabase::Entry PrefixDatabase::Load(int n, int depth,
+                                           bool symmetric) const {
+  Entry result;
+  std::string entry_dirname = EntryDirname(n, depth, symmetric);
+  pb::PrefixDatabaseEntry entry;
+  if (!ReadEntry(entry_dirname, &entry)) {
+    return result;
+  }
+  CHECK_EQ(entry.n(), n);
+  CHECK_EQ(entry.depth(), depth);
+  CHECK_EQ(entry.symmetric(), symmetric);
+  CHECK_EQ(entry.root(), root_);
+  result.networks =
+      LoadFromProtoFile(Join(entry_dirname, entry.networks()), n);
+  CHECK_EQ(result.networks.size(), entry.fingerprint_size());
+  result.complete = entry.complete();
+  LOG(INFO) << std::format("Loaded {} {}prefixes of depth {} from {}",
+                           result.networks.size(),
+                           result.complete ? "(all the) " : "", depth,
+                           entry_dirname);
+  return result;
+}
+
+void PrefixDatabase::Add(const std::vector<Network> &networks, bool symmetric,
+                         bool complete, bool merged) {
+  if (networks.empty()) {
+    return;
+  }
+  int n = networks.front().n;
+  int depth = networks.front().layers.size();
+  for (const Network &network : networks) {
+    CHECK_EQ(network.n, n);
+    CHECK_EQ(network.layers.size(), depth);
+  }
+  std::string entry_dirname = EntryDirname(n, depth, symmetric);
+  std::filesystem::create_directories(entry_dirname);
+  pb::PrefixDatabaseEntry entry;
+  bool has_entry = ReadEntry(entry_dirname, &entry);
+  std::vector<uint64_t> new_fingerprints = Fingerprints(networks, symmetric);
+  std::unordered_set<uint64_t> known(entry.fingerprint().begin(),
+                                     entry.fingerprint().end());
+
+  if (merged) {
+    // The networks replace the entry, whose networks are not even loaded.
+    int64_t num_new = 0;
+    for (uint64_t fingerprint : new_fingerprints) {
+      num_new += !known.contains(fingerprint);
+    }
+    int64_t num_removed = entry.fingerprint_size() + num_new - networks.size();
+    if (num_new == 0 && num_removed == 0 && (entry.complete() || !complete)) {
+      LOG(INFO) << "No new prefixes of depth " << depth << " for "
+                << entry_dirname;
+      return;
+    }
+    WriteEntry(entry_dirname, symmetric, entry, networks, new_fingerprints,
+               complete);
+    LOG(INFO) << std::format("Stored {} prefixes of depth {} in {}: {} new, "
+                             "{} redundant removed",
+                             networks.size(), depth, entry_dirname, num_new,
+                             num_removed);
+    return;
+  }
+
+  std::vector<Network> stored;
+  if (has_entry) {
+    stored = LoadFromProtoFile(Join(entry_dirname, entry.networks()), n);
+  }
+  std::vector<uint64_t> fingerprints(entry.fingerprint().begin(),
+                                     entry.fingerprint().end());
+  CHECK_EQ(fingerprints.size(), stored.size());
+
+  // The new prefixes isomorphic to a stored one (or to an earlier new one) are
+  // skipped. A collision of fingerprints only skips a prefix that could have
+  // been stored.
+  int64_t num_stored = stored.size();
+  for (int i = 0; i < networks.size(); i++) {
+    if (known.insert(new_fingerprints[i]).second) {
+      stored.push_back(networks[i]);
+      fingerprints.push_back(new_fingerprints[i]);
+    }
+  }
+  int64_t num_new = stored.size() - num_stored;
+  if (num_new == 0 && (entry.complete() || !complete)) {
+    LOG(INFO) << "No new prefixes of depth " << depth << " for "
+              << entry_dirname;
+    return;
+  }
+
+  // The redundant prefixes, by increasing number of outputs as in
+  // RemoveRedundantNetworks. The pairs of stored prefixes were checked by the
+  // previous updates, so they are mostly found in the dominance cache.
+  std::vector<int> order(stored.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int i, int j) {
+    return stored[i].outputs.size() < stored[j].outputs.size();
+  });
+  std::vector<bool> is_redundant(stored.size(), false);
+  if (num_new > 0) {
+    OutputsCollection outputs;
+    for (int i : order) {
+      outputs.Add(stored[i].outputs);
+    }
+    // A generator of its own, so that the database does not change the
+    // random choices of the run.
+    std::mt19937 gen(0);
+    is_redundant = FindRedundantOutputs(n, &outputs, false, symmetric, &gen,
+                                        &DominanceCache::Default());
+  }
+
+  std::vector<Network> kept;
+  std::vector<uint64_t> kept_fingerprints;
+  for (int k = 0; k < order.size(); k++) {
+    if (!is_redundant[k]) {
+      kept.push_back(std::move(stored[order[k]]));
+      kept_fingerprints.push_back(fingerprints[order[k]]);
+    }
+  }
+  WriteEntry(entry_dirname, symmetric, entry, kept, kept_fingerprints,
+             complete);
+  LOG(INFO) << std::format("Stored {} prefixes of depth {} in {}: {} new, {} "
+                           "redundant removed",
+                           kept.size(), depth, entry_dirname, num_new,
+                           stored.size() - kept.size());
+}
+
+void PrefixDatabase::WriteEntry(const std::string &entry_dirname,
+                                bool symmetric,
+                                const pb::PrefixDatabaseEntry &entry,
+                                const std::vector<Network> &networks,
+                                const std::vector<uint64_t> &fingerprints,
+                                bool complete) const {
+  CHECK_EQ(networks.size(), fingerprints.size());
+  pb::PrefixDatabaseEntry new_entry;
+  new_entry.set_n(networks.front().n);
+  new_entry.set_depth(networks.front().layers.size());
+  new_entry.set_symmetric(symmetric);
+  new_entry.set_root(root_);
+  new_entry.set_complete(entry.complete() || complete);
+  new_entry.set_generation(entry.generation() + 1);
+  new_entry.set_networks(
+      std::format("networks-{:04}.pb.shards", new_entry.generation()));
+  for (uint64_t fingerprint : fingerprints) {
+    new_entry.add_fingerprint(fingerprint);
+  }
+  SaveToProtoFile(networks, Join(entry_dirname, new_entry.networks()));
+  // The entry is written last and renamed, so that an interrupted update keeps
+  // the previous one.
+  std::string entry_filename = Join(entry_dirname, kEntryFilename);
+  {
+    auto output_stream = OpenOutputFile(entry_filename + ".tmp");
+    CHECK(new_entry.SerializeToZeroCopyStream(output_stream.get()));
+  }
+  std::filesystem::rename(entry_filename + ".tmp", entry_filename);
+  if (!entry.networks().empty()) {
+    std::filesystem::remove_all(Join(entry_dirname, entry.networks()));
+  }
+  DominanceCache::Default().Save(Join(dirname_, kDominanceCacheFilename));
+}
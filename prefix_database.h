@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "network.h"
+#include "network.pb.h"
+
+// The directory of the prefix database of add_layers_main.
+DECLARE_string(prefix_db);
+
+// A database on disk of the non-redundant prefixes found by the runs of
+// add_layers_main, by number of channels, depth, symmetry and root, so that a
+// run starts from the prefixes that the previous runs found instead of
+// rediscovering them. The root identifies the input prefixes of the runs (see
+// Root), and the runs from other inputs have entries of their own: a run is
+// only seeded with extensions of its own input.
+//
+// The entry of a depth holds the non-redundant prefixes found so far, none of
+// which is redundant with another one, with the fingerprints of their outputs
+// (the hashes of the canonical forms up to inversion), which identify the
+// prefixes up to isomorphism. The entry is complete if a run kept all the
+// non-redundant extensions of the input of the depth: the later runs then take
+// the prefixes of the depth from it instead of extending the ones of the
+// previous depth. The subset-isomorphism results are
+// kept in the dominance cache of the database, which is loaded into
+// DominanceCache::Default(), so that the prefixes made redundant by a stored
+// one are found again without a search.
+//
+// A database is used by one process at a time.
+class PrefixDatabase {
+public:
+  struct Entry {
+    std::vector<Network> networks;
+    bool complete = false;
+  };
+
+  // Creates dirname if needed, and loads its dominance cache. The entries are
+  // the ones of root.
+  explicit PrefixDatabase(const std::string &dirname,
+                          const std::string &root = "");
+
+  // Returns the root of the runs from the input prefixes, which is empty if
+  // they are the first layer (CreateFirstLayer) up to isomorphism, and
+  // otherwise made of the depth and of a hash of the fingerprints of the
+  // inputs, so that isomorphic inputs share their entries.
+  static std::string Root(const std::vector<Network> &inputs, bool symmetric);
+
+  // Returns the stored prefixes with their outputs, or an empty entry.
+  Entry Load(int n, int depth, bool symmetric) const;
+  // Merges prefixes of the same depth, with their outputs, into their entry:
+  // the ones isomorphic to a stored prefix are skipped, and the redundant ones
+  // among the stored and new prefixes are removed. complete tells whether the
+  // networks are all the non-redundant extensions of the input of their depth.
+  // If merged, the networks are already the non-redundant ones among the
+  // stored and new prefixes, e.g. all the networks kept by an exact CleanUp
+  // seeded with the entry, and they replace it without a redundancy check.
+  void Add(const std::vector<Network> &networks, bool symmetric, bool complete,
+           bool merged = false);
+
+private:
+  std::string EntryDirname(int n, int depth, bool symmetric) const;
+  // Replaces the entry of a directory by the networks and their fingerprints.
+  void WriteEntry(const std::string &entry_dirname, bool symmetric,
+                  const pb::PrefixDatabaseEntry &entry,
+                  const std::vector<Network> &networks,
+                  const std::vector<uint64_t> &fingerprints,
+                  bool complete) const;
+
+  std::string dirname_;
+  std::string root_;
+};
@@ -0,0 +1,118 @@
+#include "prefix_database.h"
+
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "clean_up.h"
+#include "network.h"
+#include "network_utils.h"
+#include "test_networks.h"
+
+namespace {
+
+constexpr char kDatabaseDir[] = "/tmp/test_prefix_database";
+
+TEST(PrefixDatabaseTest, MergesTheRuns) {
+  std::filesystem::remove_all(kDatabaseDir);
+  std::mt19937 gen(0);
+  int n = 7;
+  std::vector<Network> networks;
+  for (int i = 0; i < 200; i++) {
+    networks.push_back(RandomNetwork(n, 3, &gen));
+  }
+  std::vector<Network> expected =
+      CleanUp(RemoveIsomorphicNetworks(networks, false), false,
+              std::numeric_limits<int>::max(), &gen);
+
+  PrefixDatabase database(kDatabaseDir);
+  EXPECT_TRUE(database.Load(n, 3, false).networks.empty());
+  database.Add(std::vector<Network>(networks.begin(), networks.begin() + 100),
+               false, false);
+  database.Add(std::vector<Network>(networks.begin() + 50, networks.end()),
+               false, false);
+  PrefixDatabase::Entry entry = PrefixDatabase(kDatabaseDir).Load(n, 3, false);
+  EXPECT_EQ(Forms(entry.networks, false), Forms(expected, false));
+  EXPECT_FALSE(entry.complete);
+  for (const Network &network : entry.networks) {
+    EXPECT_EQ(network.outputs, NetworkOutputs(network));
+  }
+
+  // Adding known prefixes only changes whether the entry is complete.
+  database.Add(networks, false, true);
+  entry = database.Load(n, 3, false);
+  EXPECT_EQ(Forms(entry.networks, false), Forms(expected, false));
+  EXPECT_TRUE(entry.complete);
+  database.Add(networks, false, false);
+  EXPECT_TRUE(database.Load(n, 3, false).complete);
+
+  // The other depths and the symmetric networks have entries of their own.
+  EXPECT_TRUE(database.Load(n, 2, false).networks.empty());
+  EXPECT_TRUE(database.Load(n, 3, true).networks.empty());
+}
+
+// The networks cleaned up with the entry replace it.
+TEST(PrefixDatabaseTest, ReplacesTheEntryByMergedNetworks) {
+  std::filesystem::remove_all(kDatabaseDir);
+  std::mt19937 gen(0);
+  int n = 7;
+  std::vector<Network> networks;
+  for (int i = 0; i < 200; i++) {
+    networks.push_back(RandomNetwork(n, 3, &gen));
+  }
+  std::vector<Network> expected =
+      CleanUp(RemoveIsomorphicNetworks(networks, false), false,
+              std::numeric_limits<int>::max(), &gen);
+
+  PrefixDatabase database(kDatabaseDir);
+  database.Add(std::vector<Network>(networks.begin(), networks.begin() + 100),
+               false, false);
+  std::vector<Network> merged = database.Load(n, 3, false).networks;
+  merged.insert(merged.end(), networks.begin() + 100, networks.end());
+  merged = CleanUp(RemoveIsomorphicNetworks(std::move(merged), false), false,
+                   std::numeric_limits<int>::max(), &gen);
+  database.Add(merged, false, true, true);
+  PrefixDatabase::Entry entry = database.Load(n, 3, false);
+  EXPECT_EQ(Forms(entry.networks, false), Forms(expected, false));
+  EXPECT_TRUE(entry.complete);
+}
+
+TEST(PrefixDatabaseTest, KeepsTheRootsApart) {
+  std::filesystem::remove_all(kDatabaseDir);
+  std::mt19937 gen(0);
+  int n = 7;
+  std::vector<Network> inputs;
+  for (int i = 0; i < 20; i++) {
+    inputs.push_back(RandomNetwork(n, 2, &gen));
+  }
+  std::vector<Network> networks;
+  for (int i = 0; i < 20; i++) {
+    networks.push_back(RandomNetwork(n, 3, &gen));
+  }
+  // A depth-1 input only has the root of the first layer if it is the first
+  // layer.
+  std::vector<Network> first_layer = CreateFirstLayer(8, true);
+  EXPECT_EQ(PrefixDatabase::Root(first_layer, true), "");
+  first_layer.pop_back();
+  EXPECT_NE(PrefixDatabase::Root(first_layer, true), "");
+  std::string root = PrefixDatabase::Root(inputs, false);
+  EXPECT_FALSE(root.empty());
+  // The root only depends on the inputs up to isomorphism.
+  std::vector<Network> reversed(inputs.rbegin(), inputs.rend());
+  reversed.push_back(inputs.front());
+  EXPECT_EQ(PrefixDatabase::Root(reversed, false), root);
+  std::string other_root = PrefixDatabase::Root(
+      std::vector<Network>(inputs.begin(), inputs.begin() + 10), false);
+  EXPECT_NE(other_root, root);
+
+  PrefixDatabase(kDatabaseDir, root).Add(networks, false, true);
+  EXPECT_TRUE(PrefixDatabase(kDatabaseDir, root).Load(n, 3, false).complete);
+  PrefixDatabase other_database(kDatabaseDir, other_root);
+  EXPECT_TRUE(other_database.Load(n, 3, false).networks.empty());
+  EXPECT_TRUE(PrefixDatabase(kDatabaseDir).Load(n, 3, false).networks.empty());
+}
+
+} // namespace
@@ -0,0 +1,108 @@
+#include "redundancy_snapshot.h"
+
+#include <filesystem>
+#include <format>
+#include <span>
+
+#include "glog/logging.h"
+
+#include "compressed_file.h"
+#include "network.pb.h"
+#include "output_type.h"
+
+DEFINE_string(checkpoint_dir, "",
+              "If not empty, add_layers_main and add_comparators_main save the "
+              "networks before each step to this directory, and "
+              "FindRedundantOutputs saves its progress.");
+DEFINE_bool(resume, false,
+            "Restart from the newest checkpoint of --checkpoint_dir, and from "
+            "the saved progress of FindRedundantOutputs.");
+DEFINE_double(checkpoint_interval, 60,
+              "The minimum number of seconds between two saves of the "
+              "progress of FindRedundantOutputs.");
+
+namespace {
+
+uint64_t Mix(uint64_t hash, uint64_t value) {
+  // The finalizer of splitmix64 on the combined value.
+  uint64_t x = hash ^ (value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2));
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+} // namespace
+
+RedundancySnapshot::RedundancySnapshot(const std::string &dirname,
+                                       uint64_t fingerprint, int64_t size,
+                                       double interval)
+    : filename_((std::filesystem::path(dirname) /
+                 std::format("redundancy-{:016x}.pb", fingerprint))
+                    .string()),
+      fingerprint_(fingerprint), size_(size),
+      interval_(interval), last_save_(std::chrono::steady_clock::now()) {
+  std::filesystem::create_directories(dirname);
+}
+
+uint64_t
+RedundancySnapshot::Fingerprint(int n,
+                                const OutputsCollection &outputs_collection,
+                                bool fast, bool symmetric,
+                                int64_t num_non_redundant) {
+  uint64_t hash = Mix(n, (fast ? 1 : 0) | (symmetric ? 2 : 0));
+  hash = Mix(hash, num_non_redundant);
+  for (size_t i = 0; i < outputs_collection.size(); i++) {
+    std::span<const OutputType> set = outputs_collection[i];
+    hash = Mix(hash, set.size());
+    for (OutputType x : set) {
+      hash = Mix(hash, x);
+    }
+  }
+  return hash;
+}
+
+std::vector<RedundancySnapshot::State> RedundancySnapshot::Load() const {
+  std::vector<State> states(size_, kUnknown);
+  if (!std::filesystem::exists(filename_)) {
+    return states;
+  }
+  pb::RedundancySnapshot snapshot;
+  auto input_stream = OpenInputFile(filename_);
+  if (!snapshot.ParseFromZeroCopyStream(input_stream.get()) ||
+      snapshot.fingerprint() != fingerprint_ ||
+      snapshot.state().size() != size_) {
+    LOG(WARNING) << "Ignoring the corrupted redundancy snapshot " << filename_;
+    return states;
+  }
+  int64_t num_known = 0;
+  for (int64_t i = 0; i < size_; i++) {
+    states[i] = static_cast<State>(snapshot.state()[i]);
+    num_known += states[i] != kUnknown;
+  }
+  LOG(INFO) << std::format("Resumed the redundancy of {} of {} sets from {}",
+                           num_known, size_, filename_);
+  return states;
+}
+
+void RedundancySnapshot::MaybeSave(
+    const std::function<std::vector<State>()> &get_states) {
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock() ||
+      std::chrono::steady_clock::now() - last_save_ < interval_) {
+    return;
+  }
+  std::vector<State> states = get_states();
+  CHECK_EQ(states.size(), size_);
+  pb::RedundancySnapshot snapshot;
+  snapshot.set_fingerprint(fingerprint_);
+  snapshot.set_state(std::string(states.begin(), states.end()));
+  // Written to a temporary file and renamed, so that an interrupted save keeps
+  // the previous snapshot.
+  std::string tmp_filename = filename_ + ".tmp";
+  {
+    auto output_stream = OpenOutputFile(tmp_filename);
+    CHECK(snapshot.SerializeToZeroCopyStream(output_stream.get()));
+  }
+  std::filesystem::rename(tmp_filename, filename_);
+  last_save_ = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+#include "outputs_collection.h"
+
+// Where the long runs save their checkpoints, whether they resume from them,
+// and how often FindRedundantOutputs saves its progress.
+DECLARE_string(checkpoint_dir);
+DECLARE_bool(resume);
+DECLARE_double(checkpoint_interval);
+
+// The progress of FindRedundantOutputs on a collection of output sets, saved
+// to a file of the checkpoint directory every interval seconds at most, so
+// that a resumed run does not check the same sets again. The file is named
+// after a fingerprint of the collection and of the arguments, which a resumed
+// run finds again since it repeats the same steps from the last checkpoint.
+class RedundancySnapshot {
+public:
+  enum State : uint8_t {
+    kUnknown = 0,
+    kRedundant = 1,
+    // Checked by the exact pass.
+    kNotRedundant = 2,
+  };
+
+  RedundancySnapshot(const std::string &dirname, uint64_t fingerprint,
+                     int64_t size, double interval);
+
+  static uint64_t Fingerprint(int n,
+                              const OutputsCollection &outputs_collection,
+                              bool fast, bool symmetric,
+                              int64_t num_non_redundant);
+
+  // Returns the states of the saved snapshot, or kUnknown states if there is
+  // none.
+  std::vector<State> Load() const;
+  // Saves the states returned by get_states, unless the last save is more
+  // recent than the interval. It is thread-safe: a call returns at once while
+  // another one saves.
+  void MaybeSave(const std::function<std::vector<State>()> &get_states);
+
+private:
+  std::string filename_;
+  uint64_t fingerprint_;
+  int64_t size_;
+  std::chrono::duration<double> interval_;
+  std::mutex mutex_;
+  std::chrono::steady_clock::time_point last_save_;
+};
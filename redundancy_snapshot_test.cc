@@ -0,0 +1,71 @@
+#include "redundancy_snapshot.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "outputs_collection.h"
+
+namespace {
+
+constexpr char kCheckpointDir[] = "/tmp/test_redundancy_snapshot";
+
+TEST(RedundancySnapshotTest, SaveAndLoad) {
+  std::filesystem::remove_all(kCheckpointDir);
+  using State = RedundancySnapshot::State;
+  std::vector<State> states = {
+      RedundancySnapshot::kUnknown, RedundancySnapshot::kRedundant,
+      RedundancySnapshot::kNotRedundant, RedundancySnapshot::kRedundant};
+  RedundancySnapshot snapshot(kCheckpointDir, 42, states.size(), 0);
+  EXPECT_EQ(snapshot.Load(),
+            std::vector<State>(states.size(), RedundancySnapshot::kUnknown));
+  snapshot.MaybeSave([&]() { return states; });
+  EXPECT_EQ(snapshot.Load(), states);
+  EXPECT_EQ(RedundancySnapshot(kCheckpointDir, 42, states.size(), 0).Load(),
+            states);
+
+  // The snapshot of another collection is another file, and a corrupted one
+  // is ignored.
+  EXPECT_EQ(RedundancySnapshot(kCheckpointDir, 43, states.size(), 0).Load(),
+            std::vector<State>(states.size(), RedundancySnapshot::kUnknown));
+  for (const auto &entry :
+       std::filesystem::directory_iterator(kCheckpointDir)) {
+    std::ofstream(entry.path()) << "corrupted";
+  }
+  EXPECT_EQ(snapshot.Load(),
+            std::vector<State>(states.size(), RedundancySnapshot::kUnknown));
+}
+
+TEST(RedundancySnapshotTest, SavesAfterTheInterval) {
+  std::filesystem::remove_all(kCheckpointDir);
+  RedundancySnapshot snapshot(kCheckpointDir, 42, 1, 3600);
+  int num_calls = 0;
+  snapshot.MaybeSave([&]() {
+    num_calls++;
+    return std::vector<RedundancySnapshot::State>(1);
+  });
+  EXPECT_EQ(num_calls, 0);
+  EXPECT_TRUE(std::filesystem::is_empty(kCheckpointDir));
+}
+
+TEST(RedundancySnapshotTest, Fingerprint) {
+  OutputsCollection collection({{1, 2}, {3, 5, 6}});
+  uint64_t fingerprint =
+      RedundancySnapshot::Fingerprint(3, collection, false, false, 0);
+  EXPECT_EQ(RedundancySnapshot::Fingerprint(3, collection, false, false, 0),
+            fingerprint);
+  EXPECT_NE(RedundancySnapshot::Fingerprint(3, collection, true, false, 0),
+            fingerprint);
+  EXPECT_NE(RedundancySnapshot::Fingerprint(3, collection, false, true, 0),
+            fingerprint);
+  EXPECT_NE(RedundancySnapshot::Fingerprint(3, collection, false, false, 1),
+            fingerprint);
+  EXPECT_NE(RedundancySnapshot::Fingerprint(
+                3, OutputsCollection({{1}, {2, 3, 5, 6}}), false, false, 0),
+            fingerprint);
+}
+
+} // namespace
@@ -1,12 +1,10 @@
 #include <algorithm>
-#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <format>
-#include <fstream>
 #include <iostream>
 #include <string>
-#include <thread>
 #include <vector>
 
 #include "gflags/gflags.h"
@@ -16,13 +14,12 @@
 #include "network.h"
 #include "network_utils.h"
 #include "output_type.h"
+#include "thread_pool.h"
 
 DEFINE_int32(n, 0, "Number of channels");
 DEFINE_int32(depth, 0, "The depth of the network, including the prefix");
 DEFINE_string(input_path, "", "The input prefixes file");
 DEFINE_string(output_dir, "", "The output directory");
-DEFINE_int32(jobs, std::thread::hardware_concurrency(),
-             "Number of parallel jobs");
 DEFINE_int32(subnet_channels, -1,
              "The number of channels in the subnet (-1 = no limit)");
 DEFINE_int32(limit, -1, "The number of networks to generate (-1 = all)");
@@ -46,6 +43,15 @@ Formula AImpliesBeqCAndD(Literal a, Literal b, Literal c, Literal d) {
                       Clause::Or(!a, b, !c, !d));
 }
 
+// An estimate of the memory of the formula of a suffix of d layers for a prefix
+// with num_outputs outputs: three clauses of three or four literals (with the
+// overhead of their allocation) per output, layer and pair of channels.
+int64_t FormulaBytes(int n, int d, size_t num_outputs) {
+  constexpr int64_t kClauseBytes = sizeof(Clause) + 4 * sizeof(Literal) + 16;
+  return static_cast<int64_t>(num_outputs) * d * n * (n - 1) * 3 *
+         kClauseBytes;
+}
+
 // Build the formula for the network suffix.
 // d: the depth of the network, not including the prefix.
 Formula BuildFormula(int n, int d, const Network &network_prefix,
@@ -402,12 +408,13 @@ int main(int argc, char *argv[]) {
   if (pb_file.empty()) {
     pb_file = std::format("pb/n{}.pb.txt", FLAGS_n);
   }
-  std::ifstream in(pb_file);
-  if (!in.is_open()) {
+  if (!std::filesystem::exists(pb_file)) {
     LOG(FATAL) << "Failed to open file: " << pb_file;
   }
 
-  std::vector<Network> network_prefixes = LoadFromProtoFile(pb_file, FLAGS_n);
+  // The outputs are only computed for the prefixes within --limit.
+  std::vector<Network> network_prefixes =
+      LoadFromProtoFile(pb_file, FLAGS_n, /*fill_outputs=*/false);
   std::cout << "Loaded " << network_prefixes.size() << " network prefixes from "
             << pb_file << std::endl;
   CHECK(!network_prefixes.empty());
@@ -420,7 +427,7 @@ int main(int argc, char *argv[]) {
   }
 
   std::cout << std::format("Using {} CPU cores for parallel processing",
-                           FLAGS_jobs)
+                           ThreadPool::Default().num_threads())
             << std::endl;
 
   int prefix_count = network_prefixes.size();
@@ -429,36 +436,31 @@ int main(int argc, char *argv[]) {
   }
 
   // Process network prefixes in parallel
-  std::atomic<int> next_prefix_idx(0);
-
-  auto worker_lambda = [&]() {
-    while (true) {
-      int current_idx = next_prefix_idx.fetch_add(1);
-      if (current_idx >= prefix_count) {
-        break;
-      }
-
-      double build_time =
-          GenerateCnf(FLAGS_n, FLAGS_depth - num_layers, current_idx,
-                      network_prefixes[current_idx], cnf_dir,
-                      FLAGS_subnet_channels, FLAGS_symmetric);
-
-      std::cout << std::format("{}/{}. build_time: {} seconds    \r",
-                               current_idx, prefix_count, build_time)
-                << std::flush;
-    }
-  };
-
-  std::vector<std::thread> workers;
-  for (int i = 0; i < FLAGS_jobs; ++i) {
-    workers.emplace_back(worker_lambda);
-  }
-
-  // Wait for all workers to complete
-  for (auto &worker : workers) {
-    worker.join();
-  }
+  LazyOutputs lazy_outputs(&network_prefixes);
+  ParallelFor(0, prefix_count, [&](int current_idx) {
+    // The outputs are reserved with the formula, and released with it at the
+    // end of the task. The reservation of their computation is released before
+    // the formula is reserved, so that a task never waits while it holds a
+    // reservation: only the outputs of the waiting tasks are not covered.
+    MemoryBudget::Reservation reservation = MemoryBudget::Default().Reserve(
+        NetworkOutputsBytes(FLAGS_n, num_layers));
+    const std::vector<OutputType> &outputs = lazy_outputs.Get(current_idx);
+    reservation.Release();
+    reservation = MemoryBudget::Default().Reserve(
+        outputs.size() * sizeof(OutputType) +
+        FormulaBytes(FLAGS_n, FLAGS_depth - num_layers, outputs.size()));
+    double build_time =
+        GenerateCnf(FLAGS_n, FLAGS_depth - num_layers, current_idx,
+                    network_prefixes[current_idx], cnf_dir,
+                    FLAGS_subnet_channels, FLAGS_symmetric);
+    std::vector<OutputType>().swap(network_prefixes[current_idx].outputs);
+
+    std::cout << std::format("{}/{}. build_time: {} seconds    \r",
+                             current_idx, prefix_count, build_time)
+              << std::flush;
+  });
   std::cout << std::endl;
+  MemoryBudget::Default().LogAdmissionDelay("Generating the formulas");
   std::cout << "The results are in " << cnf_dir << std::endl;
 
   auto end_time = std::chrono::high_resolution_clock::now();
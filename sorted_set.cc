@@ -0,0 +1,253 @@
+#include "sorted_set.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// The number of elements compared at a time.
+constexpr size_t kBlockSize = 8;
+// b is searched by galloping when it is this many times larger than a.
+constexpr size_t kGallopRatio = 16;
+
+// Returns the number of elements of block[0..kBlockSize) that are less than x.
+inline size_t CountLess(const uint32_t *block, uint32_t x) {
+#if defined(__AVX2__)
+  // There is no unsigned comparison, so both sides are shifted to signed.
+  const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+  __m256i xs = _mm256_xor_si256(_mm256_set1_epi32(x), bias);
+  __m256i v = _mm256_xor_si256(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block)), bias);
+  __m256i less = _mm256_cmpgt_epi32(xs, v);
+  return std::popcount(
+      unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(less))));
+#elif defined(__SSE2__)
+  const __m128i bias = _mm_set1_epi32(INT32_MIN);
+  __m128i xs = _mm_xor_si128(_mm_set1_epi32(x), bias);
+  __m128i v0 = _mm_xor_si128(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(block)), bias);
+  __m128i v1 = _mm_xor_si128(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 4)), bias);
+  int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(xs, v0))) |
+             _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(xs, v1))) << 4;
+  return std::popcount(unsigned(mask));
+#elif defined(__ARM_NEON)
+  uint32x4_t xs = vdupq_n_u32(x);
+  uint32x4_t less0 = vshrq_n_u32(vcltq_u32(vld1q_u32(block), xs), 31);
+  uint32x4_t less1 = vshrq_n_u32(vcltq_u32(vld1q_u32(block + 4), xs), 31);
+  return vaddvq_u32(vaddq_u32(less0, less1));
+#else
+  size_t count = 0;
+  for (size_t k = 0; k < kBlockSize; k++) {
+    count += block[k] < x;
+  }
+  return count;
+#endif
+}
+
+// Returns the first position p >= begin with b[p] >= x, scanning blocks.
+inline size_t ScanLowerBound(std::span<const uint32_t> b, size_t begin,
+                             uint32_t x) {
+  size_t p = begin;
+  // Output sets are dense, so the element is often the next one.
+  if (p == b.size() || b[p] >= x) {
+    return p;
+  }
+  while (p + kBlockSize <= b.size() && b[p + kBlockSize - 1] < x) {
+    p += kBlockSize;
+  }
+  if (p + kBlockSize <= b.size()) {
+    return p + CountLess(&b[p], x);
+  }
+  while (p < b.size() && b[p] < x) {
+    p++;
+  }
+  return p;
+}
+
+// Returns the first position p >= begin with b[p] >= x, galloping.
+inline size_t GallopLowerBound(std::span<const uint32_t> b, size_t begin,
+                               uint32_t x) {
+  size_t step = kBlockSize;
+  while (begin + step <= b.size() && b[begin + step - 1] < x) {
+    begin += step;
+    step *= 2;
+  }
+  size_t end = std::min(begin + step, b.size());
+  return std::lower_bound(b.begin() + begin, b.begin() + end, x) - b.begin();
+}
+
+// Calls body(lower_bound) with the search that suits the sizes of a and b.
+// The two searches are lambdas so that body is instantiated (and inlined) for
+// each of them.
+template <typename Body>
+inline auto WithLowerBound(std::span<const uint32_t> a,
+                           std::span<const uint32_t> b, Body body) {
+  if (b.size() >= kGallopRatio * a.size()) {
+    return body([](std::span<const uint32_t> b, size_t begin, uint32_t x) {
+      return GallopLowerBound(b, begin, x);
+    });
+  }
+  return body([](std::span<const uint32_t> b, size_t begin, uint32_t x) {
+    return ScanLowerBound(b, begin, x);
+  });
+}
+
+} // namespace
+
+bool SortedIsSubset(std::span<const uint32_t> a, std::span<const uint32_t> b) {
+  if (a.empty()) {
+    return true;
+  }
+  if (a.size() > b.size()) {
+    return false;
+  }
+  return WithLowerBound(a, b, [&](auto lower_bound) {
+    size_t i = 0;
+    size_t p = 0;
+    while (i < a.size()) {
+      if (p == b.size() || a[i] < b[p]) {
+        return false;
+      }
+      if (a[i] == b[p]) {
+        i++;
+        p++;
+      } else {
+        p = lower_bound(b, p + 1, a[i]);
+      }
+    }
+    return true;
+  });
+}
+
+bool SortedContains(std::span<const uint32_t> set, uint32_t x) {
+  // Branchless binary search down to one block.
+  const uint32_t *base = set.data();
+  size_t size = set.size();
+  while (size > kBlockSize) {
+    size_t half = size / 2;
+    base = base[half - 1] < x ? base + half : base;
+    size -= half;
+  }
+  size_t p = base - set.data();
+  if (set.size() >= kBlockSize) {
+    // The lower bound is in [p, p + kBlockSize].
+    p = std::min(p, set.size() - kBlockSize);
+    p += CountLess(&set[p], x);
+  } else {
+    p = ScanLowerBound(set, p, x);
+  }
+  return p < set.size() && set[p] == x;
+}
+
+size_t SortedIntersectionSize(std::span<const uint32_t> a,
+                              std::span<const uint32_t> b) {
+  if (a.size() > b.size()) {
+    std::swap(a, b);
+  }
+  size_t count = 0;
+  size_t i = 0;
+  size_t j = 0;
+  if (b.size() >= kGallopRatio * a.size()) {
+    for (uint32_t x : a) {
+      j = GallopLowerBound(b, j, x);
+      if (j == b.size()) {
+        break;
+      }
+      count += b[j] == x;
+    }
+    return count;
+  }
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  // Compare all pairs of two blocks of 4 by rotating one of them, then advance
+  // the block with the smaller last element.
+  while (i + 4 <= a.size() && j + 4 <= b.size()) {
+#if defined(__SSE2__)
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&a[i]));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&b[j]));
+    __m128i eq = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                     _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+        _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4e)),
+                     _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+    count += std::popcount(unsigned(_mm_movemask_ps(_mm_castsi128_ps(eq))));
+#else
+    uint32x4_t va = vld1q_u32(&a[i]);
+    uint32x4_t vb = vld1q_u32(&b[j]);
+    uint32x4_t eq =
+        vorrq_u32(vorrq_u32(vceqq_u32(va, vb),
+                            vceqq_u32(va, vextq_u32(vb, vb, 1))),
+                  vorrq_u32(vceqq_u32(va, vextq_u32(vb, vb, 2)),
+                            vceqq_u32(va, vextq_u32(vb, vb, 3))));
+    count += vaddvq_u32(vshrq_n_u32(eq, 31));
+#endif
+    uint32_t a_max = a[i + 3];
+    uint32_t b_max = b[j + 3];
+    i += a_max <= b_max ? 4 : 0;
+    j += b_max <= a_max ? 4 : 0;
+  }
+#endif
+  while (i < a.size() && j < b.size()) {
+    if (a[i] < b[j]) {
+      i++;
+    } else if (b[j] < a[i]) {
+      j++;
+    } else {
+      count++;
+      i++;
+      j++;
+    }
+  }
+  return count;
+}
+
+std::vector<uint32_t> SortedDifference(std::span<const uint32_t> a,
+                                       std::span<const uint32_t> b) {
+  std::vector<uint32_t> result;
+  result.reserve(a.size());
+  WithLowerBound(a, b, [&](auto lower_bound) {
+    size_t p = 0;
+    for (uint32_t x : a) {
+      p = lower_bound(b, p, x);
+      if (p < b.size() && b[p] == x) {
+        p++;
+      } else {
+        result.push_back(x);
+      }
+    }
+    return 0;
+  });
+  return result;
+}
+
+std::vector<uint32_t> SortedMergeUnique(std::span<const uint32_t> a,
+                                        std::span<const uint32_t> b) {
+  std::vector<uint32_t> result;
+  result.reserve(a.size() + b.size());
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.size() || j < b.size()) {
+    uint32_t x;
+    if (j == b.size() || (i < a.size() && a[i] <= b[j])) {
+      x = a[i++];
+    } else {
+      x = b[j++];
+    }
+    if (result.empty() || result.back() != x) {
+      result.push_back(x);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Operations on sorted arrays of uint32_t, such as sets of outputs.
+//
+// The scans compare blocks of 8 elements at a time with SSE2 or AVX2 on x86-64
+// and NEON on ARM, and fall back to scalar code elsewhere. When one array is
+// much smaller than the other, the larger one is searched by galloping
+// (exponential search) instead of being scanned.
+
+// Returns true if every element of a appears in b, at least as many times as
+// in a, i.e. std::includes(b, a). It returns at the first missing element.
+bool SortedIsSubset(std::span<const uint32_t> a, std::span<const uint32_t> b);
+
+// Returns true if x is in the sorted array.
+bool SortedContains(std::span<const uint32_t> set, uint32_t x);
+
+// Returns the number of common elements of two strictly increasing arrays.
+size_t SortedIntersectionSize(std::span<const uint32_t> a,
+                              std::span<const uint32_t> b);
+
+// Returns the elements of a that are not in b, i.e. std::set_difference.
+std::vector<uint32_t> SortedDifference(std::span<const uint32_t> a,
+                                       std::span<const uint32_t> b);
+
+// Returns the strictly increasing union of a and b.
+std::vector<uint32_t> SortedMergeUnique(std::span<const uint32_t> a,
+                                        std::span<const uint32_t> b);
@@ -0,0 +1,182 @@
+/*
+Compare the sorted-set operations of sorted_set.h with the standard algorithms
+on the output sets of real prefixes.
+
+The output sets are sorted by weight (as in the passes of
+FindRedundantOutputs), and random pairs of them are tested for inclusion, as
+whole sets and as projections to the first channels (as in the backtracking).
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "isomorphism.h"
+#include "network.h"
+#include "network_utils.h"
+#include "output_type.h"
+#include "sorted_set.h"
+
+DEFINE_string(input_path, "", "The prefixes file, e.g. generated/n12d5.pb.");
+DEFINE_int32(n, 0, "The number of channels.");
+DEFINE_int32(pairs, 1000000, "The number of pairs of output sets to test.");
+DEFINE_int32(seed, 0, "The random seed.");
+
+namespace {
+
+double Seconds(const std::function<void()> &f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+void Report(const std::string &name, double seconds, double baseline_seconds,
+            int count) {
+  LOG(INFO) << std::format("{:<24} {:8.1f} ns/op (std {:8.1f} ns/op) {:5.2f}x",
+                           name, seconds / count * 1e9,
+                           baseline_seconds / count * 1e9,
+                           baseline_seconds / seconds);
+}
+
+// Times the inclusion tests of the pairs with std::includes and
+// SortedIsSubset, and checks that they agree.
+void BenchmarkIncludes(
+    const std::string &name, const std::vector<std::vector<OutputType>> &sets,
+    const std::vector<std::pair<int, int>> &pairs) {
+  int64_t std_count = 0;
+  double std_seconds = Seconds([&]() {
+    for (auto [j, i] : pairs) {
+      std_count += std::includes(sets[i].begin(), sets[i].end(),
+                                 sets[j].begin(), sets[j].end());
+    }
+  });
+  int64_t count = 0;
+  double seconds = Seconds([&]() {
+    for (auto [j, i] : pairs) {
+      count += SortedIsSubset(sets[j], sets[i]);
+    }
+  });
+  CHECK_EQ(count, std_count);
+  Report(std::format("{} ({} hits)", name, count), seconds, std_seconds,
+         pairs.size());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  FLAGS_alsologtostderr = true;
+  FLAGS_log_dir = "/tmp";
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_EQ(argc, 1);
+  CHECK(!FLAGS_input_path.empty());
+  CHECK_GT(FLAGS_n, 0);
+  int n = FLAGS_n;
+
+  std::vector<Network> networks = LoadFromProtoFile(FLAGS_input_path, n);
+  std::vector<std::vector<OutputType>> sets;
+  for (const Network &network : networks) {
+    sets.push_back(SortByWeight(n, network.outputs).first);
+  }
+  LOG(INFO) << std::format("Loaded {} output sets", sets.size());
+  CHECK_GE(sets.size(), 2);
+
+  // Pairs (j, i) with |set j| <= |set i|.
+  std::mt19937 gen(FLAGS_seed);
+  std::uniform_int_distribution<int> dist(0, sets.size() - 1);
+  std::vector<std::pair<int, int>> pairs;
+  for (int k = 0; k < FLAGS_pairs; k++) {
+    int j = dist(gen);
+    int i = dist(gen);
+    if (sets[j].size() > sets[i].size()) {
+      std::swap(i, j);
+    }
+    pairs.emplace_back(j, i);
+  }
+  BenchmarkIncludes("includes", sets, pairs);
+
+  // The pairs that FindRedundantOutputs still tests after the invariants and
+  // the subset signatures.
+  std::vector<internal::OutputsInvariants> invariants;
+  int64_t max_size = 0;
+  for (const auto &set : sets) {
+    invariants.push_back(internal::ComputeInvariants(n, set));
+    max_size = std::max<int64_t>(max_size, set.size());
+  }
+  internal::SubsetSignatures signatures(sets.size(), max_size);
+  for (int i = 0; i < sets.size(); i++) {
+    signatures.Compute(i, sets[i]);
+  }
+  std::vector<std::pair<int, int>> filtered_pairs;
+  for (int i = 0; i < sets.size(); i++) {
+    for (int j = 0; j < sets.size(); j++) {
+      if (j != i && sets[j].size() <= sets[i].size() &&
+          internal::InvariantsAllowSubset(n, invariants[j], invariants[i]) &&
+          signatures.AllowsSubset(j, i)) {
+        filtered_pairs.emplace_back(j, i);
+      }
+    }
+  }
+  LOG(INFO) << std::format("{} filtered pairs ({}-bit signatures)",
+                           filtered_pairs.size(), signatures.num_bits());
+  if (!filtered_pairs.empty()) {
+    std::vector<std::pair<int, int>> repeated_pairs;
+    while (repeated_pairs.size() < FLAGS_pairs) {
+      repeated_pairs.insert(repeated_pairs.end(), filtered_pairs.begin(),
+                            filtered_pairs.end());
+    }
+    BenchmarkIncludes("includes filtered", sets, repeated_pairs);
+  }
+
+  // Projections to the first pos channels, with duplicates.
+  for (int pos : {n / 4, n / 2}) {
+    OutputType mask = (OutputType(1) << pos) - 1;
+    std::vector<std::vector<OutputType>> projections;
+    for (const auto &set : sets) {
+      std::vector<OutputType> projection;
+      for (OutputType x : set) {
+        projection.push_back(x & mask);
+      }
+      std::sort(projection.begin(), projection.end());
+      projections.push_back(std::move(projection));
+    }
+    BenchmarkIncludes(std::format("includes pos={}", pos), projections,
+                      pairs);
+  }
+
+  // Lookups as in IsSymmetric.
+  int64_t std_count = 0;
+  double std_seconds = Seconds([&]() {
+    for (const auto &set : sets) {
+      for (OutputType x : set) {
+        std_count += std::binary_search(set.begin(), set.end(),
+                                        ReflectAndInvert(n, x));
+      }
+    }
+  });
+  int64_t count = 0;
+  double seconds = Seconds([&]() {
+    for (const auto &set : sets) {
+      for (OutputType x : set) {
+        count += SortedContains(set, ReflectAndInvert(n, x));
+      }
+    }
+  });
+  CHECK_EQ(count, std_count);
+  int64_t num_outputs = 0;
+  for (const auto &set : sets) {
+    num_outputs += set.size();
+  }
+  Report("contains", seconds, std_seconds, num_outputs);
+  return 0;
+}
@@ -0,0 +1,119 @@
+#include "sorted_set.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Returns a sorted array of size elements in [0, max_value]. If unique is
+// true, the elements are distinct.
+std::vector<uint32_t> RandomSorted(int size, uint32_t max_value, bool unique,
+                                   std::mt19937 *gen) {
+  std::uniform_int_distribution<uint32_t> dist(0, max_value);
+  std::vector<uint32_t> result;
+  for (int i = 0; i < size; i++) {
+    result.push_back(dist(*gen));
+  }
+  std::sort(result.begin(), result.end());
+  if (unique) {
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+  }
+  return result;
+}
+
+// Returns a random subsequence of set.
+std::vector<uint32_t> RandomSubsequence(const std::vector<uint32_t> &set,
+                                        int size, std::mt19937 *gen) {
+  std::vector<uint32_t> result;
+  std::sample(set.begin(), set.end(), std::back_inserter(result), size, *gen);
+  return result;
+}
+
+TEST(SortedSetTest, Empty) {
+  std::vector<uint32_t> empty;
+  std::vector<uint32_t> set = {1, 2, 3};
+  EXPECT_TRUE(SortedIsSubset(empty, empty));
+  EXPECT_TRUE(SortedIsSubset(empty, set));
+  EXPECT_FALSE(SortedIsSubset(set, empty));
+  EXPECT_FALSE(SortedContains(empty, 1));
+  EXPECT_EQ(SortedIntersectionSize(empty, set), 0);
+  EXPECT_EQ(SortedDifference(set, empty), set);
+  EXPECT_EQ(SortedDifference(empty, set), empty);
+  EXPECT_EQ(SortedMergeUnique(empty, set), set);
+}
+
+TEST(SortedSetTest, Multiplicity) {
+  std::vector<uint32_t> a = {1, 1, 2};
+  std::vector<uint32_t> b = {1, 2, 2, 3};
+  EXPECT_FALSE(SortedIsSubset(a, b));
+  EXPECT_TRUE(SortedIsSubset(std::vector<uint32_t>{1, 2, 2}, b));
+  EXPECT_EQ(SortedDifference(a, b), std::vector<uint32_t>({1}));
+  EXPECT_EQ(SortedMergeUnique(a, b), std::vector<uint32_t>({1, 2, 3}));
+}
+
+TEST(SortedSetTest, LargeValues) {
+  std::vector<uint32_t> set = {0, 1, 0x7fffffff, 0x80000000, 0xfffffffe,
+                               0xffffffff};
+  for (uint32_t x : set) {
+    EXPECT_TRUE(SortedContains(set, x));
+  }
+  EXPECT_FALSE(SortedContains(set, 2));
+  EXPECT_FALSE(SortedContains(set, 0x80000001));
+  std::vector<uint32_t> subset = {0x7fffffff, 0xffffffff};
+  EXPECT_TRUE(SortedIsSubset(subset, set));
+}
+
+TEST(SortedSetTest, MatchesStandardAlgorithms) {
+  std::mt19937 gen(0);
+  for (int trial = 0; trial < 2000; trial++) {
+    std::uniform_int_distribution<int> size_dist(0, trial % 2 ? 40 : 2000);
+    // Small values give duplicates and overlaps, large values sparse sets.
+    uint32_t max_value = trial % 3 == 0 ? 100 : 0xffffffff;
+    bool unique = trial % 5 != 0;
+    std::vector<uint32_t> b =
+        RandomSorted(size_dist(gen), max_value, unique, &gen);
+    std::vector<uint32_t> a =
+        trial % 4 == 0 ? RandomSorted(size_dist(gen), max_value, unique, &gen)
+                       : RandomSubsequence(b, size_dist(gen), &gen);
+    if (trial % 4 == 1 && !a.empty()) {
+      // Nearly a subset.
+      a[gen() % a.size()] ^= 1;
+      std::sort(a.begin(), a.end());
+      if (unique) {
+        a.erase(std::unique(a.begin(), a.end()), a.end());
+      }
+    }
+
+    ASSERT_EQ(SortedIsSubset(a, b),
+              std::includes(b.begin(), b.end(), a.begin(), a.end()))
+        << "trial=" << trial;
+    std::vector<uint32_t> expected;
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(expected));
+    ASSERT_EQ(SortedDifference(a, b), expected) << "trial=" << trial;
+    expected.clear();
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                   std::back_inserter(expected));
+    expected.erase(std::unique(expected.begin(), expected.end()),
+                   expected.end());
+    ASSERT_EQ(SortedMergeUnique(a, b), expected) << "trial=" << trial;
+    if (unique) {
+      expected.clear();
+      std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                            std::back_inserter(expected));
+      ASSERT_EQ(SortedIntersectionSize(a, b), expected.size())
+          << "trial=" << trial;
+    }
+    for (uint32_t x : a) {
+      ASSERT_EQ(SortedContains(b, x), std::binary_search(b.begin(), b.end(), x))
+          << "trial=" << trial;
+    }
+  }
+}
+
+} // namespace
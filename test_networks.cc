@@ -0,0 +1,36 @@
+#include "test_networks.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "canonical_form.h"
+#include "network_utils.h"
+
+Network RandomNetwork(int n, int depth, std::mt19937 *gen) {
+  Network network(n, depth);
+  std::vector<int> channels(n);
+  std::iota(channels.begin(), channels.end(), 0);
+  for (Layer &layer : network.layers) {
+    std::shuffle(channels.begin(), channels.end(), *gen);
+    int num_comparators = 1 + (*gen)() % (n / 2);
+    for (int k = 0; k < num_comparators; k++) {
+      int i = channels[2 * k];
+      int j = channels[2 * k + 1];
+      layer.matching[i] = j;
+      layer.matching[j] = i;
+    }
+  }
+  network.outputs = NetworkOutputs(network);
+  return network;
+}
+
+std::vector<std::vector<OutputType>> Forms(const std::vector<Network> &networks,
+                                           bool symmetric) {
+  std::vector<std::vector<OutputType>> forms;
+  for (const Network &network : networks) {
+    forms.push_back(
+        CanonicalFormUpToInverse(network.n, network.outputs, symmetric));
+  }
+  std::sort(forms.begin(), forms.end());
+  return forms;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "network.h"
+#include "output_type.h"
+
+// Networks for the tests.
+
+// Returns a network of random layers with its outputs.
+Network RandomNetwork(int n, int depth, std::mt19937 *gen);
+
+// The sorted canonical forms of the outputs, which identify the networks up
+// to isomorphism.
+std::vector<std::vector<OutputType>> Forms(const std::vector<Network> &networks,
+                                           bool symmetric);
@@ -0,0 +1,422 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+DEFINE_int32(jobs, std::thread::hardware_concurrency(),
+             "The number of workers to use for parallel processing.");
+DEFINE_bool(pin_workers, false,
+            "Pin the workers to CPUs, filling one NUMA node after another.");
+DEFINE_double(memory_budget, 0,
+              "The memory in GiB that the tasks of the parallel stages may "
+              "reserve at the same time, from an estimate of their footprint. "
+              "The tasks wait for room in the budget before they start. 0 "
+              "means no limit.");
+
+namespace {
+
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local int current_worker_index = -1;
+// The number of MemoryBudget reservations made by the calling thread and not
+// released.
+thread_local int current_num_reservations = 0;
+// Whether the task running on the calling thread was started by a thread that
+// holds a reservation, so that its reservations are admitted at once.
+thread_local bool current_admit_at_once = false;
+
+struct Cpu {
+  int cpu = 0;
+  int node = 0;
+};
+
+// Parses a cpulist like "0-3,8,10-11".
+std::vector<int> ParseCpuList(const std::string &cpu_list) {
+  std::vector<int> cpus;
+  std::istringstream iss(cpu_list);
+  std::string range;
+  while (std::getline(iss, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    size_t dash = range.find('-');
+    int first = std::stoi(range.substr(0, dash));
+    int last = dash == std::string::npos ? first
+                                         : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+// Returns the CPUs ordered by NUMA node. Falls back to a single node with
+// hardware_concurrency() CPUs if the topology is unknown.
+std::vector<Cpu> CpusByNumaNode() {
+  std::vector<Cpu> cpus;
+#ifdef __linux__
+  for (int node = 0;; node++) {
+    std::ifstream file(
+        std::format("/sys/devices/system/node/node{}/cpulist", node));
+    if (!file.is_open()) {
+      break;
+    }
+    std::string cpu_list;
+    std::getline(file, cpu_list);
+    for (int cpu : ParseCpuList(cpu_list)) {
+      cpus.push_back({cpu, node});
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    int num_cpus = std::max<int>(1, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < num_cpus; cpu++) {
+      cpus.push_back({cpu, 0});
+    }
+  }
+  return cpus;
+}
+
+void PinCurrentThread(int cpu) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  int error =
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  LOG_IF(WARNING, error != 0) << "Failed to pin a worker to CPU " << cpu;
+#else
+  LOG(WARNING) << "Pinning workers is not supported on this platform";
+#endif
+}
+
+} // namespace
+
+ThreadPool::ThreadPool(int num_threads, bool pin_workers)
+    : workers_(num_threads) {
+  CHECK_GT(num_threads, 0);
+  std::vector<Cpu> cpus = CpusByNumaNode();
+  std::vector<int> nodes(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    const Cpu &cpu = cpus[i % cpus.size()];
+    nodes[i] = cpu.node;
+    if (pin_workers) {
+      workers_[i].cpu = cpu.cpu;
+    }
+  }
+  // Steal from the workers on the same node first, then from the others, each
+  // in round-robin order starting after the thief.
+  for (int i = 0; i < num_threads; i++) {
+    for (bool same_node : {true, false}) {
+      for (int k = 1; k < num_threads; k++) {
+        int victim = (i + k) % num_threads;
+        if ((nodes[victim] == nodes[i]) == same_node) {
+          workers_[i].victims.push_back(victim);
+        }
+      }
+    }
+  }
+  LOG(INFO) << "Starting a thread pool with " << num_threads << " workers"
+            << (pin_workers ? " pinned to CPUs" : "");
+  for (int i = 0; i < num_threads; i++) {
+    threads_.emplace_back([this, i]() { WorkerLoop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_ = true;
+  }
+  sleep_cv_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+ThreadPool &ThreadPool::Default() {
+  static ThreadPool *pool =
+      new ThreadPool(FLAGS_jobs > 0 ? FLAGS_jobs : 4, FLAGS_pin_workers);
+  return *pool;
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  int index = current_pool == this ? current_worker_index
+                                   : next_worker_.fetch_add(1) % num_threads();
+  {
+    std::lock_guard<std::mutex> lock(workers_[index].mutex);
+    workers_[index].tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    num_pending_.fetch_add(1);
+  }
+  sleep_cv_.notify_one();
+}
+
+bool ThreadPool::PopTask(int index, std::function<void()> *task) {
+  if (num_pending_.load() == 0) {
+    return false;
+  }
+  if (index >= 0) {
+    Worker &worker = workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      *task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      num_pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  int num_victims =
+      index >= 0 ? workers_[index].victims.size() : num_threads();
+  for (int k = 0; k < num_victims; k++) {
+    Worker &victim = workers_[index >= 0 ? workers_[index].victims[k] : k];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      num_pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::RunPendingTask() {
+  std::function<void()> task;
+  if (!PopTask(current_pool == this ? current_worker_index : -1, &task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+bool ThreadPool::IsWorkerThread() const { return current_pool == this; }
+
+void ThreadPool::WorkerLoop(int index) {
+  current_pool = this;
+  current_worker_index = index;
+  if (workers_[index].cpu >= 0) {
+    PinCurrentThread(workers_[index].cpu);
+  }
+  while (true) {
+    std::function<void()> task;
+    if (PopTask(index, &task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleep_cv_.wait(lock, [&]() { return stop_ || num_pending_.load() > 0; });
+    if (stop_ && num_pending_.load() == 0) {
+      return;
+    }
+  }
+}
+
+TaskGroup::TaskGroup(ThreadPool *pool, const TaskGroup *parent)
+    : pool_(pool), parent_(parent) {
+  CHECK_NOTNULL(pool_);
+}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+bool TaskGroup::IsCancelled() const {
+  return cancelled_.load(std::memory_order_relaxed) ||
+         (parent_ != nullptr && parent_->IsCancelled());
+}
+
+bool TaskGroup::RunPendingTask(PendingTasks *pending) {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(pending->mutex);
+    if (pending->tasks.empty()) {
+      return false;
+    }
+    task = std::move(pending->tasks.front());
+    pending->tasks.pop_front();
+  }
+  task();
+  return true;
+}
+
+void TaskGroup::Run(std::function<void()> task) {
+  num_unfinished_.fetch_add(1);
+  bool admit_at_once = current_admit_at_once || current_num_reservations > 0;
+  {
+    std::lock_guard<std::mutex> lock(pending_->mutex);
+    pending_->tasks.push_back([this, task = std::move(task), admit_at_once]() {
+      if (!IsCancelled()) {
+        bool outer_admit_at_once = current_admit_at_once;
+        current_admit_at_once = admit_at_once;
+        task();
+        current_admit_at_once = outer_admit_at_once;
+      }
+      // Notify under the lock: the group may be destroyed as soon as Wait()
+      // observes num_unfinished_ == 0.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (num_unfinished_.fetch_sub(1) == 1) {
+        done_cv_.notify_all();
+      }
+    });
+  }
+  pool_->Schedule([pending = pending_]() { RunPendingTask(pending.get()); });
+}
+
+void TaskGroup::Wait() {
+  if (pool_->IsWorkerThread()) {
+    // Help instead of blocking a worker, which could deadlock the pool. The
+    // other tasks of the pool are not run while the thread holds a
+    // reservation, since they could wait for it.
+    while (num_unfinished_.load() > 0) {
+      if (RunPendingTask(pending_.get())) {
+        continue;
+      }
+      if (current_num_reservations > 0 || !pool_->RunPendingTask()) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait_for(lock, std::chrono::milliseconds(1),
+                          [&]() { return num_unfinished_.load() == 0; });
+      }
+    }
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [&]() { return num_unfinished_.load() == 0; });
+}
+
+void ParallelFor(int begin, int end, const std::function<void(int)> &body,
+                 ThreadPool *pool, const TaskGroup *parent) {
+  if (begin >= end) {
+    return;
+  }
+  std::atomic<int> next_index(begin);
+  TaskGroup group(pool, parent);
+  auto runner = [&]() {
+    while (!group.IsCancelled()) {
+      int index = next_index.fetch_add(1);
+      if (index >= end) {
+        break;
+      }
+      body(index);
+    }
+  };
+  int num_runners = std::min(end - begin, pool->num_threads());
+  for (int r = 0; r < num_runners; r++) {
+    group.Run(runner);
+  }
+  group.Wait();
+}
+
+MemoryBudget::Reservation::Reservation(MemoryBudget *budget, int64_t bytes)
+    : budget_(budget), bytes_(bytes), thread_(std::this_thread::get_id()) {
+  current_num_reservations++;
+}
+
+MemoryBudget::Reservation::Reservation(Reservation &&other) noexcept
+    : budget_(other.budget_), bytes_(other.bytes_), thread_(other.thread_) {
+  other.budget_ = nullptr;
+}
+
+MemoryBudget::Reservation &
+MemoryBudget::Reservation::operator=(Reservation &&other) noexcept {
+  if (this != &other) {
+    Release();
+    budget_ = other.budget_;
+    bytes_ = other.bytes_;
+    thread_ = other.thread_;
+    other.budget_ = nullptr;
+  }
+  return *this;
+}
+
+void MemoryBudget::Reservation::Release() {
+  if (budget_ != nullptr) {
+    CHECK(thread_ == std::this_thread::get_id())
+        << "A reservation is released by another thread than the one that "
+           "made it";
+    current_num_reservations--;
+    budget_->Release(bytes_);
+    budget_ = nullptr;
+  }
+}
+
+MemoryBudget::MemoryBudget(int64_t capacity) : capacity_(capacity) {
+  CHECK_GE(capacity, 0);
+}
+
+MemoryBudget &MemoryBudget::Default() {
+  static MemoryBudget *budget = new MemoryBudget(
+      static_cast<int64_t>(std::max(0.0, FLAGS_memory_budget) * (1 << 30)));
+  return *budget;
+}
+
+MemoryBudget::Reservation MemoryBudget::Reserve(int64_t bytes) {
+  CHECK_GE(bytes, 0);
+  if (capacity_ == 0) {
+    return Reservation();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_reservations_++;
+  auto fits = [&]() {
+    return reserved_ == 0 || reserved_ + bytes <= capacity_;
+  };
+  if (!current_admit_at_once &&
+      (admitted_ticket_ < next_ticket_ || !fits())) {
+    auto start = std::chrono::steady_clock::now();
+    int64_t ticket = next_ticket_++;
+    admitted_cv_.wait(lock,
+                      [&]() { return admitted_ticket_ == ticket && fits(); });
+    admitted_ticket_++;
+    // The next ticket may fit as well.
+    admitted_cv_.notify_all();
+    num_delayed_++;
+    delay_seconds_ += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  }
+  reserved_ += bytes;
+  peak_reserved_ = std::max(peak_reserved_, reserved_);
+  return Reservation(this, bytes);
+}
+
+void MemoryBudget::Release(int64_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reserved_ -= bytes;
+  }
+  admitted_cv_.notify_all();
+}
+
+int64_t MemoryBudget::reserved() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return reserved_;
+}
+
+void MemoryBudget::LogAdmissionDelay(const std::string &stage) {
+  if (capacity_ == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  constexpr double kMiB = 1 << 20;
+  LOG(INFO) << std::format(
+      "{}: {} of {} tasks waited {:.3f} s in total for the memory budget, "
+      "peak {:.1f} MiB of {:.1f} MiB",
+      stage, num_delayed_, num_reservations_, delay_seconds_,
+      peak_reserved_ / kMiB, capacity_ / kMiB);
+  num_reservations_ = 0;
+  num_delayed_ = 0;
+  delay_seconds_ = 0;
+  peak_reserved_ = reserved_;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gflags/gflags.h"
+
+// The number of workers of the process-wide thread pool.
+DECLARE_int32(jobs);
+// Whether to pin the workers of the process-wide thread pool to CPUs.
+DECLARE_bool(pin_workers);
+// The memory in GiB of the process-wide memory budget, 0 for no limit.
+DECLARE_double(memory_budget);
+
+// A work-stealing thread pool shared by all parallel stages of the program.
+//
+// Each worker owns a deque of tasks. A worker runs tasks from the back of its
+// own deque and, when it is empty, steals from the front of the other workers'
+// deques, trying the workers on its own NUMA node first. Tasks scheduled from
+// outside the pool are distributed round-robin over the deques.
+//
+// A worker that waits for other tasks (TaskGroup::Wait, ParallelFor) keeps
+// running pending tasks instead of blocking, so nested parallelism neither
+// deadlocks nor starts more threads than the pool has. A worker that holds a
+// MemoryBudget reservation only runs the tasks of the group it waits for.
+class ThreadPool {
+public:
+  // Starts num_threads workers. If pin_workers is true, worker i is pinned to
+  // the i-th CPU, where the CPUs are ordered by NUMA node, so that neighbouring
+  // workers (which steal from each other first) share a node.
+  explicit ThreadPool(int num_threads, bool pin_workers = false);
+  // Runs the remaining tasks and joins the workers.
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Returns the process-wide pool with --jobs workers. It is created on first
+  // use, i.e. after the command line flags are parsed.
+  static ThreadPool &Default();
+
+  // Returns the number of workers.
+  int num_threads() const { return workers_.size(); }
+  // Schedules a task to run on one of the workers.
+  void Schedule(std::function<void()> task);
+  // Runs one pending task on the calling thread.
+  // Returns false if there is no pending task.
+  bool RunPendingTask();
+  // Returns true if the calling thread is a worker of this pool.
+  bool IsWorkerThread() const;
+
+private:
+  struct alignas(64) Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+    // The worker indices to steal from, in order of preference.
+    std::vector<int> victims;
+    int cpu = -1;
+  };
+
+  void WorkerLoop(int index);
+  // Pops a task from the worker's own deque or steals one from the others.
+  // index = -1 means that the caller is not a worker.
+  bool PopTask(int index, std::function<void()> *task);
+
+  std::vector<Worker> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<int> next_worker_{0};
+  // The number of tasks in all deques. Guarded by sleep_mutex_ for writes, so
+  // that a sleeping worker cannot miss a new task.
+  std::atomic<int> num_pending_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  bool stop_ = false;
+};
+
+// A set of tasks that are waited for and cancelled together.
+class TaskGroup {
+public:
+  // If parent is not null, the group is also cancelled when the parent is.
+  explicit TaskGroup(ThreadPool *pool = &ThreadPool::Default(),
+                     const TaskGroup *parent = nullptr);
+  // Waits for all tasks.
+  ~TaskGroup();
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  ThreadPool *pool() const { return pool_; }
+  // Schedules a task. The task is skipped if the group is cancelled before the
+  // task starts. Running tasks should poll IsCancelled() to stop early.
+  void Run(std::function<void()> task);
+  // Waits until all tasks have finished or have been skipped. A worker thread
+  // runs the pending tasks of the group while waiting, and then the other
+  // pending tasks of the pool unless it holds a MemoryBudget reservation.
+  void Wait();
+  // Cancels the tasks that have not started yet.
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool IsCancelled() const;
+
+private:
+  // The tasks of the group that have not started. They are run by the pool
+  // tasks scheduled by Run, or by Wait, whichever comes first, so the pool
+  // tasks share them and may outlive the group.
+  struct PendingTasks {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // Runs a pending task on the calling thread. Returns false if there is none.
+  static bool RunPendingTask(PendingTasks *pending);
+
+  ThreadPool *pool_ = nullptr;
+  const TaskGroup *parent_ = nullptr;
+  std::shared_ptr<PendingTasks> pending_ = std::make_shared<PendingTasks>();
+  std::atomic<bool> cancelled_{false};
+  std::atomic<int> num_unfinished_{0};
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
+};
+
+// Calls body(i) for each i in [begin, end) on the pool and waits for all of
+// them. The indices are handed out one at a time in increasing order, so that
+// the bodies start roughly in index order and expensive indices are balanced
+// over the workers. The remaining indices are skipped once parent is cancelled.
+void ParallelFor(int begin, int end, const std::function<void(int)> &body,
+                 ThreadPool *pool = &ThreadPool::Default(),
+                 const TaskGroup *parent = nullptr);
+
+// Limits the memory of the tasks of the parallel stages that run at the same
+// time. A task reserves its estimated footprint before it starts, and waits
+// until the reservations of the running tasks leave room for it, so that fewer
+// tasks run at a time when each of them is large. The waiting tasks are
+// admitted in order, and a task larger than the whole budget runs alone.
+//
+// The tasks of a TaskGroup (or ParallelFor) started by a thread that holds a
+// reservation are admitted at once, wherever they run: the reservation is only
+// released once they finish, so they could wait for it forever. The budget may
+// be exceeded by these tasks, so a task that holds a reservation should not
+// wait for tasks that reserve more. For the same reason, a worker that holds a
+// reservation does not run the unrelated tasks of the pool while it waits.
+//
+// The budget covers the memory while it is reserved: the memory that a task
+// hands to its caller should be reserved by the caller for as long as it is
+// kept. A reservation is released by the thread that made it.
+class MemoryBudget {
+public:
+  // The memory of the reservations that are released together.
+  class Reservation {
+  public:
+    Reservation() = default;
+    Reservation(Reservation &&other) noexcept;
+    Reservation &operator=(Reservation &&other) noexcept;
+    // Releases the memory.
+    ~Reservation() { Release(); }
+
+    void Release();
+
+  private:
+    friend class MemoryBudget;
+    Reservation(MemoryBudget *budget, int64_t bytes);
+
+    MemoryBudget *budget_ = nullptr;
+    int64_t bytes_ = 0;
+    std::thread::id thread_;
+  };
+
+  // capacity is in bytes. A capacity of 0 admits every task at once.
+  explicit MemoryBudget(int64_t capacity);
+  MemoryBudget(const MemoryBudget &) = delete;
+  MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+  // Returns the process-wide budget of --memory_budget.
+  static MemoryBudget &Default();
+
+  // Waits until bytes can be reserved, and reserves them.
+  [[nodiscard]] Reservation Reserve(int64_t bytes);
+
+  int64_t capacity() const { return capacity_; }
+  int64_t reserved() const;
+  // Logs how long the reservations since the last call waited to be admitted,
+  // as the delay of a stage, and resets the counts. Nothing is logged without
+  // a limit.
+  void LogAdmissionDelay(const std::string &stage);
+
+private:
+  void Release(int64_t bytes);
+
+  const int64_t capacity_;
+  mutable std::mutex mutex_;
+  std::condition_variable admitted_cv_;
+  int64_t reserved_ = 0;
+  // The waiting reservations take tickets and are admitted in ticket order.
+  int64_t next_ticket_ = 0;
+  int64_t admitted_ticket_ = 0;
+  // Since the last LogAdmissionDelay.
+  int64_t num_reservations_ = 0;
+  int64_t num_delayed_ = 0;
+  double delay_seconds_ = 0;
+  int64_t peak_reserved_ = 0;
+};
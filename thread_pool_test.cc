@@ -0,0 +1,197 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(ThreadPoolTest, ParallelForVisitsEachIndexOnce) {
+  ThreadPool pool(4);
+  std::vector<std::atomic<int>> visits(1000);
+  ParallelFor(0, visits.size(), [&](int i) { visits[i].fetch_add(1); }, &pool);
+  for (int i = 0; i < visits.size(); i++) {
+    EXPECT_EQ(visits[i].load(), 1) << "i=" << i;
+  }
+}
+
+TEST(ThreadPoolTest, ParallelForEmptyRange) {
+  ThreadPool pool(2);
+  int calls = 0;
+  ParallelFor(5, 5, [&](int) { calls++; }, &pool);
+  ParallelFor(5, 3, [&](int) { calls++; }, &pool);
+  EXPECT_EQ(calls, 0);
+}
+
+TEST(ThreadPoolTest, NestedParallelForDoesNotDeadlock) {
+  // More outer iterations than workers: every worker blocks in an inner
+  // ParallelFor, so the workers have to run the inner bodies themselves.
+  ThreadPool pool(2);
+  std::atomic<int> sum(0);
+  ParallelFor(
+      0, 8,
+      [&](int i) {
+        ParallelFor(0, 100, [&](int j) { sum.fetch_add(1); }, &pool);
+      },
+      &pool);
+  EXPECT_EQ(sum.load(), 800);
+}
+
+TEST(ThreadPoolTest, TaskGroupWait) {
+  ThreadPool pool(3);
+  std::atomic<int> count(0);
+  TaskGroup group(&pool);
+  for (int i = 0; i < 50; i++) {
+    group.Run([&]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      count.fetch_add(1);
+    });
+  }
+  group.Wait();
+  EXPECT_EQ(count.load(), 50);
+}
+
+TEST(ThreadPoolTest, TaskGroupCancelSkipsPendingTasks) {
+  ThreadPool pool(1);
+  std::atomic<int> count(0);
+  TaskGroup group(&pool);
+  for (int i = 0; i < 100; i++) {
+    group.Run([&]() {
+      if (count.fetch_add(1) == 9) {
+        group.Cancel();
+      }
+    });
+  }
+  group.Wait();
+  EXPECT_TRUE(group.IsCancelled());
+  EXPECT_EQ(count.load(), 10);
+}
+
+TEST(ThreadPoolTest, ParallelForStopsWhenParentIsCancelled) {
+  ThreadPool pool(2);
+  TaskGroup parent(&pool);
+  std::atomic<int> count(0);
+  ParallelFor(
+      0, 100000,
+      [&](int i) {
+        if (count.fetch_add(1) == 100) {
+          parent.Cancel();
+        }
+      },
+      &pool, &parent);
+  EXPECT_TRUE(parent.IsCancelled());
+  EXPECT_LT(count.load(), 100000);
+}
+
+TEST(ThreadPoolTest, PinnedWorkers) {
+  ThreadPool pool(2, true);
+  std::atomic<int> sum(0);
+  ParallelFor(0, 10, [&](int i) { sum.fetch_add(i); }, &pool);
+  EXPECT_EQ(sum.load(), 45);
+}
+
+TEST(ThreadPoolTest, DefaultPoolUsesJobsFlag) {
+  EXPECT_EQ(ThreadPool::Default().num_threads(),
+            FLAGS_jobs > 0 ? FLAGS_jobs : 4);
+  EXPECT_FALSE(ThreadPool::Default().IsWorkerThread());
+}
+
+TEST(MemoryBudgetTest, LimitsTheReservedMemory) {
+  ThreadPool pool(8);
+  MemoryBudget budget(100);
+  std::atomic<int> num_running(0);
+  std::atomic<int> max_running(0);
+  ParallelFor(
+      0, 64,
+      [&](int i) {
+        MemoryBudget::Reservation reservation = budget.Reserve(40);
+        int running = num_running.fetch_add(1) + 1;
+        int max = max_running.load();
+        while (running > max &&
+               !max_running.compare_exchange_weak(max, running)) {
+        }
+        EXPECT_LE(budget.reserved(), 100);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        num_running.fetch_sub(1);
+      },
+      &pool);
+  EXPECT_LE(max_running.load(), 2);
+  EXPECT_EQ(budget.reserved(), 0);
+}
+
+TEST(MemoryBudgetTest, LargeReservationRunsAlone) {
+  MemoryBudget budget(100);
+  {
+    MemoryBudget::Reservation reservation = budget.Reserve(1000);
+    EXPECT_EQ(budget.reserved(), 1000);
+    MemoryBudget::Reservation moved = std::move(reservation);
+    reservation.Release();
+    EXPECT_EQ(budget.reserved(), 1000);
+  }
+  EXPECT_EQ(budget.reserved(), 0);
+}
+
+TEST(MemoryBudgetTest, NestedReservationsDoNotDeadlock) {
+  // Each outer body holds the whole budget while it waits for the inner
+  // loop, during which its worker may run the bodies of the second loop.
+  ThreadPool pool(2);
+  MemoryBudget budget(10);
+  std::atomic<int> sum(0);
+  ParallelFor(
+      0, 8,
+      [&](int i) {
+        MemoryBudget::Reservation reservation = budget.Reserve(10);
+        ParallelFor(0, 100, [&](int j) { sum.fetch_add(1); }, &pool);
+      },
+      &pool);
+  EXPECT_EQ(sum.load(), 800);
+}
+
+TEST(MemoryBudgetTest, HoldersOnlyBypassTheBudgetForTheirOwnTasks) {
+  // Each holder takes the whole budget and waits for its own reserving tasks,
+  // which are admitted at once, while the bodies of an unrelated loop wait for
+  // room: a waiting holder must not run them on its thread.
+  ThreadPool pool(4);
+  MemoryBudget budget(100);
+  std::atomic<int> num_holders(0);
+  std::atomic<int> num_own_tasks(0);
+  std::atomic<int> num_bodies(0);
+  TaskGroup holders(&pool);
+  for (int k = 0; k < 8; k++) {
+    holders.Run([&]() {
+      MemoryBudget::Reservation reservation = budget.Reserve(100);
+      num_holders.fetch_add(1);
+      ParallelFor(
+          0, 8,
+          [&](int i) {
+            MemoryBudget::Reservation own_reservation = budget.Reserve(10);
+            num_own_tasks.fetch_add(1);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+          },
+          &pool);
+      num_holders.fetch_sub(1);
+    });
+  }
+  ParallelFor(
+      0, 64,
+      [&](int i) {
+        MemoryBudget::Reservation reservation = budget.Reserve(60);
+        EXPECT_EQ(num_holders.load(), 0);
+        num_bodies.fetch_add(1);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      },
+      &pool);
+  holders.Wait();
+  EXPECT_EQ(num_own_tasks.load(), 64);
+  EXPECT_EQ(num_bodies.load(), 64);
+  EXPECT_EQ(budget.reserved(), 0);
+}
+
+TEST(MemoryBudgetTest, NoLimit) {
+  MemoryBudget budget(0);
+  MemoryBudget::Reservation a = budget.Reserve(int64_t(1) << 40);
+  MemoryBudget::Reservation b = budget.Reserve(int64_t(1) << 40);
+  EXPECT_EQ(budget.reserved(), 0);
+}